@@ -2,23 +2,76 @@
 #define PRIORITY_BUFFER_H
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
-#include <fstream>
+#include <cstdint>
+#include <deque>
 #include <functional>
-#include <map>
+#include <iterator>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <random>
-#include <sstream>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "prioritydb.h"
 #include "priorityfs.h"
+#include "priorityring.h"
 
 #define DEFAULT_MAX_BUFFER_SIZE 100000000LL
 #define DEFAULT_MAX_MEMORY_SIZE 50
+#define DEFAULT_MAX_SPILL_BACKLOG 1000
+// Messages the background thread writes to disk, or evicts from it, in one batch
+#define MAX_SPILL_BATCH 64
+#define DEFAULT_INGRESS_CAPACITY 1024
+// Bounds on how long a consumer spins for a message before it parks, in pause instructions
+#define MIN_WAIT_SPINS 16
+#define MAX_WAIT_SPINS 4096
+// Spins between looks at the clock while a timed pop spins for a message
+#define WAIT_SPINS_PER_CLOCK 64
+
+
+// What Push does when the ingress ring is full: wait for the drainer to make room, retry until
+// there is room, or skip the ring and push under the lock
+enum class PriorityIngressPolicy { BLOCK, SPIN, SPILL };
+
+// What TryPop, TryPopFor and PopUntil did. UNREADABLE means that the highest message was taken
+// but could not be read back from disk, and CLOSED that the buffer is closed and empty.
+enum class PriorityPopStatus { OK, EMPTY, TIMEOUT, CLOSED, UNREADABLE };
+
+// The lowest priorities of the messages that a buffer holds in memory and on disk, or the largest
+// priority there is if it holds none there
+struct PriorityTails {
+    PriorityTails()
+            : memory{std::numeric_limits<unsigned long long>::max()},
+              disk{std::numeric_limits<unsigned long long>::max()} {}
+
+    std::atomic<unsigned long long> memory;
+    std::atomic<unsigned long long> disk;
+};
+
+// Running totals of what buffers that share their limits hold on disk and in memory. Each buffer
+// adds and takes away its own share under its own lock, and holds the totals to its limits.
+//
+// Only the buffer with the lowest priority message of a tier spills or evicts from it, going by
+// the tails that each buffer publishes, in the order they were made, whenever it commits. Any
+// other buffer that finds the totals over a limit marks the budget as unmet instead, for whoever
+// shares it to have the buffer with the lowest priority message make room.
+struct PriorityBudget {
+    PriorityBudget() : disk_size{0}, memory_size{0}, memory_messages{0}, unmet{false} {}
+
+    std::atomic<unsigned long long> disk_size;
+    std::atomic<unsigned long long> memory_size;
+    std::atomic<long long> memory_messages;
+    std::deque<PriorityTails> tails;
+    std::atomic<bool> unmet;
+};
 
 
 template <typename T>
@@ -26,41 +79,47 @@ class PriorityBuffer {
     typedef std::function<unsigned long long(const T&)> PriorityFunction;
 
   public:
-    PriorityBuffer()
-            : make_priority_{epoch_priority_}, fs_{"prism_buffer", std::string{}},
-              db_{DEFAULT_MAX_BUFFER_SIZE, fs_.GetFilePath("prism_data.db")},
-              max_memory_{DEFAULT_MAX_MEMORY_SIZE}, fuzzer_{0, 0} {
-        srand(std::chrono::steady_clock::now().time_since_epoch().count());
-    }
+    PriorityBuffer() : PriorityBuffer{epoch_priority_} {}
 
     PriorityBuffer(PriorityFunction make_priority)
-            : make_priority_{make_priority}, fs_{"prism_buffer", std::string{}},
-              db_{DEFAULT_MAX_BUFFER_SIZE, fs_.GetFilePath("prism_data.db")},
-              max_memory_{DEFAULT_MAX_MEMORY_SIZE}, fuzzer_{0, 0} {
-        srand(std::chrono::steady_clock::now().time_since_epoch().count());
-    }
+            : PriorityBuffer{make_priority, DEFAULT_MAX_BUFFER_SIZE, DEFAULT_MAX_MEMORY_SIZE} {}
 
     PriorityBuffer(PriorityFunction make_priority, const unsigned long long& buffer_size,
-                   const int& max_memory)
-            : make_priority_{make_priority}, fs_{"prism_buffer", std::string{}},
-              db_{buffer_size, fs_.GetFilePath("prism_data.db")}, max_memory_{max_memory}, 
-              fuzzer_{0, 0} {
-        srand(std::chrono::steady_clock::now().time_since_epoch().count());
-    }
+                   const int& max_memory, const PriorityDBOptions& db_options=PriorityDBOptions{},
+                   const PriorityFSOptions& fs_options=PriorityFSOptions{})
+            : PriorityBuffer{make_priority, std::string{}, buffer_size, max_memory, db_options,
+                             fs_options} {}
 
     PriorityBuffer(PriorityFunction make_priority, const std::string& buffer_root,
-                   const unsigned long long& buffer_size, const int& max_memory)
-            : make_priority_{make_priority}, fs_{"prism_buffer", std::string{buffer_root}},
-              db_{buffer_size, fs_.GetFilePath("prism_data.db")}, max_memory_{max_memory}, 
-              fuzzer_{0, 0} {
-        srand(std::chrono::steady_clock::now().time_since_epoch().count());
-    }
+                   const unsigned long long& buffer_size, const int& max_memory,
+                   const PriorityDBOptions& db_options=PriorityDBOptions{},
+                   const PriorityFSOptions& fs_options=PriorityFSOptions{})
+            : PriorityBuffer{make_priority, buffer_root, "prism_buffer", buffer_size, max_memory,
+                             db_options, fs_options} {}
 
     ~PriorityBuffer() {
+        stop_ingress_();
+        stop_promoter_();
+        stop_writer_();
+        PriorityDBTransaction transaction{db_};
+        std::vector<std::pair<unsigned long long, const T*>> messages;
         for (auto object = objects_.begin(); object != objects_.end(); ++object) {
-            auto hash = object->first;
-            save_to_disk(object->second, hash);
+            messages.emplace_back(object->first, object->second.message.get());
+        }
+        save_to_disk(messages);
+        transaction.Commit();
+        // There is no one left to report a failed sync to. The index is committed regardless,
+        // since messages that did not make it to disk are dropped as unreadable once popped.
+        fs_.Sync();
+        db_.Flush();
+
+        if (tails_) {
+            tails_->memory = std::numeric_limits<unsigned long long>::max();
+            tails_->disk = std::numeric_limits<unsigned long long>::max();
         }
+        budget_->disk_size -= disk_size_;
+        budget_->memory_size -= memory_size_;
+        budget_->memory_messages -= objects_.size();
     }
 
     void SetFuzz(const unsigned long& fuzz_lower_ms, const unsigned long& fuzz_upper_ms) {
@@ -68,126 +127,1224 @@ class PriorityBuffer {
         fuzzer_ = std::uniform_int_distribution<unsigned long>{fuzz_lower_ms, fuzz_upper_ms};
     }
 
-    void Push(T& t) {
+    // Once the messages in memory take up more than high_bytes, the lowest priority ones are
+    // spilled to disk until they take up no more than low_bytes. A high_bytes of 0 turns the byte
+    // budget off, which leaves only max_memory to limit the number of messages in memory.
+    void SetMemoryBudget(const unsigned long long& high_bytes,
+                         const unsigned long long& low_bytes) {
         std::lock_guard<std::mutex> lock(mutex_);
-        auto hash = make_hash_();
-        auto size = get_size_(t);
-        db_.Insert(make_priority_(t), hash, size);
-        objects_.emplace(hash, std::move(t));
+        memory_high_bytes_ = high_bytes;
+        memory_low_bytes_ = std::min(low_bytes, high_bytes);
+    }
 
-        while (objects_.size() > max_memory_) {
-            auto lowest_hash = db_.GetLowestMemoryHash();
-            auto find = objects_.find(lowest_hash);
-            if (find != objects_.end()) {
-                auto object = find->second;
-                save_to_disk(object, lowest_hash);
-                objects_.erase(lowest_hash);
+    // With a nonzero window, index changes made by Push and Pop calls from any thread within
+    // window_ms of each other are committed together. Each call still returns only once its
+    // change has been committed.
+    void SetGroupCommit(const unsigned long& window_ms) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        group_commit_window_ = std::chrono::milliseconds{window_ms};
+    }
+
+    // Hands spilling to disk and evicting from disk to a background thread, so that Push only
+    // touches memory. max_memory and the memory budget become targets for that thread rather than
+    // limits. Push blocks once the thread has fallen more than max_backlog spills behind.
+    void SetBackgroundSpill(const bool& enabled, const int& max_backlog=DEFAULT_MAX_SPILL_BACKLOG) {
+        stop_writer_();
+        if (enabled) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            background_spill_ = true;
+            max_spill_backlog_ = max_backlog;
+            writer_ = std::thread{&PriorityBuffer::write_loop_, this};
+        }
+    }
+
+    // Starts a background thread that reads the depth highest priority messages back from disk
+    // ahead of Pop, so that Pop rarely has to wait for a file. depth should stay well within
+    // max_memory and the memory budget, or prefetched messages are spilled again. 0 turns
+    // prefetching off.
+    void SetPrefetch(const int& depth) {
+        stop_promoter_();
+        if (depth > 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            prefetch_depth_ = depth;
+            promoter_ = std::thread{&PriorityBuffer::promote_loop_, this};
+        }
+    }
+
+    // Puts a lock-free ring of capacity messages in front of the buffer. Push then only hands its
+    // message to the ring, and a background thread moves them into the buffer in batches, so that
+    // producers don't wait for a Pop that is reading from disk. Pop takes in what is in the ring
+    // before it looks for the highest message. policy says what Push does when the ring is full.
+    // 0 turns the ring off. Must not be called while other threads push.
+    void SetIngress(const size_t& capacity=DEFAULT_INGRESS_CAPACITY,
+                    const PriorityIngressPolicy& policy=PriorityIngressPolicy::BLOCK) {
+        stop_ingress_();
+        if (capacity > 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ingress_.reset(new PriorityRing<Incoming>{capacity});
+            ingress_policy_ = policy;
+            ingress_open_ = true;
+            drainer_ = std::thread{&PriorityBuffer::drain_loop_, this};
+        }
+    }
+
+    // Messages that were found corrupt on disk and dropped, so far. Pop returns nullptr for them.
+    unsigned long long GetCorruptMessages() {
+        return fs_.GetCorruptRecords();
+    }
+
+    void Push(std::unique_ptr<T> t) {
+        if (!t) {
+            return;
+        }
+
+        auto priority = make_priority_(*t);
+        Incoming incoming{std::move(t), priority};
+        if (ingress_ && enqueue_(incoming)) {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        std::vector<Incoming> messages;
+        messages.push_back(std::move(incoming));
+        insert_(lock, messages);
+        wait_for_spill_(lock);
+    }
+
+    // Takes over the contents of t, which is left empty. Swap only exchanges the fields of the two
+    // messages, so nothing is copied.
+    void Push(T&& t) {
+        auto object = std::unique_ptr<T>{new T{}};
+        object->Swap(&t);
+        Push(std::move(object));
+    }
+
+    // Pushes the std::unique_ptr<T>s in [first, last), which are left empty, under one lock and in
+    // one index transaction. Messages that have to go to disk are written there in one batch.
+    template <typename Iterator>
+    void PushMany(Iterator first, Iterator last) {
+        std::vector<Incoming> messages;
+        for (; first != last; ++first) {
+            if (*first) {
+                auto priority = make_priority_(**first);
+                messages.push_back(Incoming{std::move(*first), priority});
             }
         }
+        if (messages.empty()) {
+            return;
+        }
 
-        while (db_.Full()) {
-            auto lowest_hash = db_.GetLowestDiskHash();
-            fs_.Delete(lowest_hash);
-            db_.Delete(lowest_hash);
+        std::unique_lock<std::mutex> lock(mutex_);
+        insert_(lock, messages);
+        wait_for_spill_(lock);
+    }
+
+    // Returns nullptr if there is no message, or if the highest one could not be read back. A
+    // blocking Pop also returns nullptr once the buffer is closed and empty.
+    std::unique_ptr<T> Pop(bool block=false) {
+        std::unique_ptr<T> object;
+        if (block) {
+            pop_(object, [this] (std::unique_lock<std::mutex>& lock) {
+                wait_for_message_(lock);
+                return true;
+            }, PriorityPopStatus::EMPTY);
+        } else {
+            pop_(object, [] (std::unique_lock<std::mutex>&) { return false; },
+                 PriorityPopStatus::EMPTY);
+        }
+        return object;
+    }
+
+    // Pops the highest message into t without waiting for one
+    PriorityPopStatus TryPop(T& t) {
+        std::unique_ptr<T> object;
+        auto status = pop_(object, [] (std::unique_lock<std::mutex>&) { return false; },
+                           PriorityPopStatus::EMPTY);
+        if (object) {
+            t.Swap(object.get());
+        }
+        return status;
+    }
+
+    // Pops the highest message into t, waiting up to timeout for one to arrive
+    template <typename Rep, typename Period>
+    PriorityPopStatus TryPopFor(T& t, const std::chrono::duration<Rep, Period>& timeout) {
+        return PopUntil(t, std::chrono::steady_clock::now() + timeout);
+    }
+
+    // Pops the highest message into t, waiting until deadline for one to arrive
+    template <typename Clock, typename Duration>
+    PriorityPopStatus PopUntil(T& t, const std::chrono::time_point<Clock, Duration>& deadline) {
+        std::unique_ptr<T> object;
+        auto status = pop_(object, [this, &deadline] (std::unique_lock<std::mutex>& lock) {
+            return wait_for_message_until_(lock, deadline);
+        }, PriorityPopStatus::TIMEOUT);
+        if (object) {
+            t.Swap(object.get());
         }
+        return status;
+    }
 
-        condition_.notify_one();;
+    // Wakes every thread that waits in Pop, TryPopFor or PopUntil. From then on they return as
+    // soon as the buffer is empty instead of waiting for more. Messages can still be pushed and
+    // popped, and are saved as usual.
+    void Close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        condition_.notify_all();
     }
 
-    T Pop(bool block=false)
-    {
-        T object;
+    // Pops up to max_count of the highest priority messages, highest first, under one lock and in
+    // one index transaction, reading those on disk in one batch. With a nonzero max_bytes, no more
+    // messages are taken once the next would bring their sizes in the index past it, although the
+    // first is always taken. Messages that could not be read back are left out.
+    std::vector<std::unique_ptr<T>> PopMany(const size_t& max_count,
+                                            const unsigned long long& max_bytes=0) {
+        std::vector<std::unique_ptr<T>> objects;
+        if (max_count == 0) {
+            return objects;
+        }
+
         {
             std::unique_lock<std::mutex> lock(mutex_);
+            drain_ingress_(lock);
             bool on_disk = true;
-            auto hash = db_.GetHighestHash(on_disk);
-            if (block) {
-                while (hash.empty()) {
-                    condition_.wait(lock);
-                    hash = db_.GetHighestHash(on_disk);
+            auto id = db_.GetHighestId(on_disk);
+            while (moving_(id)) {
+                spill_condition_.wait(lock);
+                id = db_.GetHighestId(on_disk);
+            }
+
+            PriorityDBTransaction transaction{db_};
+            // The messages on disk, and where each of them goes among the objects
+            std::vector<PriorityRecord> records;
+            std::vector<size_t> slots;
+            unsigned long long bytes = 0;
+            // Stopping at a message that is being moved keeps the batch in priority order
+            while (id != 0 && objects.size() < max_count && !moving_(id)) {
+                PriorityLocation location;
+                auto find = objects_.end();
+                unsigned long long size = 0;
+                if (on_disk) {
+                    db_.GetLocation(id, location);
+                    size = location.length;
+                } else {
+                    find = objects_.find(id);
+                    if (find != objects_.end()) {
+                        size = find->second.size;
+                    }
                 }
+                if (max_bytes > 0 && !objects.empty() && bytes + size > max_bytes) {
+                    break;
+                }
+                bytes += size;
+                db_.Delete(id);
+
+                objects.emplace_back();
+                if (on_disk) {
+                    records.emplace_back(id);
+                    records.back().location = location;
+                    slots.push_back(objects.size() - 1);
+                } else if (find != objects_.end()) {
+                    objects.back() = take_object_(find).message;
+                }
+                id = db_.GetHighestId(on_disk);
             }
 
-            db_.Delete(hash);
+            if (!records.empty()) {
+                fs_.Read(records);
+                for (size_t i = 0; i < records.size(); ++i) {
+                    std::unique_ptr<T> t{new T{}};
+                    if (records[i].done && t->ParseFromString(records[i].data)) {
+                        objects[slots[i]] = std::move(t);
+                    }
+                }
+                fs_.Discard(records);
+            }
+            transaction.Commit();
 
-            if (!on_disk) {
-                auto find = objects_.find(hash);
-                if (find != objects_.end()) {
-                    object = find->second;
-                    objects_.erase(hash);
+            if (!objects.empty()) {
+                if (background_spill_) {
+                    spill_condition_.notify_all();
+                }
+                promoter_condition_.notify_one();
+                commit_(lock);
+                if (!records.empty()) {
+                    compact_segment_(lock);
                 }
-            } else {
-                object = inflate(hash);
             }
         }
 
-        if (object.IsInitialized() && fuzzer_.b() > 0 && fuzzer_.a() <= fuzzer_.b()) {
+        objects.erase(std::remove(objects.begin(), objects.end(), nullptr), objects.end());
+        if (!objects.empty() && fuzzer_.b() > 0 && fuzzer_.a() <= fuzzer_.b()) {
             std::this_thread::sleep_for(std::chrono::milliseconds(fuzzer_(generator_)));
         }
 
-        return object;
+        return objects;
     }
 
   protected:
+    // Keeps the buffer in buffer_directory under buffer_root, so that several can share a root.
+    // Buffers given the same budget are held to buffer_size and max_memory together.
+    PriorityBuffer(PriorityFunction make_priority, const std::string& buffer_root,
+                   const std::string& buffer_directory, const unsigned long long& buffer_size,
+                   const int& max_memory, const PriorityDBOptions& db_options,
+                   const PriorityFSOptions& fs_options, PriorityBudget* budget=nullptr)
+            : make_priority_{make_priority}, fs_{buffer_directory, buffer_root, fs_options},
+              db_{buffer_size, fs_.GetFilePath("prism_data.db"),
+                  index_options_(db_options, fs_options)},
+              buffer_size_{buffer_size},
+              max_memory_{max_memory}, memory_high_bytes_{0}, memory_low_bytes_{0}, memory_size_{0},
+              disk_size_{0}, budget_{budget ? budget : &own_budget_}, tails_{nullptr},
+              draining_{false},
+              fuzzer_{0, 0}, group_commit_window_{0}, committing_{false}, operation_sequence_{0},
+              committed_sequence_{0}, background_spill_{false}, stopping_writer_{false},
+              max_spill_backlog_{0}, spill_backlog_{0}, prefetch_depth_{0},
+              stopping_promoter_{false}, promoting_id_{0}, unfit_id_{0}, unfit_size_{0},
+              compacting_{false}, ingress_policy_{PriorityIngressPolicy::BLOCK},
+              ingress_open_{false}, ingress_blocked_{0}, drainer_sleeping_{false},
+              stopping_drainer_{false}, closed_{false}, insert_sequence_{0},
+              wait_spins_{MIN_WAIT_SPINS}, waiting_consumers_{0} {
+        rename_legacy_files_();
+        fs_.RecoverSegments(db_.GetSegmentSizes());
+        last_id_ = db_.GetMaxId();
+        fs_.RecoverFiles(last_id_);
+        update_disk_size_();
+        if (budget) {
+            budget_->tails.emplace_back();
+            tails_ = &budget_->tails.back();
+            publish_tails_();
+        }
+    }
+
+    // Spills and evicts whatever the budget calls for, as Push would have. For buffers that share
+    // a budget, when another of them found it unmet.
+    void make_room_() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (background_spill_) {
+            if (needs_spill_() || full_()) {
+                writer_condition_.notify_one();
+            }
+            return;
+        }
+
+        PriorityDBTransaction transaction{db_};
+        spill_and_evict_();
+        transaction.Commit();
+        commit_(lock);
+        compact_segment_(lock);
+    }
+
+    struct Object {
+        std::unique_ptr<T> message;
+        unsigned long long size;
+    };
+
     PriorityFS fs_;
     PriorityDB db_;
-    std::map<std::string, T> objects_;
+    std::unordered_map<unsigned long long, Object> objects_;
     std::mutex mutex_;
     std::condition_variable condition_;
+    std::condition_variable commit_condition_;
+    std::condition_variable writer_condition_;
+    std::condition_variable spill_condition_;
+    std::condition_variable promoter_condition_;
 
   private:
+    struct Incoming {
+        std::unique_ptr<T> message;
+        unsigned long long priority;
+    };
+
     static unsigned long long epoch_priority_(const T& t) {
         return std::chrono::steady_clock::now().time_since_epoch().count();
     }
 
-    static std::string make_hash_(const int& len=32) {
-        static const char alphanum[] = "0123456789"
-                                       "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-                                       "abcdefghijklmnopqrstuvwxyz";
+    // Resolves Synchronous::AUTO to syncing the index as often as the messages it points to.
+    // Messages left unsynced only need an index that can't be corrupted, which NORMAL gives with a
+    // write-ahead log or the journal of the memory backend and FULL otherwise.
+    static PriorityDBOptions index_options_(const PriorityDBOptions& db_options,
+                                            const PriorityFSOptions& fs_options) {
+        auto options = db_options;
+        if (options.synchronous == PriorityDBOptions::Synchronous::AUTO) {
+            auto journaled = options.wal || options.backend == PriorityDBOptions::Backend::MEMORY;
+            options.synchronous =
+                    fs_options.durability == PriorityFSOptions::Durability::NONE && journaled ?
+                    PriorityDBOptions::Synchronous::NORMAL : PriorityDBOptions::Synchronous::FULL;
+        }
+        return options;
+    }
+
+    // Files written before messages had numeric ids are named after random hashes
+    void rename_legacy_files_() {
+        auto hashes = db_.GetLegacyHashes();
+        for (auto& hash : hashes) {
+            fs_.Rename(hash.second, PriorityFS::GetFileName(hash.first));
+        }
+        db_.DeleteLegacyHashes();
+    }
+
+    // Also caches the size in the message, which write_record_ relies on later
+    static unsigned long long get_size_(const T& t) {
+        return t.ByteSizeLong();
+    }
+
+    // Whether messages have to be moved from memory to disk. Once the memory budget is exceeded
+    // this stays true until usage is back under the low watermark, but only for the buffer with
+    // the lowest priority message in memory.
+    bool needs_spill_() {
+        auto memory_size = budget_->memory_size.load();
+        if (memory_high_bytes_ > 0 && memory_size > memory_high_bytes_) {
+            draining_ = true;
+        } else if (memory_high_bytes_ == 0 || memory_size <= memory_low_bytes_) {
+            draining_ = false;
+        }
+        return (draining_ || budget_->memory_messages > max_memory_) && holds_lowest_(false);
+    }
 
-        std::stringstream stream;
-        for (int i = 0; i < len; ++i) {
-            stream << alphanum[rand() % (sizeof(alphanum) - 1)];
+    // Whether a message of size bytes can come into memory without going over the memory budget,
+    // which would only have it spilled straight back to disk
+    bool fits_in_memory_(const unsigned long long& size) {
+        return memory_high_bytes_ == 0 || budget_->memory_size + size <= memory_high_bytes_;
+    }
+
+    // Whether the messages on disk take up more than buffer_size, and this buffer has the lowest
+    // priority one of them to evict
+    bool full_() {
+        update_disk_size_();
+        return budget_->disk_size > buffer_size_ && holds_lowest_(true);
+    }
+
+    // Whether this buffer has a message on disk, or in memory, and none of the buffers sharing its
+    // budget has one of lower priority there. If not, the budget is marked as unmet.
+    bool holds_lowest_(const bool& on_disk) {
+        unsigned long long priority;
+        auto holds = db_.GetLowestPriority(on_disk, priority);
+        if (!tails_) {
+            return holds;
+        }
+        for (auto& tails : budget_->tails) {
+            if (holds && &tails != tails_ && (on_disk ? tails.disk : tails.memory) < priority) {
+                holds = false;
+            }
+        }
+        if (!holds) {
+            budget_->unmet = true;
         }
+        return holds;
+    }
 
-        return stream.str();
+    // Lets the buffers sharing the budget see the lowest priorities this one holds
+    void publish_tails_() {
+        if (!tails_) {
+            return;
+        }
+        unsigned long long priority;
+        tails_->memory = db_.GetLowestPriority(false, priority) ?
+                priority : std::numeric_limits<unsigned long long>::max();
+        tails_->disk = db_.GetLowestPriority(true, priority) ?
+                priority : std::numeric_limits<unsigned long long>::max();
     }
 
-    static unsigned long get_size_(const T& t) {
-        return t.ByteSize();
+    // Brings this buffer's share of the disk in the budget up to date with the index
+    void update_disk_size_() {
+        auto disk_size = db_.GetDiskSize();
+        budget_->disk_size += disk_size - disk_size_;
+        disk_size_ = disk_size;
+    }
+
+    void add_object_(const unsigned long long& id, std::unique_ptr<T> message,
+                     const unsigned long long& size) {
+        objects_.emplace(id, Object{std::move(message), size});
+        memory_size_ += size;
+        budget_->memory_size += size;
+        ++budget_->memory_messages;
+    }
+
+    Object take_object_(typename std::unordered_map<unsigned long long, Object>::iterator find) {
+        auto object = std::move(find->second);
+        objects_.erase(find);
+        memory_size_ -= object.size;
+        budget_->memory_size -= object.size;
+        --budget_->memory_messages;
+        return object;
+    }
+
+    // Takes up to limit of the lowest priority messages out of memory for as long as they have to
+    // go, and moves them to disk in the index ahead of them being written there
+    std::vector<std::pair<unsigned long long, Object>> take_spills_(const size_t& limit) {
+        std::vector<std::pair<unsigned long long, Object>> spills;
+        while (spills.size() < limit && needs_spill_()) {
+            auto lowest_id = db_.GetLowestMemoryId();
+            auto find = objects_.find(lowest_id);
+            if (find == objects_.end()) {
+                break;
+            }
+
+            db_.Update(lowest_id, true);
+            spills.emplace_back(lowest_id, take_object_(find));
+        }
+        return spills;
+    }
+
+    // Moves as many of the lowest priority messages in memory to disk as have to go, in one batch
+    void spill_() {
+        auto spills = take_spills_(objects_.size());
+        if (spills.empty()) {
+            return;
+        }
+
+        std::vector<std::pair<unsigned long long, const T*>> messages;
+        for (auto& spill : spills) {
+            messages.emplace_back(spill.first, spill.second.message.get());
+        }
+        save_to_disk(messages);
+    }
+
+    // Moves what has to go from memory to disk, and forgets what has to go from disk
+    void spill_and_evict_() {
+        spill_();
+
+        std::vector<PriorityRecord> evicted;
+        while (full_()) {
+            evict_lowest_(evicted);
+        }
+        if (!evicted.empty()) {
+            fs_.Discard(evicted);
+        }
     }
 
-    T inflate(const std::string& hash) {
-        std::ifstream file_stream;
-        T t;
-        if (fs_.GetInput(hash, file_stream) && file_stream.is_open())
+    // Forgets the lowest priority message on disk, whose record is left for the caller to release
+    void evict_lowest_(std::vector<PriorityRecord>& evicted) {
+        auto lowest_id = db_.GetLowestDiskId();
+        forget_promotion_(lowest_id);
+        evicted.emplace_back(lowest_id);
+        db_.GetLocation(lowest_id, evicted.back().location);
+        db_.Delete(lowest_id);
+    }
+
+    // Pops the highest message into object. While there is none, wait is called with the lock
+    // held and returns false to give up, which pop_ reports as give_up.
+    template <typename Wait>
+    PriorityPopStatus pop_(std::unique_ptr<T>& object, Wait wait,
+                           const PriorityPopStatus& give_up) {
         {
-            t.ParseFromIstream(&file_stream);
-            t.CheckInitialized();
-            file_stream.close();
-            fs_.Delete(hash);
+            std::unique_lock<std::mutex> lock(mutex_);
+            drain_ingress_(lock);
+            bool on_disk = true;
+            auto id = db_.GetHighestId(on_disk);
+            while (id == 0 || moving_(id)) {
+                // A message that a background thread is moving between memory and disk can't be
+                // taken until it has arrived
+                if (id != 0) {
+                    spill_condition_.wait(lock);
+                } else if (closed_) {
+                    return PriorityPopStatus::CLOSED;
+                } else if (!wait(lock)) {
+                    return give_up;
+                }
+                id = db_.GetHighestId(on_disk);
+            }
+
+            PriorityDBTransaction transaction{db_};
+            PriorityLocation location;
+            if (on_disk) {
+                db_.GetLocation(id, location);
+            }
+            db_.Delete(id);
+
+            if (!on_disk) {
+                auto find = objects_.find(id);
+                if (find != objects_.end()) {
+                    object = take_object_(find).message;
+                }
+            } else {
+                object = inflate(id, location);
+            }
+            transaction.Commit();
+
+            if (background_spill_) {
+                spill_condition_.notify_all();
+            }
+            promoter_condition_.notify_one();
+            commit_(lock);
+            if (on_disk) {
+                compact_segment_(lock);
+            }
+        }
+
+        if (!object) {
+            return PriorityPopStatus::UNREADABLE;
+        }
+        if (fuzzer_.b() > 0 && fuzzer_.a() <= fuzzer_.b()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(fuzzer_(generator_)));
+        }
+        return PriorityPopStatus::OK;
+    }
+
+    bool has_message_() {
+        bool on_disk;
+        return db_.GetHighestId(on_disk) != 0;
+    }
+
+    // Waits for a message or Close(). Parked consumers are counted, so that Push only wakes
+    // anyone when somebody waits.
+    void wait_for_message_(std::unique_lock<std::mutex>& lock) {
+        if (spin_for_message_(lock, std::chrono::steady_clock::time_point::max())) {
+            return;
+        }
+        ++waiting_consumers_;
+        condition_.wait(lock, [this] { return closed_ || has_message_(); });
+        --waiting_consumers_;
+    }
+
+    // As wait_for_message_, but returns false if deadline passes first
+    template <typename Clock, typename Duration>
+    bool wait_for_message_until_(std::unique_lock<std::mutex>& lock,
+                                 const std::chrono::time_point<Clock, Duration>& deadline) {
+        if (spin_for_message_(lock, deadline)) {
+            return true;
+        }
+        ++waiting_consumers_;
+        auto ready = condition_.wait_until(lock, deadline, [this] {
+            return closed_ || has_message_();
+        });
+        --waiting_consumers_;
+        return ready;
+    }
+
+    // Watches for an insert with the lock released for a while before the caller parks, since
+    // under load a message tends to arrive sooner than a parked thread could be woken. The spin
+    // grows while it pays off and shrinks while it doesn't. The spin ends at deadline, which is
+    // looked at every WAIT_SPINS_PER_CLOCK spins. Returns whether anything arrived.
+    template <typename Clock, typename Duration>
+    bool spin_for_message_(std::unique_lock<std::mutex>& lock,
+                           const std::chrono::time_point<Clock, Duration>& deadline) {
+        if (closed_ || Clock::now() >= deadline) {
+            return false;
+        }
+        auto sequence = insert_sequence_.load();
+        auto limit = wait_spins_;
+        int spins = 0;
+        bool expired = false;
+        lock.unlock();
+        while (spins < limit && insert_sequence_.load(std::memory_order_relaxed) == sequence) {
+            relax_();
+            ++spins;
+            if (spins % WAIT_SPINS_PER_CLOCK == 0 && Clock::now() >= deadline) {
+                expired = true;
+                break;
+            }
+        }
+        lock.lock();
+
+        auto arrived = insert_sequence_ != sequence;
+        if (arrived) {
+            wait_spins_ = std::min(std::max(limit, 2 * spins), MAX_WAIT_SPINS);
+        } else if (!expired) {
+            wait_spins_ = std::max(limit / 2, MIN_WAIT_SPINS);
+        }
+        return arrived;
+    }
+
+    // Tells the CPU that this is a spin loop, which saves power and lets a sibling thread run
+    static void relax_() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#else
+        std::this_thread::yield();
+#endif
+    }
+
+    // Wakes as many parked consumers as there are new messages for, with a single broadcast if
+    // that is all of them
+    void notify_consumers_(const size_t& messages) {
+        if (waiting_consumers_ == 0) {
+            return;
+        }
+        if (messages >= static_cast<size_t>(waiting_consumers_)) {
+            condition_.notify_all();
+        } else {
+            for (size_t i = 0; i < messages; ++i) {
+                condition_.notify_one();
+            }
+        }
+    }
+
+    // Whether a background thread is moving the message between memory and disk
+    bool moving_(const unsigned long long& id) {
+        return id != 0 && (spilling_ids_.count(id) || id == promoting_id_);
+    }
+
+    void wait_for_spill_(std::unique_lock<std::mutex>& lock) {
+        spill_condition_.wait(lock, [this] {
+            return !background_spill_ || spill_caught_up_();
+        });
+    }
+
+    // Adds the messages to memory and the index in one transaction, and then makes room for them by
+    // spilling and evicting, or leaves that to the background thread
+    void insert_(std::unique_lock<std::mutex>& lock, std::vector<Incoming>& messages) {
+        PriorityDBTransaction transaction{db_};
+        for (auto& message : messages) {
+            auto id = ++last_id_;
+            auto size = get_size_(*message.message);
+            db_.Insert(message.priority, id, size);
+            add_object_(id, std::move(message.message), size);
+            if (background_spill_ && needs_spill_()) {
+                ++spill_backlog_;
+            }
+        }
+
+        if (background_spill_) {
+            if (spill_backlog_ > 0 || full_()) {
+                writer_condition_.notify_one();
+            }
+        } else {
+            spill_and_evict_();
+        }
+
+        transaction.Commit();
+        insert_sequence_ += messages.size();
+        notify_consumers_(messages.size());
+        promoter_condition_.notify_one();
+        commit_(lock);
+        if (!background_spill_) {
+            compact_segment_(lock);
+        }
+    }
+
+    // Hands the message to the ingress ring, or returns false to leave it for Push to insert
+    // under the lock
+    bool enqueue_(Incoming& incoming) {
+        if (!ingress_open_) {
+            return false;
+        }
+
+        if (!ingress_->TryPush(incoming)) {
+            if (ingress_policy_ == PriorityIngressPolicy::SPILL) {
+                return false;
+            } else if (ingress_policy_ == PriorityIngressPolicy::SPIN) {
+                while (!ingress_->TryPush(incoming)) {
+                    if (!ingress_open_) {
+                        return false;
+                    }
+                    std::this_thread::yield();
+                }
+            } else {
+                std::unique_lock<std::mutex> lock(ingress_mutex_);
+                bool pushed = false;
+                ++ingress_blocked_;
+                // Pairs with the fence in drain_ingress_, so that either the drainer sees this
+                // producer waiting or the producer sees the room the drainer made
+                ingress_space_.wait(lock, [this, &incoming, &pushed] {
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    pushed = ingress_->TryPush(incoming);
+                    return pushed || !ingress_open_;
+                });
+                --ingress_blocked_;
+                if (!pushed) {
+                    return false;
+                }
+            }
+        }
+
+        // Pairs with the fence in drain_loop_, so that the drainer can't miss the message while it
+        // goes to sleep
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (drainer_sleeping_) {
+            std::lock_guard<std::mutex> lock(ingress_mutex_);
+            ingress_condition_.notify_one();
+        }
+        return true;
+    }
+
+    // Moves up to one ring's worth of messages from the ingress ring into the buffer. Messages are
+    // only taken out of the ring under the lock, so Pop never misses one that is on its way.
+    void drain_ingress_(std::unique_lock<std::mutex>& lock) {
+        if (!ingress_) {
+            return;
+        }
+
+        std::vector<Incoming> messages;
+        Incoming incoming;
+        while (messages.size() < ingress_->Capacity() && ingress_->TryPop(incoming)) {
+            messages.push_back(std::move(incoming));
+        }
+        if (messages.empty()) {
+            return;
+        }
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ingress_blocked_ > 0) {
+            std::lock_guard<std::mutex> ingress_lock(ingress_mutex_);
+            ingress_space_.notify_all();
+        }
+        insert_(lock, messages);
+    }
+
+    void drain_loop_() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(ingress_mutex_);
+                drainer_sleeping_ = true;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                ingress_condition_.wait(lock, [this] {
+                    return stopping_drainer_ || !ingress_->Empty();
+                });
+                drainer_sleeping_ = false;
+                if (stopping_drainer_) {
+                    break;
+                }
+            }
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            try {
+                drain_ingress_(lock);
+            } catch (const std::exception&) {
+                // Hand the work back to Push, which reports errors to its caller
+                ingress_open_ = false;
+                std::lock_guard<std::mutex> ingress_lock(ingress_mutex_);
+                ingress_space_.notify_all();
+                break;
+            }
+            // Holding back here while the background spill catches up lets the ring fill, which
+            // is how producers are held back instead
+            wait_for_spill_(lock);
+        }
+    }
+
+    // Stops the drainer and moves whatever it left in the ring into the buffer
+    void stop_ingress_() {
+        {
+            std::lock_guard<std::mutex> lock(ingress_mutex_);
+            if (!drainer_.joinable()) {
+                return;
+            }
+            stopping_drainer_ = true;
+            ingress_open_ = false;
+        }
+        ingress_condition_.notify_all();
+        ingress_space_.notify_all();
+        drainer_.join();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!ingress_->Empty()) {
+            drain_ingress_(lock);
+        }
+        ingress_.reset();
+        stopping_drainer_ = false;
+    }
+
+    // Whether the background thread is close enough behind for Push to return. The backlog is
+    // cleared once there is nothing left to do, which may also be thanks to Pop.
+    bool spill_caught_up_() {
+        if (!needs_spill_() && !full_()) {
+            spill_backlog_ = 0;
+        }
+        return spill_backlog_ <= max_spill_backlog_;
+    }
+
+    void write_loop_() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            writer_condition_.wait(lock, [this] {
+                return stopping_writer_ || needs_spill_() || full_();
+            });
+            if (stopping_writer_) {
+                break;
+            }
+
+            // Evicting first keeps the disk within its budget, and makes sure that every spill
+            // below pays off one message of the backlog that Push waits on
+            try {
+                if (full_()) {
+                    evict_in_background_(lock);
+                    compact_segment_(lock);
+                } else if (auto spilled = spill_in_background_(lock)) {
+                    spill_backlog_ = std::max(0, spill_backlog_ - spilled);
+                    promoter_condition_.notify_one();
+                } else {
+                    // The index has no message in memory left to give up
+                    draining_ = false;
+                    spill_backlog_ = 0;
+                    writer_condition_.wait(lock);
+                }
+            } catch (const std::exception&) {
+                // Hand the work back to Push, which reports errors to its caller
+                background_spill_ = false;
+                spill_condition_.notify_all();
+                break;
+            }
+            spill_condition_.notify_all();
+        }
+    }
+
+    // Serializes a batch of the lowest priority messages in memory and writes them with the lock
+    // released. Until that is done, the messages are in neither objects_ nor on disk, and Pop and
+    // the promoter wait for them. Returns how many were spilled.
+    int spill_in_background_(std::unique_lock<std::mutex>& lock) {
+        std::vector<std::pair<unsigned long long, Object>> spills;
+        {
+            PriorityDBTransaction transaction{db_};
+            spills = take_spills_(MAX_SPILL_BATCH);
+            transaction.Commit();
+        }
+        if (spills.empty()) {
+            return 0;
+        }
+
+        std::vector<std::pair<unsigned long long, const T*>> messages;
+        for (auto& spill : spills) {
+            spilling_ids_.insert(spill.first);
+            messages.emplace_back(spill.first, spill.second.message.get());
+        }
+        lock.unlock();
+        auto records = write_records_(messages);
+        lock.lock();
+
+        spilling_ids_.clear();
+        PriorityDBTransaction transaction{db_};
+        locate_records_(records);
+        transaction.Commit();
+        commit_(lock);
+        return spills.size();
+    }
+
+    // Forgets a batch of the lowest priority messages on disk first and unlinks their files with
+    // the lock released, so a crash in between leaves at most unreferenced files behind
+    void evict_in_background_(std::unique_lock<std::mutex>& lock) {
+        std::vector<PriorityRecord> evicted;
+        {
+            PriorityDBTransaction transaction{db_};
+            while (full_() && evicted.size() < MAX_SPILL_BATCH) {
+                evict_lowest_(evicted);
+            }
+            transaction.Commit();
+        }
+        commit_(lock);
+
+        lock.unlock();
+        fs_.Discard(evicted);
+        lock.lock();
+    }
+
+    void stop_writer_() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!writer_.joinable()) {
+                return;
+            }
+            stopping_writer_ = true;
+            background_spill_ = false;
+        }
+        writer_condition_.notify_all();
+        spill_condition_.notify_all();
+        writer_.join();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_writer_ = false;
+        spill_backlog_ = 0;
+    }
+
+    // Commits the index, at most once per group commit window. The first caller to find no commit
+    // pending sleeps through the window with the lock released, so that operations from other
+    // threads can join the open transaction, and then commits on behalf of all of them.
+    void commit_(std::unique_lock<std::mutex>& lock) {
+        publish_tails_();
+        if (group_commit_window_.count() == 0) {
+            flush_();
+            return;
+        }
+
+        auto sequence = ++operation_sequence_;
+        if (committing_) {
+            commit_condition_.wait(lock, [this, sequence] {
+                return committed_sequence_ >= sequence;
+            });
+            return;
+        }
+
+        committing_ = true;
+        lock.unlock();
+        std::this_thread::sleep_for(group_commit_window_);
+        lock.lock();
+        committing_ = false;
+        committed_sequence_ = operation_sequence_;
+        commit_condition_.notify_all();
+        flush_();
+    }
+
+    // Messages on disk whose batch is due are synced first. The index stays uncommitted for as
+    // long as any of them are not, so that it never points at a message a power loss could take.
+    void flush_() {
+        // Buffers that share the budget see what this one took up or freed since the last time
+        update_disk_size_();
+        if (!fs_.Flush()) {
+            throw PriorityFSException{"Unable to sync messages to disk"};
+        }
+        if (fs_.Synced()) {
+            db_.Flush();
+        }
+    }
+
+    // Rewrites the messages of a segment that is mostly free space at the end of the one being
+    // appended to, and releases their old records once the index has reached the disk
+    void compact_segment_(std::unique_lock<std::mutex>& lock) {
+        if (compacting_) {
+            return;
+        }
+        auto segment = fs_.GetSparseSegment();
+        if (segment == 0) {
+            return;
+        }
+
+        compacting_ = true;
+        std::vector<PriorityRecord> released;
+        try {
+            PriorityDBTransaction transaction{db_};
+            for (auto id : db_.GetSegmentIds(segment)) {
+                PriorityRecord record{id};
+                if (db_.GetLocation(id, record.location)) {
+                    released.push_back(record);
+                }
+            }
+
+            // Messages that can't be read back are gone, the rest are written out again together
+            auto records = released;
+            fs_.Read(records);
+            std::vector<PriorityRecord> moved;
+            for (auto& record : records) {
+                if (record.done) {
+                    moved.push_back(std::move(record));
+                } else {
+                    db_.Delete(record.id);
+                }
+            }
+            fs_.Write(moved);
+            locate_records_(moved);
+            transaction.Commit();
+            commit_(lock);
+        } catch (const std::exception&) {
+            compacting_ = false;
+            throw;
+        }
+        compacting_ = false;
+
+        fs_.Discard(released);
+    }
+
+    std::unique_ptr<T> read_record_(const unsigned long long& id,
+                                    const PriorityLocation& location) {
+        std::unique_ptr<T> t{new T{}};
+        auto parse = [&t] (const char* data, const size_t& size) {
+            return t->ParseFromArray(data, size);
+        };
+        if (!fs_.Read(id, location, parse)) {
+            t.reset();
         }
         return t;
-        ;
     }
 
-    bool save_to_disk(const T& t, const std::string& hash) {
-        std::ofstream file_stream;
-        if (fs_.GetOutput(hash, file_stream) && file_stream.is_open()) {
-            t.SerializeToOstream(&file_stream);
-            file_stream.close();
-            db_.Update(hash, true);
+    std::unique_ptr<T> inflate(const unsigned long long& id, const PriorityLocation& location) {
+        auto t = read_record_(id, location);
+        fs_.Discard(id, location);
+        return t;
+    }
+
+    void promote_loop_() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_promoter_) {
+            try {
+                if (!promote_highest_(lock)) {
+                    promoter_condition_.wait(lock);
+                }
+            } catch (const std::exception&) {
+                // Prefetching is only an optimization, Pop still reads from disk without it
+                break;
+            }
+        }
+    }
+
+    // Reads the next message that Pop will want from disk with the lock released, and moves it
+    // into memory unless it was evicted in the meantime. Returns false if there is nothing to do.
+    bool promote_highest_(std::unique_lock<std::mutex>& lock) {
+        auto id = db_.GetHighestDiskId(std::min(prefetch_depth_, max_memory_));
+        if (id == 0 || spilling_ids_.count(id)) {
+            return false;
+        }
+
+        PriorityLocation location;
+        db_.GetLocation(id, location);
+        // Saves reading the same message again while there is still no room for it
+        if (id == unfit_id_ && !fits_in_memory_(unfit_size_)) {
+            return false;
+        }
+        promoting_id_ = id;
+        lock.unlock();
+        auto object = read_record_(id, location);
+        lock.lock();
+
+        // An eviction in the meantime has released the record already
+        if (promoting_id_ != id) {
+            return true;
+        }
+        promoting_id_ = 0;
+        spill_condition_.notify_all();
+        auto size = object ? get_size_(*object) : 0ULL;
+        if (!fits_in_memory_(size)) {
+            // The record stays where it is, as if nothing had been read
+            unfit_id_ = id;
+            unfit_size_ = size;
+            return false;
+        }
+        fs_.Release(id, location);
+
+        PriorityDBTransaction transaction{db_};
+        if (object) {
+            db_.Update(id, false);
+            add_object_(id, std::move(object), size);
+        } else {
+            // Pop would have had nothing to return for it either
+            db_.Delete(id);
+        }
+        transaction.Commit();
+        commit_(lock);
+
+        if (background_spill_) {
+            writer_condition_.notify_one();
+        } else {
+            PriorityDBTransaction spill_transaction{db_};
+            spill_();
+            spill_transaction.Commit();
+            commit_(lock);
+        }
+
+        // If the memory budget could not hold it, wait for Pop to make room before trying again
+        return objects_.find(id) != objects_.end();
+    }
+
+    // Called before a message on disk is evicted, so that a promotion of it is thrown away
+    void forget_promotion_(const unsigned long long& id) {
+        if (id == promoting_id_) {
+            promoting_id_ = 0;
+            spill_condition_.notify_all();
+        }
+    }
+
+    void stop_promoter_() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!promoter_.joinable()) {
+                return;
+            }
+            stopping_promoter_ = true;
+        }
+        promoter_condition_.notify_all();
+        promoter_.join();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_promoter_ = false;
+        prefetch_depth_ = 0;
+    }
+
+    // Serializes straight into the buffer that is written out, with the size get_size_ cached
+    // in the message when it arrived instead of working it out again
+    static bool serialize_(const T& t, std::string& data) {
+        data.resize(t.GetCachedSize());
+        if (data.empty()) {
             return true;
         }
-        fs_.Delete(hash);
-        db_.Delete(hash);
-        return false;
+        auto begin = reinterpret_cast<uint8_t*>(&data[0]);
+        return t.SerializeWithCachedSizesToArray(begin) == begin + data.size();
+    }
+
+    // Writes the messages to disk in one batch, which only touches the file system. Records that
+    // could not be serialized are not written, and not done either.
+    std::vector<PriorityRecord> write_records_(
+            const std::vector<std::pair<unsigned long long, const T*>>& messages) {
+        std::vector<PriorityRecord> records, serialized;
+        for (auto& message : messages) {
+            PriorityRecord record{message.first};
+            if (serialize_(*message.second, record.data)) {
+                serialized.push_back(std::move(record));
+            } else {
+                records.push_back(std::move(record));
+            }
+        }
+        fs_.Write(serialized);
+        std::move(serialized.begin(), serialized.end(), std::back_inserter(records));
+        return records;
+    }
+
+    // Records where the messages went in the index, and drops those that didn't make it
+    void locate_records_(const std::vector<PriorityRecord>& records) {
+        for (auto& record : records) {
+            if (record.done) {
+                db_.SetLocation(record.id, record.location);
+            } else {
+                db_.Delete(record.id);
+            }
+        }
+    }
+
+    void save_to_disk(const std::vector<std::pair<unsigned long long, const T*>>& messages) {
+        locate_records_(write_records_(messages));
     }
 
     PriorityFunction make_priority_;
+    unsigned long long buffer_size_;
     int max_memory_;
+    unsigned long long memory_high_bytes_;
+    unsigned long long memory_low_bytes_;
+    // This buffer's share of the budget, which is its own unless it was given one to share
+    unsigned long long memory_size_;
+    unsigned long long disk_size_;
+    PriorityBudget own_budget_;
+    PriorityBudget* budget_;
+    // What this buffer publishes to the others sharing its budget, if it shares it
+    PriorityTails* tails_;
+    bool draining_;
     std::random_device generator_;
     std::uniform_int_distribution<unsigned long> fuzzer_;
+    std::chrono::milliseconds group_commit_window_;
+    bool committing_;
+    unsigned long long operation_sequence_;
+    unsigned long long committed_sequence_;
+    unsigned long long last_id_;
+    bool background_spill_;
+    bool stopping_writer_;
+    int max_spill_backlog_;
+    int spill_backlog_;
+    std::unordered_set<unsigned long long> spilling_ids_;
+    std::thread writer_;
+    int prefetch_depth_;
+    bool stopping_promoter_;
+    unsigned long long promoting_id_;
+    // The last message read for promotion that turned out too large for the memory budget
+    unsigned long long unfit_id_;
+    unsigned long long unfit_size_;
+    std::thread promoter_;
+    bool compacting_;
+    std::unique_ptr<PriorityRing<Incoming>> ingress_;
+    PriorityIngressPolicy ingress_policy_;
+    std::atomic<bool> ingress_open_;
+    std::mutex ingress_mutex_;
+    std::condition_variable ingress_condition_;
+    std::condition_variable ingress_space_;
+    std::atomic<int> ingress_blocked_;
+    std::atomic<bool> drainer_sleeping_;
+    bool stopping_drainer_;
+    std::thread drainer_;
+    bool closed_;
+    std::atomic<unsigned long long> insert_sequence_;
+    int wait_spins_;
+    // Consumers parked on condition_
+    int waiting_consumers_;
 };
 
 #endif
@@ -0,0 +1,135 @@
+#include "prioritycrc.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define PRIORITY_CRC_SSE42
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define PRIORITY_CRC_ARMV8
+#endif
+
+// The Castagnoli polynomial, bit reversed
+#define CRC32C_POLYNOMIAL 0x82f63b78
+
+
+namespace {
+
+// Slicing by 8: table[k][b] is the CRC of byte b followed by k zero bytes, so that eight bytes
+// are folded in with eight lookups instead of one at a time
+struct Tables {
+    Tables() {
+        for (uint32_t b = 0; b < 256; ++b) {
+            auto crc = b;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLYNOMIAL : 0);
+            }
+            table[0][b] = crc;
+        }
+        for (uint32_t b = 0; b < 256; ++b) {
+            for (int k = 1; k < 8; ++k) {
+                table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xff];
+            }
+        }
+    }
+
+    uint32_t table[8][256];
+};
+
+uint32_t crc_table(const unsigned char* data, size_t size, uint32_t crc) {
+    static const Tables tables;
+    auto& table = tables.table;
+    while (size >= 8) {
+        uint32_t low, high;
+        memcpy(&low, data, 4);
+        memcpy(&high, data + 4, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        low = __builtin_bswap32(low);
+        high = __builtin_bswap32(high);
+#endif
+        low ^= crc;
+        crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^
+              table[5][(low >> 16) & 0xff] ^ table[4][low >> 24] ^
+              table[3][high & 0xff] ^ table[2][(high >> 8) & 0xff] ^
+              table[1][(high >> 16) & 0xff] ^ table[0][high >> 24];
+        data += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xff];
+    }
+    return crc;
+}
+
+#if defined(PRIORITY_CRC_SSE42)
+
+__attribute__((target("sse4.2")))
+uint32_t crc_hardware(const unsigned char* data, size_t size, uint32_t crc) {
+    uint64_t crc64 = crc;
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        size -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (size-- > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+
+bool has_hardware() {
+    static const bool sse42 = __builtin_cpu_supports("sse4.2");
+    return sse42;
+}
+
+#elif defined(PRIORITY_CRC_ARMV8)
+
+uint32_t crc_hardware(const unsigned char* data, size_t size, uint32_t crc) {
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc = __crc32cd(crc, word);
+        data += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        crc = __crc32cb(crc, *data++);
+    }
+    return crc;
+}
+
+// Compilers only define __ARM_FEATURE_CRC32 when every CPU they build for has the instructions
+bool has_hardware() {
+    return true;
+}
+
+#else
+
+uint32_t crc_hardware(const unsigned char* data, size_t size, uint32_t crc) {
+    return crc_table(data, size, crc);
+}
+
+bool has_hardware() {
+    return false;
+}
+
+#endif
+
+} // namespace
+
+
+uint32_t PriorityCRC32C(const char* data, const size_t& size, const uint32_t& crc) {
+    auto bytes = reinterpret_cast<const unsigned char*>(data);
+    if (has_hardware()) {
+        return ~crc_hardware(bytes, size, ~crc);
+    }
+    return ~crc_table(bytes, size, ~crc);
+}
+
+uint32_t PriorityCRC32CTable(const char* data, const size_t& size, const uint32_t& crc) {
+    return ~crc_table(reinterpret_cast<const unsigned char*>(data), size, ~crc);
+}
@@ -0,0 +1,16 @@
+#ifndef PRIORITY_CRC_H
+#define PRIORITY_CRC_H
+
+#include <cstddef>
+#include <cstdint>
+
+
+// The CRC-32C (Castagnoli) of size bytes at data, carrying on from the crc of whatever came before
+// them. Uses the CRC32 instructions of SSE 4.2 or ARMv8 where the CPU has them, and tables
+// otherwise.
+uint32_t PriorityCRC32C(const char* data, const size_t& size, const uint32_t& crc=0);
+
+// The same with tables only, whatever the CPU
+uint32_t PriorityCRC32CTable(const char* data, const size_t& size, const uint32_t& crc=0);
+
+#endif
@@ -9,200 +9,548 @@
 
 #include <sqlite3.h>
 
+#include "prioritymemoryindex.h"
 
-class PriorityDB::Impl {
+// Bump this whenever the layout of the table or its indexes changes, and teach migrate_table_()
+// how to bring an older database file up to date
+#define PRIORITY_DB_SCHEMA_VERSION 3
+
+
+class PriorityDB::Impl : public PriorityIndex {
   public:
-    Impl(const unsigned long long& max_size, const std::string& path)
-            : max_size_{max_size}, table_path_(path), table_name_("prism_data") {
+    Impl(const unsigned long long& max_size, const std::string& path,
+         const PriorityDBOptions& options)
+            : max_size_{max_size}, table_path_(path), table_name_("prism_data"),
+              legacy_table_name_("prism_data_legacy"),
+              disk_length_{0}, disk_size_{0}, depth_{0}, in_transaction_{false},
+              savepoint_{false}, rollback_only_{false}, saved_disk_length_{0},
+              saved_disk_size_{0} {
         if (max_size_ == 0LL) {
             throw PriorityDBException{"Must specify a nonzero max_size"};
         }
+        open_db_();
+        configure_db_(options);
         if (!check_table_()) {
             create_table_();
+        } else {
+            migrate_table_();
         }
         delete_memory_messages_();
+        prepare_statements_();
+        load_disk_totals_();
+    }
+
+    ~Impl() {
+        try {
+            Flush();
+        } catch (const PriorityDBException&) {
+            // Closing the connection rolls back whatever could not be committed
+        }
     }
 
-    void Insert(const unsigned long long& priority, const std::string& hash,
-                const unsigned long long& size, const bool& on_disk);
-    void Delete(const std::string& hash);
-    void Update(const std::string& hash, const bool& on_disk);
-    std::string GetHighestHash(bool& on_disk);
-    std::string GetLowestMemoryHash();
-    std::string GetLowestDiskHash();
-    bool Full();
-    int GetDiskLength();
-    unsigned long long GetDiskSize();
+    void Begin() override;
+    void Commit() override;
+    void Rollback() override;
+    void Flush() override;
+    void Insert(const unsigned long long& priority, const unsigned long long& id,
+                const unsigned long long& size, const bool& on_disk) override;
+    void Delete(const unsigned long long& id) override;
+    void Update(const unsigned long long& id, const bool& on_disk) override;
+    void SetLocation(const unsigned long long& id, const PriorityLocation& location) override;
+    bool GetLocation(const unsigned long long& id, PriorityLocation& location) override;
+    unsigned long long GetHighestId(bool& on_disk) override;
+    bool GetHighestPriority(unsigned long long& priority) override;
+    unsigned long long GetLowestMemoryId() override;
+    unsigned long long GetLowestDiskId() override;
+    bool GetLowestPriority(const bool& on_disk, unsigned long long& priority) override;
+    unsigned long long GetHighestDiskId(const int& depth) override;
+    unsigned long long GetMaxId() override;
+    bool Full() override;
+    int GetDiskLength() override;
+    unsigned long long GetDiskSize() override;
+    std::vector<unsigned long long> GetSegmentIds(const unsigned long long& segment) override;
+    std::map<unsigned long long, unsigned long long> GetSegmentSizes() override;
+    std::map<unsigned long long, std::string> GetLegacyHashes() override;
+    void DeleteLegacyHashes() override;
 
   private:
-    typedef std::map<std::string, std::string> Record;
+    typedef std::unique_ptr<sqlite3_stmt, std::function<int(sqlite3_stmt*)>> Statement;
+
+    // Resets a cached statement and its bindings once the current use of it goes out of scope,
+    // so that it is ready to be bound and stepped again by the next caller.
+    class StatementReset {
+      public:
+        StatementReset(const Statement& statement) : statement_(statement.get()) {}
+        ~StatementReset() {
+            sqlite3_reset(statement_);
+            sqlite3_clear_bindings(statement_);
+        }
 
-    std::unique_ptr<sqlite3, std::function<int(sqlite3*)>> open_db_();
+      private:
+        sqlite3_stmt* statement_;
+    };
+
+    void open_db_();
+    void configure_db_(const PriorityDBOptions& options);
     bool check_table_();
     void create_table_();
+    void migrate_table_();
+    void migrate_hashes_();
+    void migrate_locations_();
+    void create_indexes_();
+    void set_schema_version_();
+    int get_schema_version_();
     void delete_memory_messages_();
-    std::vector<Record> execute_(const std::string& sql);
-    static int callback_(void* response_ptr, int num_values, char** values, char** names);
+    void prepare_statements_();
+    void load_disk_totals_();
+    void undo_();
+    void count_rows_(const unsigned long long& id, const bool& on_disk,
+                     unsigned long long& length, unsigned long long& size);
+    void execute_(const std::string& sql);
+    Statement prepare_(const std::string& sql);
+    bool step_(const Statement& statement);
+    std::string column_text_(const Statement& statement, const int& column);
 
     std::string table_path_;
     std::string table_name_;
+    std::string legacy_table_name_;
     unsigned long long max_size_;
+
+    // Running totals of the messages on disk, so that Full() doesn't have to aggregate the table
+    unsigned long long disk_length_;
+    unsigned long long disk_size_;
+
+    // Operations nest inside one another, and only the outermost one touches the transaction. It
+    // either opens a new transaction or, if committed operations are still waiting for Flush(),
+    // runs inside a savepoint of the open one so that it can be rolled back on its own.
+    int depth_;
+    bool in_transaction_;
+    bool savepoint_;
+    bool rollback_only_;
+    unsigned long long saved_disk_length_;
+    unsigned long long saved_disk_size_;
+
+    // The connection has to outlive every statement prepared on it, so it is declared first
+    std::unique_ptr<sqlite3, std::function<int(sqlite3*)>> db_;
+    Statement insert_statement_;
+    Statement delete_statement_;
+    Statement update_statement_;
+    Statement set_location_statement_;
+    Statement get_location_statement_;
+    Statement segment_ids_statement_;
+    Statement highest_statement_;
+    Statement lowest_statement_;
+    Statement highest_disk_statement_;
+    Statement ahead_statement_;
+    Statement totals_statement_;
+    Statement begin_statement_;
+    Statement commit_statement_;
+    Statement rollback_statement_;
+    Statement savepoint_statement_;
+    Statement release_statement_;
+    Statement rollback_to_statement_;
 };
 
-void PriorityDB::Impl::Insert(const unsigned long long& priority, const std::string& hash,
-                              const unsigned long long& size, const bool& on_disk) {
-    if (hash.empty()) {
+void PriorityDB::Impl::Begin() {
+    if (depth_++ > 0) {
         return;
     }
 
-    std::stringstream stream;
-    stream << "INSERT INTO "
-           << table_name_
-           << "(priority, hash, size, on_disk)"
-           << "VALUES"
-           << "("
-           << priority << ","
-           << "'" << hash << "',"
-           << size << ","
-           << on_disk
-           << ");";
-    execute_(stream.str());
+    saved_disk_length_ = disk_length_;
+    saved_disk_size_ = disk_size_;
+    rollback_only_ = false;
+    savepoint_ = in_transaction_;
+    try {
+        if (savepoint_) {
+            StatementReset reset{savepoint_statement_};
+            step_(savepoint_statement_);
+        } else {
+            StatementReset reset{begin_statement_};
+            step_(begin_statement_);
+            in_transaction_ = true;
+        }
+    } catch (const PriorityDBException&) {
+        depth_ = 0;
+        throw;
+    }
 }
 
-void PriorityDB::Impl::Delete(const std::string& hash) {
-    if (hash.empty()) {
+void PriorityDB::Impl::Commit() {
+    if (depth_ == 0 || --depth_ > 0) {
         return;
     }
 
-    std::stringstream stream;
-    stream << "DELETE FROM "
-           << table_name_
-           << " WHERE hash='"
-           << hash
-           << "';";
-    execute_(stream.str());
+    if (rollback_only_) {
+        undo_();
+    } else if (savepoint_) {
+        StatementReset reset{release_statement_};
+        step_(release_statement_);
+    }
 }
 
-void PriorityDB::Impl::Update(const std::string& hash, const bool& on_disk) {
-    if (hash.empty()) {
+void PriorityDB::Impl::Rollback() {
+    if (depth_ == 0) {
+        return;
+    }
+    if (--depth_ > 0) {
+        rollback_only_ = true;
         return;
     }
 
-    std::stringstream stream;
-    stream << "UPDATE "
-           << table_name_
-           << " SET on_disk="
-           << on_disk
-           << " WHERE hash='"
-           << hash
-           << "';";
-    execute_(stream.str());
+    undo_();
 }
 
-std::string PriorityDB::Impl::GetHighestHash(bool& on_disk) {
-    std::stringstream stream;
-    stream << "SELECT hash, on_disk FROM "
-           << table_name_
-           << " ORDER BY priority DESC, on_disk ASC LIMIT 1;";
-    auto response = execute_(stream.str());
-    std::string hash;
-    if (!response.empty()) {
-        auto record = response[0];
-        if (!record.empty()) {
-            hash = record["hash"];
-            on_disk = std::stoi(record["on_disk"]);
+void PriorityDB::Impl::Flush() {
+    if (depth_ > 0 || !in_transaction_) {
+        return;
+    }
+
+    in_transaction_ = false;
+    if (!sqlite3_get_autocommit(db_.get())) {
+        StatementReset reset{commit_statement_};
+        step_(commit_statement_);
+    }
+}
+
+void PriorityDB::Impl::undo_() {
+    if (sqlite3_get_autocommit(db_.get())) {
+        // SQLite already rolled back the whole transaction on its own, taking any other operations
+        // that were waiting for Flush() with it
+        in_transaction_ = false;
+        load_disk_totals_();
+        return;
+    }
+
+    if (savepoint_) {
+        {
+            StatementReset reset{rollback_to_statement_};
+            step_(rollback_to_statement_);
         }
+        StatementReset reset{release_statement_};
+        step_(release_statement_);
+    } else {
+        in_transaction_ = false;
+        StatementReset reset{rollback_statement_};
+        step_(rollback_statement_);
     }
+    disk_length_ = saved_disk_length_;
+    disk_size_ = saved_disk_size_;
+}
 
-    return hash;
+void PriorityDB::Impl::Insert(const unsigned long long& priority, const unsigned long long& id,
+                              const unsigned long long& size, const bool& on_disk) {
+    if (id == 0) {
+        return;
+    }
+
+    StatementReset reset{insert_statement_};
+    sqlite3_bind_int64(insert_statement_.get(), 1, id);
+    sqlite3_bind_int64(insert_statement_.get(), 2, priority);
+    sqlite3_bind_int64(insert_statement_.get(), 3, size);
+    sqlite3_bind_int(insert_statement_.get(), 4, on_disk);
+    step_(insert_statement_);
+
+    if (on_disk) {
+        ++disk_length_;
+        disk_size_ += size;
+    }
 }
 
-std::string PriorityDB::Impl::GetLowestMemoryHash() {
-    std::stringstream stream;
-    stream << "SELECT hash FROM "
-           << table_name_
-           << " WHERE on_disk="
-           << false
-           << " ORDER BY priority ASC LIMIT 1;";
-    auto response = execute_(stream.str());
-    std::string hash;
-    if (!response.empty()) {
-        auto record = response[0];
-        if (!record.empty()) {
-            hash = record["hash"];
+void PriorityDB::Impl::Delete(const unsigned long long& id) {
+    if (id == 0) {
+        return;
+    }
+
+    unsigned long long length, size;
+    count_rows_(id, true, length, size);
+
+    StatementReset reset{delete_statement_};
+    sqlite3_bind_int64(delete_statement_.get(), 1, id);
+    step_(delete_statement_);
+
+    disk_length_ -= length;
+    disk_size_ -= size;
+}
+
+void PriorityDB::Impl::Update(const unsigned long long& id, const bool& on_disk) {
+    if (id == 0) {
+        return;
+    }
+
+    // Only a row that actually changes location moves the totals
+    unsigned long long length, size;
+    count_rows_(id, !on_disk, length, size);
+
+    StatementReset reset{update_statement_};
+    sqlite3_bind_int(update_statement_.get(), 1, on_disk);
+    sqlite3_bind_int64(update_statement_.get(), 2, id);
+    step_(update_statement_);
+
+    if (on_disk) {
+        disk_length_ += length;
+        disk_size_ += size;
+    } else {
+        disk_length_ -= length;
+        disk_size_ -= size;
+    }
+}
+
+void PriorityDB::Impl::SetLocation(const unsigned long long& id,
+                                   const PriorityLocation& location) {
+    if (id == 0) {
+        return;
+    }
+
+    // Replaces whatever the row added to the totals before, if it was on disk already
+    unsigned long long length, size;
+    count_rows_(id, true, length, size);
+
+    StatementReset reset{set_location_statement_};
+    sqlite3_bind_int64(set_location_statement_.get(), 1, location.length);
+    sqlite3_bind_int64(set_location_statement_.get(), 2, location.segment);
+    sqlite3_bind_int64(set_location_statement_.get(), 3, location.offset);
+    sqlite3_bind_int64(set_location_statement_.get(), 4, id);
+    step_(set_location_statement_);
+
+    if (sqlite3_changes(db_.get()) > 0) {
+        disk_length_ += 1 - length;
+        disk_size_ += location.length - size;
+    }
+}
+
+bool PriorityDB::Impl::GetLocation(const unsigned long long& id, PriorityLocation& location) {
+    StatementReset reset{get_location_statement_};
+    sqlite3_bind_int64(get_location_statement_.get(), 1, id);
+    if (!step_(get_location_statement_)) {
+        return false;
+    }
+
+    location.segment = sqlite3_column_int64(get_location_statement_.get(), 0);
+    location.offset = sqlite3_column_int64(get_location_statement_.get(), 1);
+    location.length = sqlite3_column_int64(get_location_statement_.get(), 2);
+    return true;
+}
+
+unsigned long long PriorityDB::Impl::GetHighestId(bool& on_disk) {
+    StatementReset reset{highest_statement_};
+    unsigned long long id = 0;
+    if (step_(highest_statement_)) {
+        id = sqlite3_column_int64(highest_statement_.get(), 0);
+        on_disk = sqlite3_column_int(highest_statement_.get(), 1);
+    }
+
+    return id;
+}
+
+bool PriorityDB::Impl::GetHighestPriority(unsigned long long& priority) {
+    StatementReset reset{highest_statement_};
+    if (!step_(highest_statement_)) {
+        return false;
+    }
+
+    priority = sqlite3_column_int64(highest_statement_.get(), 2);
+    return true;
+}
+
+unsigned long long PriorityDB::Impl::GetLowestMemoryId() {
+    StatementReset reset{lowest_statement_};
+    sqlite3_bind_int(lowest_statement_.get(), 1, false);
+    unsigned long long id = 0;
+    if (step_(lowest_statement_)) {
+        id = sqlite3_column_int64(lowest_statement_.get(), 0);
+    }
+
+    return id;
+}
+
+unsigned long long PriorityDB::Impl::GetLowestDiskId() {
+    StatementReset reset{lowest_statement_};
+    sqlite3_bind_int(lowest_statement_.get(), 1, true);
+    unsigned long long id = 0;
+    if (step_(lowest_statement_)) {
+        id = sqlite3_column_int64(lowest_statement_.get(), 0);
+    }
+
+    return id;
+}
+
+bool PriorityDB::Impl::GetLowestPriority(const bool& on_disk, unsigned long long& priority) {
+    StatementReset reset{lowest_statement_};
+    sqlite3_bind_int(lowest_statement_.get(), 1, on_disk);
+    if (!step_(lowest_statement_)) {
+        return false;
+    }
+
+    priority = sqlite3_column_int64(lowest_statement_.get(), 1);
+    return true;
+}
+
+unsigned long long PriorityDB::Impl::GetHighestDiskId(const int& depth) {
+    if (depth <= 0) {
+        return 0;
+    }
+
+    unsigned long long id = 0, priority = 0;
+    {
+        StatementReset reset{highest_disk_statement_};
+        if (!step_(highest_disk_statement_)) {
+            return 0;
         }
+        id = sqlite3_column_int64(highest_disk_statement_.get(), 0);
+        priority = sqlite3_column_int64(highest_disk_statement_.get(), 1);
+    }
+
+    StatementReset reset{ahead_statement_};
+    sqlite3_bind_int64(ahead_statement_.get(), 1, priority);
+    sqlite3_bind_int(ahead_statement_.get(), 2, depth);
+    if (step_(ahead_statement_) && sqlite3_column_int(ahead_statement_.get(), 0) >= depth) {
+        return 0;
     }
 
-    return hash;
+    return id;
 }
 
-std::string PriorityDB::Impl::GetLowestDiskHash() {
+unsigned long long PriorityDB::Impl::GetMaxId() {
+    // AUTOINCREMENT keeps the largest id the table has ever held in sqlite_sequence, including
+    // those of messages that have since been deleted
     std::stringstream stream;
-    stream << "SELECT hash FROM "
+    stream << "SELECT seq FROM sqlite_sequence WHERE name='"
            << table_name_
-           << " WHERE on_disk="
-           << true
-           << " ORDER BY priority ASC LIMIT 1;";
-    auto response = execute_(stream.str());
-    std::string hash;
-    if (!response.empty()) {
-        auto record = response[0];
-        if (!record.empty()) {
-            hash = record["hash"];
-        }
+           << "';";
+    auto statement = prepare_(stream.str());
+    unsigned long long id = 0;
+    if (step_(statement)) {
+        id = sqlite3_column_int64(statement.get(), 0);
     }
 
-    return hash;
+    return id;
 }
 
-bool PriorityDB::Impl::Full() {
-    return GetDiskSize() > max_size_;
+std::vector<unsigned long long> PriorityDB::Impl::GetSegmentIds(
+        const unsigned long long& segment) {
+    StatementReset reset{segment_ids_statement_};
+    sqlite3_bind_int64(segment_ids_statement_.get(), 1, segment);
+    std::vector<unsigned long long> ids;
+    while (step_(segment_ids_statement_)) {
+        ids.push_back(sqlite3_column_int64(segment_ids_statement_.get(), 0));
+    }
+
+    return ids;
 }
 
-int PriorityDB::Impl::GetDiskLength() {
+std::map<unsigned long long, unsigned long long> PriorityDB::Impl::GetSegmentSizes() {
     std::stringstream stream;
-    stream << "SELECT COUNT(*) FROM "
+    stream << "SELECT segment, SUM(size) FROM "
            << table_name_
-           << " WHERE on_disk="
-           << true
-           << ";";
-    auto response = execute_(stream.str());
-    unsigned long long total = 0;
-    if (!response.empty()) {
-        auto record = response[0];
-        if (!record.empty()) {
-            total = std::stoi(record["COUNT(*)"]);
-        }
+           << " WHERE segment>0 GROUP BY segment;";
+    auto statement = prepare_(stream.str());
+    std::map<unsigned long long, unsigned long long> sizes;
+    while (step_(statement)) {
+        sizes[sqlite3_column_int64(statement.get(), 0)] = sqlite3_column_int64(statement.get(), 1);
     }
 
-    return total;
+    return sizes;
 }
 
-unsigned long long PriorityDB::Impl::GetDiskSize() {
+std::map<unsigned long long, std::string> PriorityDB::Impl::GetLegacyHashes() {
+    std::map<unsigned long long, std::string> hashes;
+    {
+        std::stringstream stream;
+        stream << "SELECT name FROM sqlite_master WHERE type='table' AND name='"
+               << legacy_table_name_
+               << "';";
+        auto statement = prepare_(stream.str());
+        if (!step_(statement)) {
+            return hashes;
+        }
+    }
+
     std::stringstream stream;
-    stream << "SELECT SUM(size) FROM "
-           << table_name_
-           << " WHERE on_disk="
-           << true
+    stream << "SELECT id, hash FROM "
+           << legacy_table_name_
            << ";";
-    auto response = execute_(stream.str());
-    unsigned long long total = 0;
-    if (!response.empty()) {
-        auto record = response[0];
-        if (!record.empty()) {
-            total = std::stoi(record["SUM(size)"]);
-        }
+    auto statement = prepare_(stream.str());
+    while (step_(statement)) {
+        hashes[sqlite3_column_int64(statement.get(), 0)] = column_text_(statement, 1);
     }
 
-    return total;
+    return hashes;
 }
 
-std::unique_ptr<sqlite3, std::function<int(sqlite3*)>> PriorityDB::Impl::open_db_() {
+void PriorityDB::Impl::DeleteLegacyHashes() {
+    std::stringstream stream;
+    stream << "DROP TABLE IF EXISTS "
+           << legacy_table_name_
+           << ";";
+    execute_(stream.str());
+}
+
+bool PriorityDB::Impl::Full() {
+    return GetDiskSize() > max_size_;
+}
+
+int PriorityDB::Impl::GetDiskLength() {
+    return disk_length_;
+}
+
+unsigned long long PriorityDB::Impl::GetDiskSize() {
+    return disk_size_;
+}
+
+void PriorityDB::Impl::open_db_() {
     sqlite3* sqlite_db;
     if (sqlite3_open(table_path_.data(), &sqlite_db) != SQLITE_OK) {
-        throw PriorityDBException{sqlite3_errmsg(sqlite_db)};
+        auto error_string = std::string{sqlite3_errmsg(sqlite_db)};
+        sqlite3_close(sqlite_db);
+        throw PriorityDBException{error_string};
+    }
+    db_ = std::unique_ptr<sqlite3, std::function<int(sqlite3*)>>(sqlite_db, sqlite3_close);
+}
+
+void PriorityDB::Impl::configure_db_(const PriorityDBOptions& options) {
+    if (options.wal) {
+        execute_("PRAGMA journal_mode=WAL;");
+        std::stringstream stream;
+        stream << "PRAGMA wal_autocheckpoint="
+               << options.checkpoint_pages
+               << ";";
+        execute_(stream.str());
+    } else {
+        // The journal mode is stored in the file, so an index that used to run with a
+        // write-ahead log has to be switched back explicitly
+        execute_("PRAGMA journal_mode=DELETE;");
+    }
+    {
+        std::stringstream stream;
+        stream << "PRAGMA synchronous=";
+        switch (options.synchronous) {
+            case PriorityDBOptions::Synchronous::OFF:
+                stream << "OFF;";
+                break;
+            case PriorityDBOptions::Synchronous::NORMAL:
+                stream << "NORMAL;";
+                break;
+            case PriorityDBOptions::Synchronous::FULL:
+            case PriorityDBOptions::Synchronous::AUTO:
+                stream << "FULL;";
+                break;
+        }
+        execute_(stream.str());
+    }
+    if (options.mmap_size > 0) {
+        std::stringstream stream;
+        stream << "PRAGMA mmap_size="
+               << options.mmap_size
+               << ";";
+        execute_(stream.str());
+    }
+    if (options.cache_size != 0) {
+        std::stringstream stream;
+        stream << "PRAGMA cache_size="
+               << options.cache_size
+               << ";";
+        execute_(stream.str());
     }
-    return std::unique_ptr<sqlite3, std::function<int(sqlite3*)>>(sqlite_db, sqlite3_close);
 }
 
 bool PriorityDB::Impl::check_table_() {
@@ -210,93 +558,419 @@ bool PriorityDB::Impl::check_table_() {
     stream << "SELECT name FROM sqlite_master WHERE type='table' AND name='"
            << table_name_
            << "';";
-    auto response = execute_(stream.str());
+    auto statement = prepare_(stream.str());
 
-    return !response.empty();
+    return step_(statement);
 }
 
 void PriorityDB::Impl::create_table_() {
+    execute_("BEGIN;");
+    try {
+        // The id is the rowid, so Delete and Update look messages up by the primary key and every
+        // index entry already ends with it
+        std::stringstream stream;
+        stream << "CREATE TABLE "
+               << table_name_
+               << "("
+               << "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+               << "priority UNSIGNED BIGINT NOT NULL,"
+               << "size UNSIGNED BIGINT NOT NULL,"
+               << "on_disk BOOL NOT NULL,"
+               << "segment UNSIGNED BIGINT NOT NULL DEFAULT 0,"
+               << "segment_offset UNSIGNED BIGINT NOT NULL DEFAULT 0"
+               << ");";
+        execute_(stream.str());
+        create_indexes_();
+        set_schema_version_();
+        execute_("COMMIT;");
+    } catch (const PriorityDBException&) {
+        execute_("ROLLBACK;");
+        throw;
+    }
+}
+
+void PriorityDB::Impl::migrate_table_() {
+    auto version = get_schema_version_();
+    if (version >= PRIORITY_DB_SCHEMA_VERSION) {
+        return;
+    }
+
+    execute_("BEGIN;");
+    try {
+        if (version < 2) {
+            migrate_hashes_();
+        }
+        if (version < 3) {
+            migrate_locations_();
+        }
+        create_indexes_();
+        set_schema_version_();
+        execute_("COMMIT;");
+    } catch (const PriorityDBException&) {
+        execute_("ROLLBACK;");
+        throw;
+    }
+}
+
+void PriorityDB::Impl::migrate_hashes_() {
+    // Messages used to be looked up by a random hash, which also named their file. Their old
+    // autoincremented ids become their message ids, and the hashes of those on disk are kept
+    // aside until PriorityBuffer has renamed the files.
+    {
+        std::stringstream stream;
+        stream << "CREATE TABLE IF NOT EXISTS "
+               << legacy_table_name_
+               << "(id INTEGER PRIMARY KEY, hash TEXT NOT NULL);";
+        execute_(stream.str());
+    }
+    {
+        std::stringstream stream;
+        stream << "INSERT INTO "
+               << legacy_table_name_
+               << " SELECT id, hash FROM "
+               << table_name_
+               << " WHERE on_disk="
+               << true
+               << ";";
+        execute_(stream.str());
+    }
+    {
+        std::stringstream stream;
+        stream << "ALTER TABLE "
+               << table_name_
+               << " RENAME TO "
+               << table_name_ << "_hashes;";
+        execute_(stream.str());
+    }
+    {
+        std::stringstream stream;
+        stream << "CREATE TABLE "
+               << table_name_
+               << "("
+               << "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+               << "priority UNSIGNED BIGINT NOT NULL,"
+               << "size UNSIGNED BIGINT NOT NULL,"
+               << "on_disk BOOL NOT NULL"
+               << ");";
+        execute_(stream.str());
+    }
+    {
+        std::stringstream stream;
+        stream << "INSERT INTO "
+               << table_name_
+               << " SELECT id, priority, size, on_disk FROM "
+               << table_name_ << "_hashes;";
+        execute_(stream.str());
+    }
+    {
+        // Takes the indexes on the hash with it, which frees their names for create_indexes_()
+        std::stringstream stream;
+        stream << "DROP TABLE "
+               << table_name_ << "_hashes;";
+        execute_(stream.str());
+    }
+}
+
+void PriorityDB::Impl::migrate_locations_() {
+    // Every message on disk so far has a file of its own, which is what segment 0 stands for
+    for (auto& column : {"segment", "segment_offset"}) {
+        std::stringstream stream;
+        stream << "ALTER TABLE "
+               << table_name_
+               << " ADD COLUMN "
+               << column
+               << " UNSIGNED BIGINT NOT NULL DEFAULT 0;";
+        execute_(stream.str());
+    }
+}
+
+void PriorityDB::Impl::create_indexes_() {
+    // Serves GetHighestId, which orders by priority and then prefers messages in memory
+    {
+        std::stringstream stream;
+        stream << "CREATE INDEX IF NOT EXISTS "
+               << table_name_ << "_priority ON "
+               << table_name_
+               << "(priority DESC, on_disk ASC);";
+        execute_(stream.str());
+    }
+    // Serves GetLowestMemoryId and GetLowestDiskId
+    {
+        std::stringstream stream;
+        stream << "CREATE INDEX IF NOT EXISTS "
+               << table_name_ << "_on_disk_priority ON "
+               << table_name_
+               << "(on_disk, priority);";
+        execute_(stream.str());
+    }
+    // Serves GetSegmentIds. Messages in files of their own stay out of it, so it costs nothing
+    // unless segments are in use.
+    {
+        std::stringstream stream;
+        stream << "CREATE INDEX IF NOT EXISTS "
+               << table_name_ << "_segment ON "
+               << table_name_
+               << "(segment) WHERE segment>0;";
+        execute_(stream.str());
+    }
+}
+
+void PriorityDB::Impl::set_schema_version_() {
     std::stringstream stream;
-    stream << "CREATE TABLE "
-           << table_name_
-           << "("
-           << "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-           << "priority UNSIGNED BIGINT NOT NULL,"
-           << "hash TEXT NOT NULL,"
-           << "size UNSIGNED BIGINT NOT NULL,"
-           << "on_disk BOOL NOT NULL"
-           << ");";
+    stream << "PRAGMA user_version="
+           << PRIORITY_DB_SCHEMA_VERSION
+           << ";";
     execute_(stream.str());
 }
 
+int PriorityDB::Impl::get_schema_version_() {
+    auto statement = prepare_("PRAGMA user_version;");
+    int version = 0;
+    if (step_(statement)) {
+        version = sqlite3_column_int(statement.get(), 0);
+    }
+
+    return version;
+}
+
 void PriorityDB::Impl::delete_memory_messages_() {
     std::stringstream stream;
     stream << "DELETE FROM "
            << table_name_
-           << " WHERE on_disk='"
+           << " WHERE on_disk="
            << false
-           << "';";
+           << ";";
     execute_(stream.str());
 }
 
-std::vector<PriorityDB::Impl::Record> PriorityDB::Impl::execute_(const std::string& sql) {
-    std::vector<Record> response;
-    auto db = open_db_();
-    char* error;
-    int rc = sqlite3_exec(db.get(), sql.data(), &PriorityDB::Impl::callback_, &response, &error);
-    if (rc != SQLITE_OK) {
-        auto error_string = std::string{error};
-        sqlite3_free(error);
-        throw PriorityDBException{error_string};
+void PriorityDB::Impl::prepare_statements_() {
+    {
+        std::stringstream stream;
+        stream << "INSERT INTO "
+               << table_name_
+               << "(id, priority, size, on_disk)"
+               << "VALUES(?, ?, ?, ?);";
+        insert_statement_ = prepare_(stream.str());
+    }
+    {
+        std::stringstream stream;
+        stream << "DELETE FROM "
+               << table_name_
+               << " WHERE id=?;";
+        delete_statement_ = prepare_(stream.str());
+    }
+    {
+        std::stringstream stream;
+        stream << "UPDATE "
+               << table_name_
+               << " SET on_disk=?, segment=0, segment_offset=0 WHERE id=?;";
+        update_statement_ = prepare_(stream.str());
+    }
+    {
+        std::stringstream stream;
+        stream << "UPDATE "
+               << table_name_
+               << " SET on_disk=1, size=?, segment=?, segment_offset=? WHERE id=?;";
+        set_location_statement_ = prepare_(stream.str());
+    }
+    {
+        std::stringstream stream;
+        stream << "SELECT segment, segment_offset, size FROM "
+               << table_name_
+               << " WHERE id=? AND on_disk=1;";
+        get_location_statement_ = prepare_(stream.str());
+    }
+    {
+        // Repeats the condition of the segment index, which SQLite can't infer from the binding
+        std::stringstream stream;
+        stream << "SELECT id FROM "
+               << table_name_
+               << " WHERE segment=? AND segment>0;";
+        segment_ids_statement_ = prepare_(stream.str());
+    }
+    {
+        std::stringstream stream;
+        stream << "SELECT id, on_disk, priority FROM "
+               << table_name_
+               << " ORDER BY priority DESC, on_disk ASC LIMIT 1;";
+        highest_statement_ = prepare_(stream.str());
+    }
+    {
+        std::stringstream stream;
+        stream << "SELECT id, priority FROM "
+               << table_name_
+               << " WHERE on_disk=? ORDER BY priority ASC LIMIT 1;";
+        lowest_statement_ = prepare_(stream.str());
+    }
+    {
+        // Breaks ties by age like GetHighestId, without sorting every message on disk
+        std::stringstream stream;
+        stream << "SELECT id, priority FROM "
+               << table_name_
+               << " WHERE on_disk=1 AND priority=(SELECT MAX(priority) FROM "
+               << table_name_
+               << " WHERE on_disk=1) ORDER BY id ASC LIMIT 1;";
+        highest_disk_statement_ = prepare_(stream.str());
+    }
+    {
+        // Counts the messages in memory that are popped before a given priority, up to a limit
+        std::stringstream stream;
+        stream << "SELECT COUNT(*) FROM (SELECT 1 FROM "
+               << table_name_
+               << " WHERE on_disk=0 AND priority>=? LIMIT ?);";
+        ahead_statement_ = prepare_(stream.str());
+    }
+    {
+        std::stringstream stream;
+        stream << "SELECT COUNT(*), SUM(size) FROM "
+               << table_name_
+               << " WHERE id=? AND on_disk=?;";
+        totals_statement_ = prepare_(stream.str());
+    }
+    begin_statement_ = prepare_("BEGIN;");
+    commit_statement_ = prepare_("COMMIT;");
+    rollback_statement_ = prepare_("ROLLBACK;");
+    savepoint_statement_ = prepare_("SAVEPOINT operation;");
+    release_statement_ = prepare_("RELEASE operation;");
+    rollback_to_statement_ = prepare_("ROLLBACK TO operation;");
+}
+
+void PriorityDB::Impl::load_disk_totals_() {
+    std::stringstream stream;
+    stream << "SELECT COUNT(*), SUM(size) FROM "
+           << table_name_
+           << " WHERE on_disk="
+           << true
+           << ";";
+    auto statement = prepare_(stream.str());
+    if (step_(statement)) {
+        disk_length_ = sqlite3_column_int64(statement.get(), 0);
+        disk_size_ = sqlite3_column_int64(statement.get(), 1);
     }
+}
 
-    return response;
+void PriorityDB::Impl::count_rows_(const unsigned long long& id, const bool& on_disk,
+                                   unsigned long long& length, unsigned long long& size) {
+    StatementReset reset{totals_statement_};
+    sqlite3_bind_int64(totals_statement_.get(), 1, id);
+    sqlite3_bind_int(totals_statement_.get(), 2, on_disk);
+    length = 0;
+    size = 0;
+    if (step_(totals_statement_)) {
+        length = sqlite3_column_int64(totals_statement_.get(), 0);
+        size = sqlite3_column_int64(totals_statement_.get(), 1);
+    }
 }
 
-int PriorityDB::Impl::callback_(void* response_ptr, int num_values, char** values, char** names) {
-    auto response = (std::vector<Record>*) response_ptr;
-    auto record = Record();
-    for (int i = 0; i < num_values; ++i) {
-        if (values[i]) {
-            record[names[i]] = values[i];
-        }
+void PriorityDB::Impl::execute_(const std::string& sql) {
+    auto statement = prepare_(sql);
+    while (step_(statement)) {}
+}
+
+PriorityDB::Impl::Statement PriorityDB::Impl::prepare_(const std::string& sql) {
+    sqlite3_stmt* statement;
+    if (sqlite3_prepare_v2(db_.get(), sql.data(), sql.size(), &statement, nullptr) != SQLITE_OK) {
+        throw PriorityDBException{sqlite3_errmsg(db_.get())};
     }
+    return Statement(statement, sqlite3_finalize);
+}
 
-    response->push_back(record);
+bool PriorityDB::Impl::step_(const Statement& statement) {
+    auto rc = sqlite3_step(statement.get());
+    if (rc == SQLITE_ROW) {
+        return true;
+    } else if (rc != SQLITE_DONE) {
+        throw PriorityDBException{sqlite3_errmsg(db_.get())};
+    }
 
-    return 0;
+    return false;
+}
+
+std::string PriorityDB::Impl::column_text_(const Statement& statement, const int& column) {
+    auto text = sqlite3_column_text(statement.get(), column);
+    if (text == nullptr) {
+        return std::string{};
+    }
+    return std::string{reinterpret_cast<const char*>(text),
+                       static_cast<size_t>(sqlite3_column_bytes(statement.get(), column))};
 }
 
 
 // Bridge
 
-PriorityDB::PriorityDB(const unsigned long long& max_size, const std::string& path)
-        : pimpl_{ new Impl{max_size, path} } {}
+PriorityDB::PriorityDB(const unsigned long long& max_size, const std::string& path,
+                       const PriorityDBOptions& options) {
+    if (options.backend == PriorityDBOptions::Backend::MEMORY) {
+        pimpl_.reset(new PriorityMemoryIndex{max_size, path + "-index", options});
+    } else {
+        pimpl_.reset(new Impl{max_size, path, options});
+    }
+}
 PriorityDB::~PriorityDB() {}
 
-void PriorityDB::Insert(const unsigned long long& priority, const std::string& hash,
+void PriorityDB::Begin() {
+    pimpl_->Begin();
+}
+
+void PriorityDB::Commit() {
+    pimpl_->Commit();
+}
+
+void PriorityDB::Rollback() {
+    pimpl_->Rollback();
+}
+
+void PriorityDB::Flush() {
+    pimpl_->Flush();
+}
+
+void PriorityDB::Insert(const unsigned long long& priority, const unsigned long long& id,
                         const unsigned long long& size, const bool& on_disk) {
-    pimpl_->Insert(priority, hash, size, on_disk);
+    pimpl_->Insert(priority, id, size, on_disk);
+}
+
+void PriorityDB::Delete(const unsigned long long& id) {
+    pimpl_->Delete(id);
+}
+
+void PriorityDB::Update(const unsigned long long& id, const bool& on_disk) {
+    pimpl_->Update(id, on_disk);
+}
+
+void PriorityDB::SetLocation(const unsigned long long& id, const PriorityLocation& location) {
+    pimpl_->SetLocation(id, location);
 }
 
-void PriorityDB::Delete(const std::string& hash) {
-    pimpl_->Delete(hash);
+bool PriorityDB::GetLocation(const unsigned long long& id, PriorityLocation& location) {
+    return pimpl_->GetLocation(id, location);
 }
 
-void PriorityDB::Update(const std::string& hash, const bool& on_disk) {
-    pimpl_->Update(hash, on_disk);
+unsigned long long PriorityDB::GetHighestId(bool& on_disk) {
+    return pimpl_->GetHighestId(on_disk);
 }
 
-std::string PriorityDB::GetHighestHash(bool& on_disk) {
-    return pimpl_->GetHighestHash(on_disk);
+bool PriorityDB::GetHighestPriority(unsigned long long& priority) {
+    return pimpl_->GetHighestPriority(priority);
 }
 
-std::string PriorityDB::GetLowestMemoryHash() {
-    return pimpl_->GetLowestMemoryHash();
+unsigned long long PriorityDB::GetLowestMemoryId() {
+    return pimpl_->GetLowestMemoryId();
 }
 
-std::string PriorityDB::GetLowestDiskHash() {
-    return pimpl_->GetLowestDiskHash();
+unsigned long long PriorityDB::GetLowestDiskId() {
+    return pimpl_->GetLowestDiskId();
+}
+
+bool PriorityDB::GetLowestPriority(const bool& on_disk, unsigned long long& priority) {
+    return pimpl_->GetLowestPriority(on_disk, priority);
+}
+
+unsigned long long PriorityDB::GetHighestDiskId(const int& depth) {
+    return pimpl_->GetHighestDiskId(depth);
+}
+
+unsigned long long PriorityDB::GetMaxId() {
+    return pimpl_->GetMaxId();
 }
 
 bool PriorityDB::Full() {
@@ -310,3 +984,19 @@ int PriorityDB::GetDiskLength() {
 unsigned long long PriorityDB::GetDiskSize() {
     return pimpl_->GetDiskSize();
 }
+
+std::vector<unsigned long long> PriorityDB::GetSegmentIds(const unsigned long long& segment) {
+    return pimpl_->GetSegmentIds(segment);
+}
+
+std::map<unsigned long long, unsigned long long> PriorityDB::GetSegmentSizes() {
+    return pimpl_->GetSegmentSizes();
+}
+
+std::map<unsigned long long, std::string> PriorityDB::GetLegacyHashes() {
+    return pimpl_->GetLegacyHashes();
+}
+
+void PriorityDB::DeleteLegacyHashes() {
+    pimpl_->DeleteLegacyHashes();
+}
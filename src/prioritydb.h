@@ -1,29 +1,113 @@
 #ifndef PRIORITY_DB_H
 #define PRIORITY_DB_H
 
+#include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
+#include "priorityindex.h"
+
+
+struct PriorityDBOptions {
+    enum class Backend { SQLITE, MEMORY };
+    enum class Synchronous { OFF, NORMAL, FULL, AUTO };
+
+    PriorityDBOptions()
+            : backend{Backend::SQLITE}, wal{false}, synchronous{Synchronous::AUTO}, mmap_size{0},
+              cache_size{0}, checkpoint_pages{1000} {}
+
+    // SQLITE keeps the index in an SQLite database at the given path. MEMORY keeps it in ordered
+    // in-process structures and only writes a journal of the messages on disk, which is read back
+    // and compacted at startup. The two backends keep separate files and don't share messages.
+    Backend backend;
+    // Use a write-ahead log instead of the rollback journal
+    bool wal;
+    // How often SQLite waits for the index to reach the disk. NORMAL is only durable with wal.
+    // AUTO follows the durability of the messages in a PriorityBuffer, and is FULL anywhere else.
+    Synchronous synchronous;
+    // Bytes of the index file to memory map, 0 disables memory mapped I/O
+    unsigned long long mmap_size;
+    // Page cache size, in pages when positive and in KiB when negative. 0 keeps the default
+    int cache_size;
+    // Pages the write-ahead log can grow to before it is checkpointed into the index file, 0
+    // disables automatic checkpoints
+    int checkpoint_pages;
+};
 
 class PriorityDB {
   public:
-    PriorityDB(const unsigned long long& max_size, const std::string& path);
+    PriorityDB(const unsigned long long& max_size, const std::string& path,
+               const PriorityDBOptions& options=PriorityDBOptions{});
     ~PriorityDB();
 
-    void Insert(const unsigned long long& priority, const std::string& hash,
+    // Everything between Begin() and Commit() is applied atomically, and Rollback() undoes it.
+    // Committed operations are kept in an open transaction until Flush(), so that several of them
+    // share a single sync of the index. Begin() and Commit() may be nested.
+    void Begin();
+    void Commit();
+    void Rollback();
+    void Flush();
+
+    void Insert(const unsigned long long& priority, const unsigned long long& id,
                 const unsigned long long& size, const bool& on_disk=false);
-    void Delete(const std::string& hash);
-    void Update(const std::string& hash, const bool& on_disk);
-    std::string GetHighestHash(bool& on_disk);
-    std::string GetLowestMemoryHash();
-    std::string GetLowestDiskHash();
+    void Delete(const unsigned long long& id);
+    void Update(const unsigned long long& id, const bool& on_disk);
+    // Moves a message to disk at the location PriorityFS wrote it to. Its size becomes the length
+    // it takes up there.
+    void SetLocation(const unsigned long long& id, const PriorityLocation& location);
+    // false if the message is not on disk
+    bool GetLocation(const unsigned long long& id, PriorityLocation& location);
+    unsigned long long GetHighestId(bool& on_disk);
+    // The priority of the message GetHighestId() returns. false if there are no messages.
+    bool GetHighestPriority(unsigned long long& priority);
+    unsigned long long GetLowestMemoryId();
+    unsigned long long GetLowestDiskId();
+    // The priority of the message GetLowestDiskId() or GetLowestMemoryId() returns. false if
+    // there is none.
+    bool GetLowestPriority(const bool& on_disk, unsigned long long& priority);
+    // The highest priority message on disk, if fewer than depth messages in memory would be popped
+    // before it. 0 otherwise.
+    unsigned long long GetHighestDiskId(const int& depth);
+    // The largest id ever inserted, so that ids keep increasing across restarts. 0 when empty.
+    unsigned long long GetMaxId();
     bool Full();
     int GetDiskLength();
     unsigned long long GetDiskSize();
+    // The messages stored in a segment, and the bytes of every segment that are still in use
+    std::vector<unsigned long long> GetSegmentIds(const unsigned long long& segment);
+    std::map<unsigned long long, unsigned long long> GetSegmentSizes();
+
+    std::map<unsigned long long, std::string> GetLegacyHashes();
+    void DeleteLegacyHashes();
 
   private:
     class Impl;
-    std::unique_ptr<Impl> pimpl_;
+    std::unique_ptr<PriorityIndex> pimpl_;
+};
+
+// Begins an operation on construction and rolls it back on destruction unless it was committed
+class PriorityDBTransaction {
+  public:
+    PriorityDBTransaction(PriorityDB& db) : db_(db), done_{false} {
+        db_.Begin();
+    }
+    ~PriorityDBTransaction() {
+        if (!done_) {
+            try {
+                db_.Rollback();
+            } catch (const std::exception&) {}
+        }
+    }
+
+    void Commit() {
+        done_ = true;
+        db_.Commit();
+    }
+
+  private:
+    PriorityDB& db_;
+    bool done_;
 };
 
 class PriorityDBException : public std::exception {
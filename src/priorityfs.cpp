@@ -1,29 +1,198 @@
 #include "priorityfs.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <condition_variable>
 #include <exception>
+#include <utility>
 
 #include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
+#include <vector>
+
+#ifdef PRIORITYBUFFER_LZ4
+#include "lz4.h"
+#endif
+#include "prioritycrc.h"
+#include "priorityio.h"
+
+
+// Levels of subdirectories beyond this would hold one file each
+#define MAX_DIRECTORY_LEVELS 2
+// Deferred unlinks that wake the background thread even without a Flush()
+#define DEFERRED_UNLINK_BATCH 64
+// BATCH durability keeps the file of every message it has yet to sync open, so it syncs no later
+// than this many of them, well short of the usual limit on open files
+#define MAX_BATCH_MESSAGES 256
+// Every record starts with a header of its own: three bytes to tell it from a record written before
+// headers, which can't start with 0xff as no serialized message does, and one for the format of
+// what follows, then its length and CRC-32C, both little endian
+#define RECORD_MAGIC "\xffPB"
+#define RECORD_HEADER_SIZE 12
+// The message as it is
+#define RECORD_RAW 1
+// The length of the message, little endian, then the message as an LZ4 block
+#define RECORD_LZ4 2
 
 
 namespace fs = boost::filesystem;
 
 class PriorityFS::Impl {
   public:
-    Impl(const std::string& buffer_directory, const std::string& buffer_parent);
+    Impl(const std::string& buffer_directory, const std::string& buffer_parent,
+         const PriorityFSOptions& options);
+    ~Impl();
 
     std::string GetFilePath(const std::string& file);
     bool GetInput(const std::string& file, std::ifstream& stream);
     bool GetOutput(const std::string& file, std::ofstream& stream);
     bool Delete(const std::string& file);
+    bool Rename(const std::string& file, const std::string& new_file);
+    bool Write(const unsigned long long& id, const std::string& data, PriorityLocation& location);
+    bool Read(const unsigned long long& id, const PriorityLocation& location, std::string& data);
+    bool Read(const unsigned long long& id, const PriorityLocation& location,
+              const std::function<bool(const char*, const size_t&)>& parse);
+    bool Release(const unsigned long long& id, const PriorityLocation& location);
+    bool Write(std::vector<PriorityRecord>& records);
+    bool Read(std::vector<PriorityRecord>& records);
+    bool Release(std::vector<PriorityRecord>& records);
+    bool Discard(std::vector<PriorityRecord>& records);
+    bool Flush();
+    bool Sync();
+    bool Synced();
+    unsigned long long GetSparseSegment();
+    void RecoverSegments(const std::map<unsigned long long, unsigned long long>& sizes);
+    void RecoverFiles(const unsigned long long& max_id);
+    unsigned long long GetCorruptRecords();
 
   private:
+    struct Segment {
+        // Bytes appended to the segment, and how many of those still belong to a message
+        unsigned long long size;
+        unsigned long long live;
+    };
+
+    fs::path get_file_path_(const std::string& file);
+    bool create_parent_(const fs::path& file_path);
+    int read_layout_();
+    void migrate_layout_();
+    bool release_(std::vector<PriorityRecord>& records, const bool& defer);
+    void log_unlinks_();
+    void unlink_loop_();
+    void recover_unlinks_();
+    static void put_uint32_(char* bytes, const uint32_t& value);
+    static uint32_t get_uint32_(const char* bytes);
+    const std::string& frame_(const std::string& data, std::string& encoded, char* header);
+    bool unframe_(const char* record, const size_t& size, const PriorityLocation& location,
+                  const char*& message, size_t& length, std::string& decoded);
+    static void add_writes_(const std::string& payload, char* header, const int& fd,
+                            const off_t& offset, const size_t& index,
+                            std::vector<PriorityIORequest>& requests,
+                            std::vector<size_t>& indexes);
+    static std::vector<size_t> get_written_(const std::vector<PriorityIORequest>& requests,
+                                            const std::vector<size_t>& indexes);
+    bool write_file_(const unsigned long long& id, const char* header,
+                     const std::string& payload);
+    bool write_files_(std::vector<PriorityRecord>& records);
+    bool write_segments_(std::vector<PriorityRecord>& records);
+    bool submit_segment_writes_(std::vector<PriorityRecord>& records,
+                                std::vector<PriorityIORequest>& requests,
+                                std::vector<size_t>& indexes);
+    bool map_(const int& fd, const off_t& offset, const size_t& size,
+              const std::function<bool(const char*, const size_t&)>& parse);
+    std::vector<bool> commit_files_(const std::vector<int>& fds,
+                                    const std::vector<fs::path>& directories);
+    bool commit_segment_(const int& records);
+    void add_unsynced_(const int& records);
+    bool sync_unsynced_();
+    bool sync_(const int& fd);
+    bool sync_directory_(const fs::path& directory);
+    size_t write_at_(const int& fd, const char* data, const size_t& size, const off_t& offset);
+    bool open_segment_();
+    void close_segment_();
+    fs::path get_segment_path_(const unsigned long long& segment);
+
     fs::path buffer_path_;
+    fs::path layout_path_;
+    int directory_levels_;
+    unsigned long long mmap_threshold_;
+    PriorityFSOptions::Compression compression_;
+    unsigned long long compression_threshold_;
+    std::mutex directory_mutex_;
+    std::set<std::string> directories_;
+
+    fs::path segment_path_;
+    unsigned long long segment_size_;
+    double segment_compact_ratio_;
+
+    PriorityFSOptions::Durability durability_;
+    int batch_messages_;
+    std::chrono::milliseconds batch_window_;
+    bool sync_directories_;
+
+    // Records are appended to the active segment until it reaches segment_size_. Every other
+    // segment only shrinks, and is deleted once none of its records are needed.
+    std::mutex mutex_;
+    std::map<unsigned long long, Segment> segments_;
+    unsigned long long active_segment_;
+    unsigned long long last_segment_;
+    int active_fd_;
+
+    // What BATCH durability still has to sync. Files stay open until then.
+    std::vector<int> unsynced_fds_;
+    std::set<std::string> unsynced_directories_;
+    bool unsynced_segment_;
+    int unsynced_records_;
+    std::chrono::steady_clock::time_point first_unsynced_;
+    // A batch that Write() had to sync and failed to, reported by the next Flush() or Sync()
+    bool sync_failed_;
+
+    PriorityIO io_;
+
+    // Paths that Discard() let go of and the background thread has yet to unlink, and their lines
+    // that have yet to be appended to the log. The log is emptied whenever both are.
+    bool deferred_unlink_;
+    fs::path unlink_log_path_;
+    std::mutex unlink_mutex_;
+    std::condition_variable unlink_condition_;
+    std::vector<std::string> unlinks_;
+    std::string unlink_log_lines_;
+    int unlink_log_fd_;
+    bool stopping_unlinker_;
+    std::thread unlinker_;
+
+    std::atomic<unsigned long long> corrupt_records_;
 };
 
-PriorityFS::Impl::Impl(const std::string& buffer_directory, const std::string& buffer_parent) {
+PriorityFS::Impl::Impl(const std::string& buffer_directory, const std::string& buffer_parent,
+                       const PriorityFSOptions& options)
+        : directory_levels_{options.directory_levels}, mmap_threshold_{options.mmap_threshold},
+          compression_{options.compression},
+          compression_threshold_{options.compression_threshold},
+          segment_size_{options.segment_size},
+          segment_compact_ratio_{options.segment_compact_ratio},
+          durability_{options.durability},
+          batch_messages_{std::min(options.batch_messages, MAX_BATCH_MESSAGES)},
+          batch_window_{options.batch_ms}, sync_directories_{options.sync_directories},
+          active_segment_{0}, last_segment_{0}, active_fd_{-1}, unsynced_segment_{false},
+          unsynced_records_{0}, sync_failed_{false}, io_{options.io_depth},
+          deferred_unlink_{options.deferred_unlink}, unlink_log_fd_{-1}, stopping_unlinker_{false},
+          corrupt_records_{0} {
     auto parent_path = buffer_parent.empty() ? fs::temp_directory_path() : fs::path{buffer_parent};
     if (buffer_directory.empty()) {
         throw PriorityFSException{"Cannot initialize PriorityFS with an empty buffer path"};
@@ -33,15 +202,49 @@ PriorityFS::Impl::Impl(const std::string& buffer_directory, const std::string& b
             fs::equivalent(buffer_path_, parent_path / fs::path{".."})) {
         throw PriorityFSException{"PriorityFS must be initialized within a valid parent directory"};
     }
+    if (directory_levels_ < 0 || directory_levels_ > MAX_DIRECTORY_LEVELS) {
+        throw PriorityFSException{"PriorityFS supports up to " +
+                                  std::to_string(MAX_DIRECTORY_LEVELS) + " directory levels"};
+    }
+#ifndef PRIORITYBUFFER_LZ4
+    if (compression_ == PriorityFSOptions::Compression::LZ4) {
+        throw PriorityFSException{"PriorityFS was built without LZ4 compression"};
+    }
+#endif
     fs::create_directory(buffer_path_);
+    segment_path_ = buffer_path_ / fs::path{"segments"};
+    layout_path_ = buffer_path_ / fs::path{"layout"};
+    unlink_log_path_ = buffer_path_ / fs::path{"unlinks"};
+    if (read_layout_() != directory_levels_) {
+        migrate_layout_();
+    }
+    recover_unlinks_();
+    if (deferred_unlink_) {
+        unlinker_ = std::thread{&PriorityFS::Impl::unlink_loop_, this};
+    }
+}
+
+PriorityFS::Impl::~Impl() {
+    if (unlinker_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(unlink_mutex_);
+            stopping_unlinker_ = true;
+        }
+        unlink_condition_.notify_all();
+        unlinker_.join();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    sync_unsynced_();
+    close_segment_();
 }
 
 std::string PriorityFS::Impl::GetFilePath(const std::string& file) {
-    return (buffer_path_ / fs::path{file}).string();
+    return get_file_path_(file).string();
 }
 
 bool PriorityFS::Impl::GetInput(const std::string& file, std::ifstream& stream) {
-    auto file_path = buffer_path_ / fs::path{file};
+    auto file_path = get_file_path_(file);
     if (!fs::is_directory(file_path) &&
             std::string{".."} != file_path.filename().string() &&
             fs::exists(file_path)) {
@@ -52,10 +255,10 @@ bool PriorityFS::Impl::GetInput(const std::string& file, std::ifstream& stream)
 }
 
 bool PriorityFS::Impl::GetOutput(const std::string& file, std::ofstream& stream) {
-    auto file_path = buffer_path_ / fs::path{file};
+    auto file_path = get_file_path_(file);
     if (!fs::is_directory(file_path) &&
             std::string{".."} != file_path.filename().string() &&
-            !fs::exists(file_path)) {
+            !fs::exists(file_path) && create_parent_(file_path)) {
         stream.open(file_path.native(), std::ios::out | std::ios::binary);
         return true;
     }
@@ -63,22 +266,1010 @@ bool PriorityFS::Impl::GetOutput(const std::string& file, std::ofstream& stream)
 }
 
 bool PriorityFS::Impl::Delete(const std::string& file) {
-    auto file_path = buffer_path_ / fs::path{file};
+    auto file_path = get_file_path_(file);
     if (!fs::is_directory(file_path) &&
             std::string{".."} != file_path.filename().string() &&
             fs::exists(file_path)) {
-        return fs::remove(buffer_path_ / fs::path{file});
+        return fs::remove(file_path);
+    }
+    return false;
+}
+
+bool PriorityFS::Impl::Rename(const std::string& file, const std::string& new_file) {
+    auto file_path = get_file_path_(file);
+    auto new_file_path = get_file_path_(new_file);
+    if (!fs::is_directory(file_path) &&
+            std::string{".."} != file_path.filename().string() &&
+            std::string{".."} != new_file_path.filename().string() &&
+            fs::exists(file_path) && !fs::exists(new_file_path) &&
+            create_parent_(new_file_path)) {
+        boost::system::error_code error;
+        fs::rename(file_path, new_file_path, error);
+        return !error;
+    }
+    return false;
+}
+
+bool PriorityFS::Impl::Write(const unsigned long long& id, const std::string& data,
+                             PriorityLocation& location) {
+    char header[RECORD_HEADER_SIZE];
+    std::string encoded;
+    auto& payload = frame_(data, encoded, header);
+    auto length = RECORD_HEADER_SIZE + payload.size();
+    if (segment_size_ == 0) {
+        location = PriorityLocation{};
+        location.length = length;
+        return write_file_(id, header, payload);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (active_fd_ < 0 ||
+            (segments_[active_segment_].size > 0 &&
+             segments_[active_segment_].size + length > segment_size_)) {
+        if (!open_segment_()) {
+            return false;
+        }
+    }
+
+    auto& segment = segments_[active_segment_];
+    auto written = write_at_(active_fd_, header, RECORD_HEADER_SIZE, segment.size);
+    if (written == RECORD_HEADER_SIZE) {
+        written += write_at_(active_fd_, payload.data(), payload.size(),
+                             segment.size + RECORD_HEADER_SIZE);
+    }
+    if (written < length || !commit_segment_(1)) {
+        // Whatever did make it is never referenced, and goes when the segment does
+        segment.size += written;
+        return false;
+    }
+
+    location.segment = active_segment_;
+    location.offset = segment.size;
+    location.length = length;
+    segment.size += length;
+    segment.live += length;
+    return true;
+}
+
+bool PriorityFS::Impl::Read(const unsigned long long& id, const PriorityLocation& location,
+                            std::string& data) {
+    std::vector<PriorityRecord> records{PriorityRecord{id}};
+    records[0].location = location;
+    auto read = Read(records);
+    data.swap(records[0].data);
+    return read;
+}
+
+bool PriorityFS::Impl::Read(const unsigned long long& id, const PriorityLocation& location,
+                            const std::function<bool(const char*, const size_t&)>& parse) {
+    // Small records, and the length of a file, aren't worth the mapping
+    if (mmap_threshold_ == 0 || location.length < mmap_threshold_) {
+        std::string data;
+        return Read(id, location, data) && parse(data.data(), data.size());
+    }
+
+    auto path = location.segment == 0 ? get_file_path_(GetFileName(id)) :
+                                        get_segment_path_(location.segment);
+    auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    auto offset = static_cast<off_t>(location.offset);
+    auto size = static_cast<size_t>(location.length);
+    struct stat status;
+    auto parsed = false;
+    if (fstat(fd, &status) == 0) {
+        if (location.segment == 0) {
+            size = status.st_size;
+        }
+        if (offset + size <= static_cast<unsigned long long>(status.st_size)) {
+            auto unframed_parse = [this, &location, &parse] (const char* record,
+                                                             const size_t& size) {
+                const char* message;
+                size_t length;
+                std::string decoded;
+                return unframe_(record, size, location, message, length, decoded) &&
+                       parse(message, length);
+            };
+            parsed = map_(fd, offset, size, unframed_parse);
+        }
+    }
+    close(fd);
+    return parsed;
+}
+
+bool PriorityFS::Impl::Release(const unsigned long long& id, const PriorityLocation& location) {
+    std::vector<PriorityRecord> records{PriorityRecord{id}};
+    records[0].location = location;
+    return Release(records);
+}
+
+bool PriorityFS::Impl::Write(std::vector<PriorityRecord>& records) {
+    if (segment_size_ == 0) {
+        return write_files_(records);
+    }
+    return write_segments_(records);
+}
+
+bool PriorityFS::Impl::Read(std::vector<PriorityRecord>& records) {
+    // Records that share a segment share its descriptor
+    std::map<std::string, int> fds;
+    std::vector<PriorityIORequest> requests;
+    std::vector<size_t> indexes;
+    for (size_t i = 0; i < records.size(); ++i) {
+        auto& record = records[i];
+        record.data.clear();
+        record.done = false;
+        auto path = record.location.segment == 0 ? get_file_path_(GetFileName(record.id)) :
+                                                   get_segment_path_(record.location.segment);
+        auto find = fds.find(path.string());
+        if (find == fds.end()) {
+            find = fds.emplace(path.string(), open(path.c_str(), O_RDONLY)).first;
+        }
+        auto fd = find->second;
+        if (fd < 0) {
+            continue;
+        }
+
+        // The file of a message is the message, whatever the index thinks its length is
+        auto size = record.location.length;
+        struct stat status;
+        if (record.location.segment == 0) {
+            if (fstat(fd, &status) != 0) {
+                continue;
+            }
+            size = status.st_size;
+        }
+        record.data.resize(size);
+        record.done = size == 0;
+        if (record.done) {
+            continue;
+        }
+        requests.emplace_back(PriorityIORequest::Operation::READ, fd, &record.data[0], size,
+                              record.location.segment == 0 ? 0 : record.location.offset);
+        indexes.push_back(i);
+    }
+
+    io_.Submit(requests);
+    for (auto& fd : fds) {
+        if (fd.second >= 0) {
+            close(fd.second);
+        }
+    }
+
+    for (size_t k = 0; k < requests.size(); ++k) {
+        records[indexes[k]].done = requests[k].result == static_cast<long long>(requests[k].size);
+    }
+
+    // Only the message is handed back, and only if it is what was written
+    auto read = true;
+    for (auto& record : records) {
+        const char* message;
+        size_t length;
+        std::string decoded;
+        record.done = record.done && unframe_(record.data.data(), record.data.size(),
+                                              record.location, message, length, decoded);
+        if (!record.done) {
+            record.data.clear();
+        } else if (message == decoded.data()) {
+            record.data.swap(decoded);
+        } else {
+            record.data.erase(0, message - record.data.data());
+        }
+        read = read && record.done;
+    }
+    return read;
+}
+
+bool PriorityFS::Impl::Release(std::vector<PriorityRecord>& records) {
+    return release_(records, false);
+}
+
+bool PriorityFS::Impl::Discard(std::vector<PriorityRecord>& records) {
+    return release_(records, deferred_unlink_);
+}
+
+bool PriorityFS::Impl::Flush() {
+    log_unlinks_();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto synced = !sync_failed_;
+    sync_failed_ = false;
+    if (unsynced_records_ == 0 ||
+            (unsynced_records_ < batch_messages_ &&
+             std::chrono::steady_clock::now() - first_unsynced_ < batch_window_)) {
+        return synced;
+    }
+    return sync_unsynced_() && synced;
+}
+
+bool PriorityFS::Impl::Sync() {
+    log_unlinks_();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto synced = !sync_failed_;
+    sync_failed_ = false;
+    return sync_unsynced_() && synced;
+}
+
+bool PriorityFS::Impl::Synced() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return unsynced_records_ == 0;
+}
+
+unsigned long long PriorityFS::Impl::GetSparseSegment() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& segment : segments_) {
+        if (segment.first != active_segment_ &&
+                segment.second.live < segment.second.size * segment_compact_ratio_) {
+            return segment.first;
+        }
+    }
+    return 0;
+}
+
+void PriorityFS::Impl::RecoverSegments(
+        const std::map<unsigned long long, unsigned long long>& sizes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!fs::is_directory(segment_path_)) {
+        return;
+    }
+
+    fs::directory_iterator begin(segment_path_), end;
+    for (auto entry = begin; entry != end; ++entry) {
+        auto name = entry->path().filename().string();
+        char* name_end = nullptr;
+        auto segment = std::strtoull(name.data(), &name_end, 16);
+        if (segment == 0 || name.size() != 16 || *name_end != '\0') {
+            continue;
+        }
+
+        last_segment_ = std::max(last_segment_, segment);
+        auto find = sizes.find(segment);
+        boost::system::error_code error;
+        if (find == sizes.end() || find->second == 0) {
+            fs::remove(entry->path(), error);
+            continue;
+        }
+        auto size = fs::file_size(entry->path(), error);
+        segments_[segment] = Segment{error ? find->second : size, find->second};
+    }
+}
+
+void PriorityFS::Impl::RecoverFiles(const unsigned long long& max_id) {
+    std::vector<fs::path> files;
+    fs::recursive_directory_iterator begin(buffer_path_), end;
+    for (auto entry = begin; entry != end; ++entry) {
+        if (entry->path() == segment_path_) {
+            entry.no_push();
+            continue;
+        }
+        auto name = entry->path().filename().string();
+        char* name_end = nullptr;
+        auto id = std::strtoull(name.data(), &name_end, 16);
+        if (name.size() == 16 && *name_end == '\0' && id > max_id &&
+                !fs::is_directory(entry->path())) {
+            files.push_back(entry->path());
+        }
+    }
+
+    for (auto& file_path : files) {
+        boost::system::error_code error;
+        fs::remove(file_path, error);
+    }
+}
+
+unsigned long long PriorityFS::Impl::GetCorruptRecords() {
+    return corrupt_records_;
+}
+
+bool PriorityFS::Impl::release_(std::vector<PriorityRecord>& records, const bool& defer) {
+    std::vector<PriorityIORequest> requests;
+    std::vector<size_t> indexes;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < records.size(); ++i) {
+            auto& record = records[i];
+            record.done = false;
+            if (record.location.segment == 0) {
+                requests.emplace_back(PriorityIORequest::Operation::UNLINK,
+                                      get_file_path_(GetFileName(record.id)).string());
+                indexes.push_back(i);
+                continue;
+            }
+
+            auto find = segments_.find(record.location.segment);
+            if (find == segments_.end()) {
+                continue;
+            }
+            auto& segment = find->second;
+            segment.live -= std::min(segment.live, record.location.length);
+            record.done = true;
+            if (segment.live == 0 && record.location.segment != active_segment_) {
+                segments_.erase(find);
+                requests.emplace_back(PriorityIORequest::Operation::UNLINK,
+                                      get_segment_path_(record.location.segment).string());
+                indexes.push_back(i);
+            }
+        }
+    }
+
+    if (defer) {
+        // Neither segment names nor the ids of discarded records are handed out again while this
+        // instance lives. A later one may reuse them, but only after replaying the log.
+        std::lock_guard<std::mutex> lock(unlink_mutex_);
+        for (size_t k = 0; k < requests.size(); ++k) {
+            auto& record = records[indexes[k]];
+            auto kind = record.location.segment == 0 ? "f " : "s ";
+            auto name = GetFileName(record.location.segment == 0 ? record.id :
+                                                                    record.location.segment);
+            unlinks_.push_back(requests[k].path);
+            unlink_log_lines_ += kind + name + "\n";
+            record.done = true;
+        }
+        if (unlinks_.size() >= DEFERRED_UNLINK_BATCH) {
+            unlink_condition_.notify_one();
+        }
+        requests.clear();
+    }
+
+    // The unlinks are made with the lock released, segments that are gone aren't used anymore
+    io_.Submit(requests);
+    for (size_t k = 0; k < requests.size(); ++k) {
+        records[indexes[k]].done = requests[k].result == 0;
+    }
+
+    auto released = true;
+    for (auto& record : records) {
+        released = released && record.done;
+    }
+    return released;
+}
+
+fs::path PriorityFS::Impl::get_file_path_(const std::string& file) {
+    // Only the names of messages are spread over subdirectories, the index stays at the top
+    if (directory_levels_ == 0 || file.size() != 16 ||
+            file.find_first_not_of("0123456789abcdef") != std::string::npos) {
+        return buffer_path_ / fs::path{file};
+    }
+
+    auto file_path = buffer_path_;
+    for (int level = 0; level < directory_levels_; ++level) {
+        file_path /= fs::path{file.substr(14 - 2 * level, 2)};
+    }
+    return file_path / fs::path{file};
+}
+
+bool PriorityFS::Impl::create_parent_(const fs::path& file_path) {
+    auto parent_path = file_path.parent_path();
+    if (parent_path == buffer_path_) {
+        return true;
+    }
+
+    // Every subdirectory is only looked for once
+    std::lock_guard<std::mutex> lock(directory_mutex_);
+    if (directories_.count(parent_path.string())) {
+        return true;
+    }
+    boost::system::error_code error;
+    fs::create_directories(parent_path, error);
+    if (error) {
+        return false;
+    }
+    directories_.insert(parent_path.string());
+    return true;
+}
+
+int PriorityFS::Impl::read_layout_() {
+    // A buffer without a record of its layout predates subdirectories, and is flat
+    std::ifstream stream{layout_path_.native()};
+    int levels = 0;
+    if (!(stream >> levels)) {
+        return 0;
+    }
+    return levels;
+}
+
+void PriorityFS::Impl::migrate_layout_() {
+    // Collects everything first, since moving files around would upset the iteration
+    std::vector<fs::path> files;
+    std::vector<fs::path> directories;
+    fs::recursive_directory_iterator begin(buffer_path_), end;
+    for (auto entry = begin; entry != end; ++entry) {
+        if (entry->path() == segment_path_) {
+            entry.no_push();
+        } else if (fs::is_directory(entry->path())) {
+            directories.push_back(entry->path());
+        } else {
+            files.push_back(entry->path());
+        }
+    }
+
+    for (auto& file_path : files) {
+        auto new_file_path = get_file_path_(file_path.filename().string());
+        if (new_file_path != file_path && create_parent_(new_file_path)) {
+            boost::system::error_code error;
+            fs::rename(file_path, new_file_path, error);
+        }
+    }
+
+    // Subdirectories of the old layout that are left empty, deepest first
+    for (auto directory = directories.rbegin(); directory != directories.rend(); ++directory) {
+        boost::system::error_code error;
+        if (directory->filename().string().size() == 2 && fs::is_empty(*directory, error)) {
+            fs::remove(*directory, error);
+            directories_.erase(directory->string());
+        }
+    }
+
+    // Only written once every file has moved, so an interrupted migration starts over
+    boost::system::error_code error;
+    if (directory_levels_ == 0) {
+        fs::remove(layout_path_, error);
+    } else {
+        std::ofstream stream{layout_path_.native(), std::ios::out | std::ios::trunc};
+        stream << directory_levels_ << "\n";
+    }
+}
+
+// Appends the unlinks that were deferred since the last call to the log, before the index can
+// forget about the records they belonged to, and wakes the background thread up
+void PriorityFS::Impl::log_unlinks_() {
+    std::lock_guard<std::mutex> lock(unlink_mutex_);
+    if (unlink_log_lines_.empty()) {
+        return;
+    }
+
+    if (unlink_log_fd_ < 0) {
+        unlink_log_fd_ = open(unlink_log_path_.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    }
+    size_t written = 0;
+    while (unlink_log_fd_ >= 0 && written < unlink_log_lines_.size()) {
+        auto result = write(unlink_log_fd_, unlink_log_lines_.data() + written,
+                            unlink_log_lines_.size() - written);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            break;
+        }
+        written += result;
+    }
+    unlink_log_lines_.clear();
+    unlink_condition_.notify_one();
+}
+
+void PriorityFS::Impl::unlink_loop_() {
+    std::unique_lock<std::mutex> lock(unlink_mutex_);
+    while (true) {
+        unlink_condition_.wait(lock, [this] { return stopping_unlinker_ || !unlinks_.empty(); });
+        if (unlinks_.empty()) {
+            break;
+        }
+
+        std::vector<PriorityIORequest> requests;
+        for (auto& path : unlinks_) {
+            requests.emplace_back(PriorityIORequest::Operation::UNLINK, path);
+        }
+        unlinks_.clear();
+        lock.unlock();
+        io_.Submit(requests);
+        lock.lock();
+
+        // Every line in the log has been taken care of once nothing is waiting anymore
+        if (unlinks_.empty() && unlink_log_lines_.empty() && unlink_log_fd_ >= 0) {
+            if (ftruncate(unlink_log_fd_, 0) != 0) {
+                close(unlink_log_fd_);
+                unlink_log_fd_ = -1;
+            }
+        }
+    }
+
+    // Whatever was discarded right before stopping never made it to the log
+    unlink_log_lines_.clear();
+    if (unlink_log_fd_ >= 0) {
+        close(unlink_log_fd_);
+        unlink_log_fd_ = -1;
+    }
+    boost::system::error_code error;
+    fs::remove(unlink_log_path_, error);
+}
+
+// Finishes the unlinks that a previous run deferred but did not get to. The ids and segments they
+// name may be handed out again after a restart, so this runs before anything is written.
+void PriorityFS::Impl::recover_unlinks_() {
+    std::ifstream stream{unlink_log_path_.native()};
+    std::string kind, name;
+    while (stream >> kind >> name) {
+        if (name.size() != 16 || name.find_first_not_of("0123456789abcdef") != std::string::npos) {
+            continue;
+        }
+        auto path = kind == "s" ? segment_path_ / fs::path{name} : get_file_path_(name);
+        unlink(path.c_str());
+    }
+    stream.close();
+    boost::system::error_code error;
+    fs::remove(unlink_log_path_, error);
+}
+
+void PriorityFS::Impl::put_uint32_(char* bytes, const uint32_t& value) {
+    for (int i = 0; i < 4; ++i) {
+        bytes[i] = static_cast<char>(value >> (8 * i));
+    }
+}
+
+uint32_t PriorityFS::Impl::get_uint32_(const char* bytes) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= static_cast<uint32_t>(static_cast<unsigned char>(bytes[i])) << (8 * i);
+    }
+    return value;
+}
+
+// Fills in the header of the record of data, and returns what follows the header on disk: data
+// itself, or data compressed into encoded where that makes it smaller
+const std::string& PriorityFS::Impl::frame_(const std::string& data, std::string& encoded,
+                                            char* header) {
+    auto payload = &data;
+    auto format = RECORD_RAW;
+#ifdef PRIORITYBUFFER_LZ4
+    if (compression_ == PriorityFSOptions::Compression::LZ4 &&
+            data.size() >= compression_threshold_ && data.size() <= LZ4_MAX_INPUT_SIZE) {
+        encoded.resize(4 + LZ4_compressBound(data.size()));
+        put_uint32_(&encoded[0], data.size());
+        auto size = LZ4_compress_default(data.data(), &encoded[4], data.size(),
+                                         encoded.size() - 4);
+        if (size > 0 && 4 + static_cast<size_t>(size) < data.size()) {
+            encoded.resize(4 + size);
+            payload = &encoded;
+            format = RECORD_LZ4;
+        }
+    }
+#endif
+    memcpy(header, RECORD_MAGIC, 3);
+    header[3] = static_cast<char>(format);
+    put_uint32_(header + 4, payload->size());
+    put_uint32_(header + 8, PriorityCRC32C(payload->data(), payload->size()));
+    return *payload;
+}
+
+// Finds the message in a record read back from disk, which is decompressed into decoded if it has
+// to be. A record without a header was written before there were any, and is only trusted if it
+// is as long as the index says the message is.
+bool PriorityFS::Impl::unframe_(const char* record, const size_t& size,
+                                const PriorityLocation& location, const char*& message,
+                                size_t& length, std::string& decoded) {
+    if (size >= RECORD_HEADER_SIZE && memcmp(record, RECORD_MAGIC, 3) == 0) {
+        auto format = record[3];
+        auto payload = record + RECORD_HEADER_SIZE;
+        length = get_uint32_(record + 4);
+        if (length == size - RECORD_HEADER_SIZE &&
+                get_uint32_(record + 8) == PriorityCRC32C(payload, length)) {
+            if (format == RECORD_RAW) {
+                message = payload;
+                return true;
+            }
+#ifdef PRIORITYBUFFER_LZ4
+            if (format == RECORD_LZ4 && length >= 4) {
+                decoded.resize(get_uint32_(payload));
+                auto size = LZ4_decompress_safe(payload + 4, &decoded[0], length - 4,
+                                                decoded.size());
+                if (size >= 0 && static_cast<size_t>(size) == decoded.size()) {
+                    message = decoded.data();
+                    length = decoded.size();
+                    return true;
+                }
+            }
+#endif
+        }
+    } else if (location.segment == 0 && size == location.length &&
+               (size == 0 || record[0] != RECORD_MAGIC[0])) {
+        message = record;
+        length = size;
+        return true;
     }
+    ++corrupt_records_;
     return false;
 }
 
+// Appends the writes of the header and the payload of the record at index to requests
+void PriorityFS::Impl::add_writes_(const std::string& payload, char* header, const int& fd,
+                                   const off_t& offset, const size_t& index,
+                                   std::vector<PriorityIORequest>& requests,
+                                   std::vector<size_t>& indexes) {
+    requests.emplace_back(PriorityIORequest::Operation::WRITE, fd, header, RECORD_HEADER_SIZE,
+                          offset);
+    indexes.push_back(index);
+    if (!payload.empty()) {
+        // Writes only ever read from their data
+        requests.emplace_back(PriorityIORequest::Operation::WRITE, fd,
+                              const_cast<char*>(payload.data()), payload.size(),
+                              offset + RECORD_HEADER_SIZE);
+        indexes.push_back(index);
+    }
+}
+
+// The indexes of the records that every write went through for, in order
+std::vector<size_t> PriorityFS::Impl::get_written_(const std::vector<PriorityIORequest>& requests,
+                                                   const std::vector<size_t>& indexes) {
+    std::vector<size_t> written;
+    for (size_t k = 0; k < requests.size(); ) {
+        auto index = indexes[k];
+        auto complete = true;
+        for (; k < requests.size() && indexes[k] == index; ++k) {
+            complete = complete &&
+                       requests[k].result == static_cast<long long>(requests[k].size);
+        }
+        if (complete) {
+            written.push_back(index);
+        }
+    }
+    return written;
+}
+
+bool PriorityFS::Impl::write_file_(const unsigned long long& id, const char* header,
+                                   const std::string& payload) {
+    // Creating the file exclusively stands in for checking that it doesn't exist yet
+    auto file_path = get_file_path_(GetFileName(id));
+    if (!create_parent_(file_path)) {
+        return false;
+    }
+    auto fd = open(file_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd >= 0) {
+        if (write_at_(fd, header, RECORD_HEADER_SIZE, 0) == RECORD_HEADER_SIZE &&
+                write_at_(fd, payload.data(), payload.size(), RECORD_HEADER_SIZE) ==
+                    payload.size() &&
+                commit_files_(std::vector<int>{fd},
+                              std::vector<fs::path>{file_path.parent_path()})[0]) {
+            return true;
+        }
+        close(fd);
+    }
+    // Whatever is left under the name is not this message, and nothing else refers to it
+    unlink(file_path.c_str());
+    return false;
+}
+
+bool PriorityFS::Impl::write_files_(std::vector<PriorityRecord>& records) {
+    std::vector<fs::path> paths;
+    std::vector<int> fds;
+    std::vector<char> headers(records.size() * RECORD_HEADER_SIZE);
+    std::vector<std::string> encoded(records.size());
+    std::vector<PriorityIORequest> requests;
+    std::vector<size_t> request_indexes;
+    for (size_t i = 0; i < records.size(); ++i) {
+        auto& record = records[i];
+        auto header = &headers[i * RECORD_HEADER_SIZE];
+        auto& payload = frame_(record.data, encoded[i], header);
+        record.location = PriorityLocation{};
+        record.location.length = RECORD_HEADER_SIZE + payload.size();
+        record.done = false;
+        paths.push_back(get_file_path_(GetFileName(record.id)));
+        auto fd = -1;
+        if (create_parent_(paths.back())) {
+            fd = open(paths.back().c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        }
+        fds.push_back(fd);
+        if (fd >= 0) {
+            add_writes_(payload, header, fd, 0, i, requests, request_indexes);
+        }
+    }
+    io_.Submit(requests);
+
+    std::vector<int> written_fds;
+    std::vector<fs::path> directories;
+    std::vector<size_t> indexes;
+    for (auto i : get_written_(requests, request_indexes)) {
+        written_fds.push_back(fds[i]);
+        directories.push_back(paths[i].parent_path());
+        indexes.push_back(i);
+        fds[i] = -1;
+    }
+    for (auto fd : fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    auto committed = commit_files_(written_fds, directories);
+    for (size_t k = 0; k < indexes.size(); ++k) {
+        records[indexes[k]].done = committed[k];
+        if (!committed[k]) {
+            close(written_fds[k]);
+        }
+    }
+
+    auto written = true;
+    for (size_t i = 0; i < records.size(); ++i) {
+        if (!records[i].done) {
+            // Whatever is left under the name is not this message, and nothing else refers to it
+            unlink(paths[i].c_str());
+            written = false;
+        }
+    }
+    return written;
+}
+
+bool PriorityFS::Impl::write_segments_(std::vector<PriorityRecord>& records) {
+    // Compression is left out of the lock
+    std::vector<char> headers(records.size() * RECORD_HEADER_SIZE);
+    std::vector<std::string> encoded(records.size());
+    std::vector<const std::string*> payloads;
+    for (size_t i = 0; i < records.size(); ++i) {
+        payloads.push_back(&frame_(records[i].data, encoded[i], &headers[i * RECORD_HEADER_SIZE]));
+    }
+
+    // Records are laid out one after the other, and written together for as long as they fit in
+    // the active segment
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<PriorityIORequest> requests;
+    std::vector<size_t> indexes;
+    auto written = true;
+    for (size_t i = 0; i < records.size(); ++i) {
+        auto& record = records[i];
+        auto length = RECORD_HEADER_SIZE + payloads[i]->size();
+        record.done = false;
+        if (active_fd_ < 0 ||
+                (segments_[active_segment_].size > 0 &&
+                 segments_[active_segment_].size + length > segment_size_)) {
+            written = submit_segment_writes_(records, requests, indexes) && written;
+            if (!open_segment_()) {
+                return false;
+            }
+        }
+
+        auto& segment = segments_[active_segment_];
+        record.location.segment = active_segment_;
+        record.location.offset = segment.size;
+        record.location.length = length;
+        segment.size += length;
+        add_writes_(*payloads[i], &headers[i * RECORD_HEADER_SIZE], active_fd_,
+                    record.location.offset, i, requests, indexes);
+    }
+    return submit_segment_writes_(records, requests, indexes) && written;
+}
+
+// Called with the lock held, with the writes of records to the active segment
+bool PriorityFS::Impl::submit_segment_writes_(std::vector<PriorityRecord>& records,
+                                              std::vector<PriorityIORequest>& requests,
+                                              std::vector<size_t>& indexes) {
+    io_.Submit(requests);
+    auto written = get_written_(requests, indexes);
+    auto submitted = indexes.empty() ? 0 : 1;
+    for (size_t k = 1; k < indexes.size(); ++k) {
+        submitted += indexes[k] != indexes[k - 1];
+    }
+
+    // Records that did not make it are never referenced, and go when the segment does
+    auto committed = written.empty() || commit_segment_(written.size());
+    auto& segment = segments_[active_segment_];
+    for (auto i : written) {
+        records[i].done = committed;
+        if (committed) {
+            segment.live += records[i].location.length;
+        }
+    }
+
+    auto all = static_cast<int>(written.size()) == submitted && committed;
+    requests.clear();
+    indexes.clear();
+    return all;
+}
+
+bool PriorityFS::Impl::map_(const int& fd, const off_t& offset, const size_t& size,
+                            const std::function<bool(const char*, const size_t&)>& parse) {
+    if (size == 0) {
+        return parse(nullptr, 0);
+    }
+
+    // Mappings have to start on a page boundary
+    static const auto page_size = static_cast<off_t>(sysconf(_SC_PAGESIZE));
+    auto start = offset - offset % page_size;
+    auto length = static_cast<size_t>(offset - start) + size;
+    auto mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, start);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    // The whole record is about to be read once, front to back
+    madvise(mapping, length, MADV_WILLNEED);
+    madvise(mapping, length, MADV_SEQUENTIAL);
+    auto parsed = parse(static_cast<const char*>(mapping) + (offset - start), size);
+    munmap(mapping, length);
+    return parsed;
+}
+
+// Takes over the descriptors of files that were just written, and makes them as durable as asked.
+// Those that could not be are left open.
+std::vector<bool> PriorityFS::Impl::commit_files_(const std::vector<int>& fds,
+                                                  const std::vector<fs::path>& directories) {
+    std::vector<bool> committed(fds.size(), true);
+    if (durability_ == PriorityFSOptions::Durability::MESSAGE) {
+        std::vector<PriorityIORequest> requests;
+        for (auto fd : fds) {
+            requests.emplace_back(PriorityIORequest::Operation::SYNC, fd, nullptr, 0, 0);
+        }
+        io_.Submit(requests);
+
+        std::set<std::string> synced_directories;
+        for (size_t i = 0; i < fds.size(); ++i) {
+            committed[i] = requests[i].result == 0;
+            if (committed[i] && sync_directories_ &&
+                    !synced_directories.count(directories[i].string())) {
+                committed[i] = sync_directory_(directories[i]);
+                if (committed[i]) {
+                    synced_directories.insert(directories[i].string());
+                }
+            }
+        }
+    } else if (durability_ == PriorityFSOptions::Durability::BATCH) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        unsynced_fds_.insert(unsynced_fds_.end(), fds.begin(), fds.end());
+        if (sync_directories_) {
+            for (auto& directory : directories) {
+                unsynced_directories_.insert(directory.string());
+            }
+        }
+        add_unsynced_(fds.size());
+        return committed;
+    }
+
+    for (size_t i = 0; i < fds.size(); ++i) {
+        if (committed[i]) {
+            close(fds[i]);
+        }
+    }
+    return committed;
+}
+
+// Called with the lock held, after records were appended to the active segment
+bool PriorityFS::Impl::commit_segment_(const int& records) {
+    if (durability_ == PriorityFSOptions::Durability::MESSAGE) {
+        return sync_(active_fd_);
+    } else if (durability_ == PriorityFSOptions::Durability::BATCH) {
+        unsynced_segment_ = true;
+        add_unsynced_(records);
+    }
+    return true;
+}
+
+void PriorityFS::Impl::add_unsynced_(const int& records) {
+    if (unsynced_records_ == 0) {
+        first_unsynced_ = std::chrono::steady_clock::now();
+    }
+    unsynced_records_ += records;
+    if (unsynced_records_ >= batch_messages_ && !sync_unsynced_()) {
+        sync_failed_ = true;
+    }
+}
+
+bool PriorityFS::Impl::sync_unsynced_() {
+    // The files of a batch are synced together
+    std::vector<PriorityIORequest> requests;
+    for (auto fd : unsynced_fds_) {
+        requests.emplace_back(PriorityIORequest::Operation::SYNC, fd, nullptr, 0, 0);
+    }
+    if (unsynced_segment_ && active_fd_ >= 0) {
+        requests.emplace_back(PriorityIORequest::Operation::SYNC, active_fd_, nullptr, 0, 0);
+    }
+    io_.Submit(requests);
+
+    auto synced = true;
+    for (auto& request : requests) {
+        synced = request.result == 0 && synced;
+    }
+    for (auto fd : unsynced_fds_) {
+        close(fd);
+    }
+    for (auto& directory : unsynced_directories_) {
+        synced = sync_directory_(fs::path{directory}) && synced;
+    }
+
+    unsynced_fds_.clear();
+    unsynced_directories_.clear();
+    unsynced_segment_ = false;
+    unsynced_records_ = 0;
+    return synced;
+}
+
+bool PriorityFS::Impl::sync_(const int& fd) {
+#ifdef __APPLE__
+    return fsync(fd) == 0;
+#else
+    return fdatasync(fd) == 0;
+#endif
+}
+
+bool PriorityFS::Impl::sync_directory_(const fs::path& directory) {
+    auto fd = open(directory.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    auto synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+}
+
+size_t PriorityFS::Impl::write_at_(const int& fd, const char* data, const size_t& size,
+                                   const off_t& offset) {
+    size_t written = 0;
+    while (written < size) {
+        auto result = pwrite(fd, data + written, size - written, offset + written);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            break;
+        }
+        written += result;
+    }
+    return written;
+}
+
+bool PriorityFS::Impl::open_segment_() {
+    close_segment_();
+    fs::create_directory(segment_path_);
+    // Segments left behind by an earlier run that RecoverSegments() was not told about are kept
+    auto segment = last_segment_;
+    int fd;
+    do {
+        fd = open(get_segment_path_(++segment).c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    } while (fd < 0 && errno == EEXIST);
+    if (fd < 0) {
+        return false;
+    }
+
+    last_segment_ = segment;
+    active_segment_ = segment;
+    active_fd_ = fd;
+    segments_[segment] = Segment{0, 0};
+    if (sync_directories_) {
+        if (durability_ == PriorityFSOptions::Durability::MESSAGE) {
+            return sync_directory_(segment_path_);
+        } else if (durability_ == PriorityFSOptions::Durability::BATCH) {
+            unsynced_directories_.insert(segment_path_.string());
+        }
+    }
+    return true;
+}
+
+void PriorityFS::Impl::close_segment_() {
+    if (active_fd_ < 0) {
+        return;
+    }
+
+    // Records still waiting for a batch go out before the segment is closed
+    if (unsynced_segment_) {
+        sync_(active_fd_);
+        unsynced_segment_ = false;
+    }
+    close(active_fd_);
+    active_fd_ = -1;
+    auto find = segments_.find(active_segment_);
+    if (find != segments_.end() && find->second.live == 0) {
+        segments_.erase(find);
+        boost::system::error_code error;
+        fs::remove(get_segment_path_(active_segment_), error);
+    }
+    active_segment_ = 0;
+}
+
+fs::path PriorityFS::Impl::get_segment_path_(const unsigned long long& segment) {
+    return segment_path_ / fs::path{GetFileName(segment)};
+}
+
 
 // Bridge
 
-PriorityFS::PriorityFS(const std::string& buffer_directory, const std::string& buffer_parent)
-        : pimpl_{ new Impl{buffer_directory, buffer_parent} } {}
+PriorityFS::PriorityFS(const std::string& buffer_directory, const std::string& buffer_parent,
+                       const PriorityFSOptions& options)
+        : pimpl_{ new Impl{buffer_directory, buffer_parent, options} } {}
 PriorityFS::~PriorityFS() {}
 
+std::string PriorityFS::GetFileName(const unsigned long long& id) {
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", id);
+    return std::string{name, 16};
+}
+
 std::string PriorityFS::GetFilePath(const std::string& file) {
     return pimpl_->GetFilePath(file);
 }
@@ -94,3 +1285,76 @@ bool PriorityFS::GetOutput(const std::string& file, std::ofstream& stream) {
 bool PriorityFS::Delete(const std::string& file) {
     return pimpl_->Delete(file);
 }
+
+bool PriorityFS::Rename(const std::string& file, const std::string& new_file) {
+    return pimpl_->Rename(file, new_file);
+}
+
+bool PriorityFS::Write(const unsigned long long& id, const std::string& data,
+                       PriorityLocation& location) {
+    return pimpl_->Write(id, data, location);
+}
+
+bool PriorityFS::Read(const unsigned long long& id, const PriorityLocation& location,
+                      std::string& data) {
+    return pimpl_->Read(id, location, data);
+}
+
+bool PriorityFS::Read(const unsigned long long& id, const PriorityLocation& location,
+                      const std::function<bool(const char*, const size_t&)>& parse) {
+    return pimpl_->Read(id, location, parse);
+}
+
+bool PriorityFS::Release(const unsigned long long& id, const PriorityLocation& location) {
+    return pimpl_->Release(id, location);
+}
+
+bool PriorityFS::Write(std::vector<PriorityRecord>& records) {
+    return pimpl_->Write(records);
+}
+
+bool PriorityFS::Read(std::vector<PriorityRecord>& records) {
+    return pimpl_->Read(records);
+}
+
+bool PriorityFS::Release(std::vector<PriorityRecord>& records) {
+    return pimpl_->Release(records);
+}
+
+bool PriorityFS::Discard(const unsigned long long& id, const PriorityLocation& location) {
+    std::vector<PriorityRecord> records{PriorityRecord{id}};
+    records[0].location = location;
+    return pimpl_->Discard(records);
+}
+
+bool PriorityFS::Discard(std::vector<PriorityRecord>& records) {
+    return pimpl_->Discard(records);
+}
+
+bool PriorityFS::Flush() {
+    return pimpl_->Flush();
+}
+
+bool PriorityFS::Sync() {
+    return pimpl_->Sync();
+}
+
+bool PriorityFS::Synced() {
+    return pimpl_->Synced();
+}
+
+unsigned long long PriorityFS::GetSparseSegment() {
+    return pimpl_->GetSparseSegment();
+}
+
+void PriorityFS::RecoverSegments(const std::map<unsigned long long, unsigned long long>& sizes) {
+    pimpl_->RecoverSegments(sizes);
+}
+
+void PriorityFS::RecoverFiles(const unsigned long long& max_id) {
+    pimpl_->RecoverFiles(max_id);
+}
+
+unsigned long long PriorityFS::GetCorruptRecords() {
+    return pimpl_->GetCorruptRecords();
+}
@@ -2,19 +2,137 @@
 #define PRIORITY_FS_H
 
 #include <fstream>
+#include <functional>
+#include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 
+struct PriorityFSOptions {
+    enum class Durability { NONE, MESSAGE, BATCH };
+    enum class Compression { NONE, LZ4 };
+
+    PriorityFSOptions()
+            : segment_size{0}, segment_compact_ratio{0.25}, directory_levels{0},
+              mmap_threshold{0}, durability{Durability::NONE}, batch_messages{100},
+              batch_ms{100}, sync_directories{false}, io_depth{0}, deferred_unlink{false},
+              compression{Compression::NONE}, compression_threshold{256} {}
+
+    // Bytes to append to one segment file before the next one is started. 0 writes every message
+    // to a file of its own instead.
+    unsigned long long segment_size;
+    // A segment that is no longer being appended to is rewritten once less than this fraction of
+    // it still holds messages
+    double segment_compact_ratio;
+    // Levels of up to 256 subdirectories, named after the lowest bytes of the id, that the files
+    // of messages are spread over. 0 keeps them all in one directory. Files in another layout are
+    // moved over at startup.
+    int directory_levels;
+    // Records of at least this many bytes are parsed straight from a memory mapping of their file
+    // rather than read into a buffer first. 0 never maps them.
+    unsigned long long mmap_threshold;
+    // NONE leaves messages on disk to the page cache. MESSAGE syncs each one before Write()
+    // returns. BATCH syncs them together once batch_messages, of at most 256, are waiting or the
+    // first of them has waited batch_ms, so that a power loss takes at most that many with it.
+    Durability durability;
+    int batch_messages;
+    unsigned long batch_ms;
+    // Also sync the directories that files and segments are created in, so that their names
+    // survive a power loss along with their contents. Only takes effect with MESSAGE or BATCH.
+    bool sync_directories;
+    // Reads, writes, syncs and unlinks of a batch of records are kept this many at a time in
+    // flight, through io_uring where the kernel allows it and on as many threads otherwise. 0 makes
+    // them one after the other.
+    int io_depth;
+    // Files and segments that Discard() lets go of are unlinked in batches by a background thread
+    // instead of right away. Unlinks still pending are logged at Flush() and finished at startup.
+    bool deferred_unlink;
+    // LZ4 compresses messages of at least compression_threshold bytes before they are written,
+    // unless that doesn't make them any smaller. The length of a record, and so the disk size of
+    // the index, is what it takes on disk. Compressed records are read whatever this is set to.
+    // Without lz4 at build time, LZ4 throws and compressed records can't be read back.
+    Compression compression;
+    unsigned long long compression_threshold;
+};
+
+// Where the bytes of a message on disk are. A message in a file of its own has a segment of 0 and
+// is found by its id instead.
+struct PriorityLocation {
+    PriorityLocation() : segment{0}, offset{0}, length{0} {}
+
+    unsigned long long segment;
+    unsigned long long offset;
+    unsigned long long length;
+};
+
+// A message moving to or from disk as part of a batch. done says whether it made it.
+struct PriorityRecord {
+    PriorityRecord(const unsigned long long& id) : id{id}, done{false} {}
+
+    unsigned long long id;
+    PriorityLocation location;
+    std::string data;
+    bool done;
+};
+
 class PriorityFS {
   public:
-    PriorityFS(const std::string& buffer_directory, const std::string& buffer_parent=std::string{});
+    PriorityFS(const std::string& buffer_directory, const std::string& buffer_parent=std::string{},
+               const PriorityFSOptions& options=PriorityFSOptions{});
     ~PriorityFS();
 
+    // Messages are stored under their id, as 16 lowercase hex digits
+    static std::string GetFileName(const unsigned long long& id);
+
     std::string GetFilePath(const std::string& file);
     bool GetInput(const std::string& file, std::ifstream& stream);
     bool GetOutput(const std::string& file, std::ofstream& stream);
     bool Delete(const std::string& file);
+    bool Rename(const std::string& file, const std::string& new_file);
+
+    // Stores the serialized message with the given id and reports where it went. Each record is
+    // read back with Read() and handed back with Release() exactly once, which deletes its file or
+    // the segment it was the last needed record of.
+    bool Write(const unsigned long long& id, const std::string& data, PriorityLocation& location);
+    bool Read(const unsigned long long& id, const PriorityLocation& location, std::string& data);
+    // Hands the record to parse, without copying it if it is mapped. Returns false if the record
+    // could not be read or parse returned false.
+    bool Read(const unsigned long long& id, const PriorityLocation& location,
+              const std::function<bool(const char*, const size_t&)>& parse);
+    bool Release(const unsigned long long& id, const PriorityLocation& location);
+    // The same for many records at once, whose I/O overlaps up to PriorityFSOptions::io_depth.
+    // Write() takes the data of each record and fills in its location, Read() takes the location
+    // and fills in the data. Each returns false if any record was not done.
+    bool Write(std::vector<PriorityRecord>& records);
+    bool Read(std::vector<PriorityRecord>& records);
+    bool Release(std::vector<PriorityRecord>& records);
+    // Release() for records that are never written again under the same name, so that unlinking
+    // their files can be deferred. A deferred record is done once its unlink is queued.
+    bool Discard(const unsigned long long& id, const PriorityLocation& location);
+    bool Discard(std::vector<PriorityRecord>& records);
+    // Flush() syncs the records written under BATCH durability once they are due, and Sync() syncs
+    // them right away. Both return false if a sync failed, including one that a Write() since the
+    // last of them ran into. Both also log the deferred unlinks that are still pending, and hand
+    // them to the background thread.
+    bool Flush();
+    bool Sync();
+    // Whether every record written so far is as durable as it is going to get, which only ever
+    // stops being the case for BATCH durability until the batch is synced
+    bool Synced();
+
+    // A segment that is mostly free space, whose records should be written again so that it can
+    // be deleted. 0 if there is none.
+    unsigned long long GetSparseSegment();
+    // Takes the bytes still needed in each segment from the index at startup, and deletes the
+    // segments that it no longer refers to
+    void RecoverSegments(const std::map<unsigned long long, unsigned long long>& sizes);
+    // Deletes the files of messages with ids past max_id, the largest the index knows of at
+    // startup. Those are left over from a crash that took their ids with it, which are about to
+    // be handed out again.
+    void RecoverFiles(const unsigned long long& max_id);
+    // Records that were read back but failed their checksum, or were otherwise not what was written
+    unsigned long long GetCorruptRecords();
 
   private:
     class Impl;
@@ -0,0 +1,60 @@
+#ifndef PRIORITY_INDEX_H
+#define PRIORITY_INDEX_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "priorityfs.h"
+
+
+// Everything PriorityBuffer needs to know about the messages it holds: their priorities, whether
+// each of them is in memory or on disk, and how much of the disk budget they use. PriorityDB
+// forwards to one of the implementations of this interface, see PriorityDBOptions::Backend.
+//
+// Messages are identified by nonzero ids, which PriorityBuffer hands out in increasing order. An
+// id of 0 means that there is no such message.
+class PriorityIndex {
+  public:
+    virtual ~PriorityIndex() {}
+
+    virtual void Begin() = 0;
+    virtual void Commit() = 0;
+    virtual void Rollback() = 0;
+    virtual void Flush() = 0;
+
+    virtual void Insert(const unsigned long long& priority, const unsigned long long& id,
+                        const unsigned long long& size, const bool& on_disk) = 0;
+    virtual void Delete(const unsigned long long& id) = 0;
+    virtual void Update(const unsigned long long& id, const bool& on_disk) = 0;
+    // Moves a message to disk at the location PriorityFS wrote it to. Its size becomes the length
+    // it takes up there.
+    virtual void SetLocation(const unsigned long long& id, const PriorityLocation& location) = 0;
+    // false if the message is not on disk
+    virtual bool GetLocation(const unsigned long long& id, PriorityLocation& location) = 0;
+    virtual unsigned long long GetHighestId(bool& on_disk) = 0;
+    // false if there are no messages
+    virtual bool GetHighestPriority(unsigned long long& priority) = 0;
+    virtual unsigned long long GetLowestMemoryId() = 0;
+    virtual unsigned long long GetLowestDiskId() = 0;
+    // The priority of the message GetLowestDiskId() or GetLowestMemoryId() returns. false if
+    // there is none.
+    virtual bool GetLowestPriority(const bool& on_disk, unsigned long long& priority) = 0;
+    virtual unsigned long long GetHighestDiskId(const int& depth) = 0;
+    virtual unsigned long long GetMaxId() = 0;
+    virtual bool Full() = 0;
+    virtual int GetDiskLength() = 0;
+    virtual unsigned long long GetDiskSize() = 0;
+    // The messages stored in a segment, and the bytes of every segment that are still in use
+    virtual std::vector<unsigned long long> GetSegmentIds(const unsigned long long& segment) = 0;
+    virtual std::map<unsigned long long, unsigned long long> GetSegmentSizes() = 0;
+
+    // Indexes written before messages had numeric ids named their files after random hashes.
+    // Those files have to be renamed after the ids they were given, and then forgotten.
+    virtual std::map<unsigned long long, std::string> GetLegacyHashes() {
+        return std::map<unsigned long long, std::string>{};
+    }
+    virtual void DeleteLegacyHashes() {}
+};
+
+#endif
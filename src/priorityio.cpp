@@ -0,0 +1,384 @@
+#include "priorityio.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef PRIORITYBUFFER_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+
+// Runs every request in the calling thread, one after the other
+class PriorityIO::Engine {
+  public:
+    virtual ~Engine() {}
+
+    virtual void Run(std::vector<PriorityIORequest>& requests) {
+        for (auto& request : requests) {
+            run_(request);
+        }
+    }
+
+    virtual bool Uring() {
+        return false;
+    }
+
+  protected:
+    static void run_(PriorityIORequest& request) {
+        long long result = 0;
+        switch (request.operation) {
+            case PriorityIORequest::Operation::READ:
+                result = pread(request.fd, request.data, request.size, request.offset);
+                break;
+            case PriorityIORequest::Operation::WRITE:
+                result = pwrite(request.fd, request.data, request.size, request.offset);
+                break;
+            case PriorityIORequest::Operation::SYNC:
+#ifdef __APPLE__
+                result = fsync(request.fd);
+#else
+                result = fdatasync(request.fd);
+#endif
+                break;
+            case PriorityIORequest::Operation::UNLINK:
+                result = unlink(request.path.c_str());
+                break;
+        }
+        request.result = result < 0 ? -errno : result;
+    }
+};
+
+// Hands the requests to a pool of threads that each make one call at a time
+class PriorityIO::ThreadEngine : public PriorityIO::Engine {
+  public:
+    ThreadEngine(const int& threads) : stopping_{false} {
+        for (int i = 0; i < threads; ++i) {
+            threads_.emplace_back(&ThreadEngine::work_, this);
+        }
+    }
+
+    ~ThreadEngine() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        condition_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    void Run(std::vector<PriorityIORequest>& requests) override {
+        // Several callers may share the pool, and each only waits for its own requests
+        auto remaining = requests.size();
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (auto& request : requests) {
+            queue_.emplace_back(&request, &remaining);
+        }
+        condition_.notify_all();
+        done_condition_.wait(lock, [&remaining] { return remaining == 0; });
+    }
+
+  private:
+    void work_() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            condition_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                break;
+            }
+
+            auto work = queue_.front();
+            queue_.pop_front();
+            lock.unlock();
+            run_(*work.first);
+            lock.lock();
+            if (--*work.second == 0) {
+                done_condition_.notify_all();
+            }
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::condition_variable done_condition_;
+    std::deque<std::pair<PriorityIORequest*, size_t*>> queue_;
+    std::vector<std::thread> threads_;
+    bool stopping_;
+};
+
+#ifdef PRIORITYBUFFER_IO_URING
+
+// Talks to io_uring through its system calls directly, so that there is nothing to link against.
+// Requests are placed on the submission ring a ring's worth at a time, submitted with a single
+// call, and reaped from the completion ring as they finish.
+class PriorityIO::UringEngine : public PriorityIO::Engine {
+  public:
+    UringEngine(const int& entries)
+            : fd_{-1}, sq_ring_{MAP_FAILED}, cq_ring_{MAP_FAILED}, sqes_{MAP_FAILED} {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd_ = syscall(__NR_io_uring_setup, entries, &params);
+        if (fd_ < 0) {
+            return;
+        }
+
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        }
+        sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            cq_ring_ = sq_ring_;
+        } else {
+            cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        }
+        sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd_, IORING_OFF_SQES);
+        if (sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+            unmap_();
+            return;
+        }
+
+        auto sq_ring = static_cast<char*>(sq_ring_);
+        auto cq_ring = static_cast<char*>(cq_ring_);
+        entries_ = params.sq_entries;
+        sq_tail_ = reinterpret_cast<unsigned*>(sq_ring + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq_ring + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq_ring + params.sq_off.array);
+        cq_head_ = reinterpret_cast<unsigned*>(cq_ring + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq_ring + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq_ring + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq_ring + params.cq_off.cqes);
+    }
+
+    ~UringEngine() {
+        unmap_();
+    }
+
+    // Whether the kernel let us set up a ring
+    bool Ready() {
+        return fd_ >= 0;
+    }
+
+    void Run(std::vector<PriorityIORequest>& requests) override {
+        // There is a single ring, so callers take turns
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t begin = 0; begin < requests.size(); begin += entries_) {
+            auto end = std::min(requests.size(), begin + entries_);
+            run_batch_(requests, begin, end);
+        }
+    }
+
+    bool Uring() override {
+        return true;
+    }
+
+  private:
+    void run_batch_(std::vector<PriorityIORequest>& requests, const size_t& begin,
+                    const size_t& end) {
+        auto count = static_cast<unsigned>(end - begin);
+        std::vector<struct iovec> iovecs(count);
+        auto tail = *sq_tail_;
+        for (unsigned i = 0; i < count; ++i) {
+            auto index = (tail + i) & sq_mask_;
+            auto& sqe = static_cast<struct io_uring_sqe*>(sqes_)[index];
+            prepare_(requests[begin + i], iovecs[i], sqe);
+            sqe.user_data = begin + i;
+            sq_array_[index] = index;
+        }
+        __atomic_store_n(sq_tail_, tail + count, __ATOMIC_RELEASE);
+
+        unsigned submitted = 0;
+        while (submitted < count) {
+            auto result = syscall(__NR_io_uring_enter, fd_, count - submitted, 0, 0, nullptr, 0);
+            if (result > 0) {
+                submitted += result;
+            } else if (result < 0 && errno == EINTR) {
+                continue;
+            } else {
+                // Whatever the kernel did not take is taken back, and made without the ring
+                __atomic_store_n(sq_tail_, tail + submitted, __ATOMIC_RELEASE);
+                for (auto i = begin + submitted; i < end; ++i) {
+                    run_(requests[i]);
+                }
+                break;
+            }
+        }
+
+        unsigned completed = 0;
+        while (completed < submitted) {
+            auto head = *cq_head_;
+            auto cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            if (head == cq_tail) {
+                syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                continue;
+            }
+            for (; head != cq_tail; ++head, ++completed) {
+                auto& cqe = cqes_[head & cq_mask_];
+                auto& request = requests[cqe.user_data];
+                request.result = cqe.res;
+                if (cqe.res == -EINVAL &&
+                        request.operation == PriorityIORequest::Operation::UNLINK) {
+                    // Kernels before 5.11 can't unlink through the ring
+                    run_(request);
+                }
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        }
+    }
+
+    static void prepare_(PriorityIORequest& request, struct iovec& iovec,
+                         struct io_uring_sqe& sqe) {
+        memset(&sqe, 0, sizeof(sqe));
+        switch (request.operation) {
+            case PriorityIORequest::Operation::READ:
+            case PriorityIORequest::Operation::WRITE:
+                iovec.iov_base = request.data;
+                iovec.iov_len = request.size;
+                sqe.opcode = request.operation == PriorityIORequest::Operation::READ ?
+                             IORING_OP_READV : IORING_OP_WRITEV;
+                sqe.fd = request.fd;
+                sqe.addr = reinterpret_cast<unsigned long long>(&iovec);
+                sqe.len = 1;
+                sqe.off = request.offset;
+                break;
+            case PriorityIORequest::Operation::SYNC:
+                sqe.opcode = IORING_OP_FSYNC;
+                sqe.fd = request.fd;
+                sqe.fsync_flags = IORING_FSYNC_DATASYNC;
+                break;
+            case PriorityIORequest::Operation::UNLINK:
+                sqe.opcode = IORING_OP_UNLINKAT;
+                sqe.fd = AT_FDCWD;
+                sqe.addr = reinterpret_cast<unsigned long long>(request.path.c_str());
+                break;
+        }
+    }
+
+    void unmap_() {
+        if (sqes_ != MAP_FAILED) {
+            munmap(sqes_, sqes_size_);
+        }
+        if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+            munmap(cq_ring_, cq_ring_size_);
+        }
+        if (sq_ring_ != MAP_FAILED) {
+            munmap(sq_ring_, sq_ring_size_);
+        }
+        sq_ring_ = cq_ring_ = sqes_ = MAP_FAILED;
+        if (fd_ >= 0) {
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    int fd_;
+    std::mutex mutex_;
+    unsigned entries_;
+    void* sq_ring_;
+    void* cq_ring_;
+    void* sqes_;
+    size_t sq_ring_size_;
+    size_t cq_ring_size_;
+    size_t sqes_size_;
+    unsigned* sq_tail_;
+    unsigned sq_mask_;
+    unsigned* sq_array_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    struct io_uring_cqe* cqes_;
+};
+
+#endif
+
+
+PriorityIO::PriorityIO(const int& depth, const bool& uring) {
+    if (depth <= 0) {
+        engine_.reset(new Engine{});
+        return;
+    }
+
+#ifdef PRIORITYBUFFER_IO_URING
+    // Containers and older kernels often refuse io_uring, in which case threads will do
+    if (uring) {
+        std::unique_ptr<UringEngine> engine{new UringEngine{depth}};
+        if (engine->Ready()) {
+            engine_ = std::move(engine);
+            return;
+        }
+    }
+#endif
+    engine_.reset(new ThreadEngine{depth});
+}
+
+PriorityIO::~PriorityIO() {}
+
+void PriorityIO::Submit(std::vector<PriorityIORequest>& requests) {
+    // Each round makes the calls that are still unfinished, picking up where the last one left off
+    std::vector<size_t> pending(requests.size());
+    std::vector<size_t> done(requests.size(), 0);
+    for (size_t i = 0; i < requests.size(); ++i) {
+        pending[i] = i;
+    }
+
+    while (!pending.empty()) {
+        std::vector<PriorityIORequest> round;
+        for (auto i : pending) {
+            round.push_back(requests[i]);
+            round.back().data = requests[i].data ? requests[i].data + done[i] : nullptr;
+            round.back().size = requests[i].size - done[i];
+            round.back().offset = requests[i].offset + done[i];
+        }
+        // A lone call has nothing to overlap with
+        if (round.size() == 1) {
+            Engine{}.Run(round);
+        } else {
+            engine_->Run(round);
+        }
+
+        std::vector<size_t> unfinished;
+        for (size_t k = 0; k < round.size(); ++k) {
+            auto i = pending[k];
+            auto result = round[k].result;
+            auto& request = requests[i];
+            if (result == -EINTR || result == -EAGAIN) {
+                unfinished.push_back(i);
+            } else if (result < 0) {
+                request.result = result;
+            } else if (request.operation == PriorityIORequest::Operation::READ ||
+                       request.operation == PriorityIORequest::Operation::WRITE) {
+                done[i] += result;
+                if (result == 0 || done[i] == request.size) {
+                    request.result = done[i];
+                } else {
+                    unfinished.push_back(i);
+                }
+            } else {
+                request.result = 0;
+            }
+        }
+        pending.swap(unfinished);
+    }
+}
+
+bool PriorityIO::Uring() {
+    return engine_->Uring();
+}
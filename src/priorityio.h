@@ -0,0 +1,57 @@
+#ifndef PRIORITY_IO_H
+#define PRIORITY_IO_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+
+// One system call for PriorityIO to make. READ and WRITE transfer size bytes at offset of fd, SYNC
+// syncs the data of fd and UNLINK removes the file at path.
+struct PriorityIORequest {
+    enum class Operation { READ, WRITE, SYNC, UNLINK };
+
+    PriorityIORequest(const Operation& operation, const int& fd, char* data, const size_t& size,
+                      const off_t& offset)
+            : operation{operation}, fd{fd}, data{data}, size{size}, offset{offset}, result{0} {}
+    PriorityIORequest(const Operation& operation, const std::string& path)
+            : operation{operation}, fd{-1}, data{nullptr}, size{0}, offset{0}, path(path),
+              result{0} {}
+
+    Operation operation;
+    int fd;
+    char* data;
+    size_t size;
+    off_t offset;
+    std::string path;
+    // The bytes transferred, or 0 for the other operations. A negative errno if the call failed.
+    long long result;
+};
+
+// Keeps up to depth requests in flight at once, through io_uring where the kernel allows it and on
+// a pool of as many threads otherwise
+class PriorityIO {
+  public:
+    // A depth of 0 makes every call in the calling thread, one after the other. Without uring,
+    // threads are used even where io_uring is available.
+    PriorityIO(const int& depth, const bool& uring=true);
+    ~PriorityIO();
+
+    // Returns once every request has completed. Short reads and writes are carried on until the
+    // end of the file or an error.
+    void Submit(std::vector<PriorityIORequest>& requests);
+
+    // Whether requests go through io_uring
+    bool Uring();
+
+  private:
+    class Engine;
+    class ThreadEngine;
+    class UringEngine;
+
+    std::unique_ptr<Engine> engine_;
+};
+
+#endif
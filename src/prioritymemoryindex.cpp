@@ -0,0 +1,452 @@
+#include "prioritymemoryindex.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// The journal is rewritten from the live entries once it holds this many records and more than
+// twice as many as there are messages on disk
+#define JOURNAL_COMPACT_RECORDS 1024
+
+
+PriorityMemoryIndex::PriorityMemoryIndex(const unsigned long long& max_size,
+                                         const std::string& path,
+                                         const PriorityDBOptions& options)
+        : path_(path), max_size_{max_size},
+          synchronous_{options.synchronous == PriorityDBOptions::Synchronous::AUTO ?
+                       PriorityDBOptions::Synchronous::FULL : options.synchronous},
+          max_id_{0}, disk_size_{0}, depth_{0}, rollback_only_{false}, saved_pending_{0},
+          journal_fd_{-1}, journal_records_{0} {
+    if (max_size_ == 0LL) {
+        throw PriorityDBException{"Must specify a nonzero max_size"};
+    }
+    load_();
+    compact_();
+}
+
+PriorityMemoryIndex::~PriorityMemoryIndex() {
+    try {
+        Flush();
+    } catch (const PriorityDBException&) {
+        // Whatever could not be written is replayed from the messages still on disk next time
+    }
+    if (journal_fd_ >= 0) {
+        close(journal_fd_);
+    }
+}
+
+void PriorityMemoryIndex::Begin() {
+    if (depth_++ > 0) {
+        return;
+    }
+
+    rollback_only_ = false;
+    undo_log_.clear();
+    saved_pending_ = pending_.size();
+}
+
+void PriorityMemoryIndex::Commit() {
+    if (depth_ == 0 || --depth_ > 0) {
+        return;
+    }
+
+    if (rollback_only_) {
+        undo_();
+    }
+    undo_log_.clear();
+}
+
+void PriorityMemoryIndex::Rollback() {
+    if (depth_ == 0) {
+        return;
+    }
+    if (--depth_ > 0) {
+        rollback_only_ = true;
+        return;
+    }
+
+    undo_();
+    undo_log_.clear();
+}
+
+void PriorityMemoryIndex::Flush() {
+    if (depth_ > 0 || pending_.empty()) {
+        return;
+    }
+
+    write_(journal_fd_, pending_);
+    if (synchronous_ == PriorityDBOptions::Synchronous::FULL) {
+        sync_(journal_fd_);
+    }
+    journal_records_ += std::count(pending_.begin(), pending_.end(), '\n');
+    pending_.clear();
+
+    if (journal_records_ > JOURNAL_COMPACT_RECORDS && journal_records_ > 2 * disk_.size()) {
+        compact_();
+    }
+}
+
+void PriorityMemoryIndex::Insert(const unsigned long long& priority, const unsigned long long& id,
+                                 const unsigned long long& size, const bool& on_disk) {
+    if (id == 0) {
+        return;
+    }
+
+    Entry entry;
+    if (find_(id, entry)) {
+        throw PriorityDBException{"Message " + std::to_string(id) + " is already in the index"};
+    }
+    entry.priority = priority;
+    entry.size = size;
+    entry.on_disk = on_disk;
+    entry.segment = 0;
+    entry.offset = 0;
+    add_(id, entry);
+    max_id_ = std::max(max_id_, id);
+    if (on_disk) {
+        journal_(id, entry);
+    }
+}
+
+void PriorityMemoryIndex::Delete(const unsigned long long& id) {
+    Entry entry;
+    if (id == 0 || !find_(id, entry)) {
+        return;
+    }
+
+    remove_(id);
+    if (entry.on_disk) {
+        entry.on_disk = false;
+        journal_(id, entry);
+    }
+}
+
+void PriorityMemoryIndex::Update(const unsigned long long& id, const bool& on_disk) {
+    Entry entry;
+    if (id == 0 || !find_(id, entry) || entry.on_disk == on_disk) {
+        return;
+    }
+
+    remove_(id);
+    entry.on_disk = on_disk;
+    entry.segment = 0;
+    entry.offset = 0;
+    add_(id, entry);
+    journal_(id, entry);
+}
+
+void PriorityMemoryIndex::SetLocation(const unsigned long long& id,
+                                      const PriorityLocation& location) {
+    Entry entry;
+    if (id == 0 || !find_(id, entry)) {
+        return;
+    }
+
+    remove_(id);
+    entry.size = location.length;
+    entry.on_disk = true;
+    entry.segment = location.segment;
+    entry.offset = location.offset;
+    add_(id, entry);
+    journal_(id, entry);
+}
+
+bool PriorityMemoryIndex::GetLocation(const unsigned long long& id, PriorityLocation& location) {
+    Entry entry;
+    if (!find_(id, entry) || !entry.on_disk) {
+        return false;
+    }
+
+    location.segment = entry.segment;
+    location.offset = entry.offset;
+    location.length = entry.size;
+    return true;
+}
+
+unsigned long long PriorityMemoryIndex::GetHighestId(bool& on_disk) {
+    if (memory_.empty() && disk_.empty()) {
+        return 0;
+    }
+
+    // Equal priorities are served from memory first
+    if (disk_.empty() ||
+            (!memory_.empty() && memory_.rbegin()->first >= disk_.rbegin()->first)) {
+        on_disk = false;
+        return oldest_(memory_);
+    }
+    on_disk = true;
+    return oldest_(disk_);
+}
+
+bool PriorityMemoryIndex::GetHighestPriority(unsigned long long& priority) {
+    if (memory_.empty() && disk_.empty()) {
+        return false;
+    }
+
+    priority = 0;
+    if (!memory_.empty()) {
+        priority = memory_.rbegin()->first;
+    }
+    if (!disk_.empty()) {
+        priority = std::max(priority, disk_.rbegin()->first);
+    }
+    return true;
+}
+
+unsigned long long PriorityMemoryIndex::GetLowestMemoryId() {
+    if (memory_.empty()) {
+        return 0;
+    }
+    return memory_.begin()->second;
+}
+
+unsigned long long PriorityMemoryIndex::GetLowestDiskId() {
+    if (disk_.empty()) {
+        return 0;
+    }
+    return disk_.begin()->second;
+}
+
+bool PriorityMemoryIndex::GetLowestPriority(const bool& on_disk, unsigned long long& priority) {
+    auto& messages = on_disk ? disk_ : memory_;
+    if (messages.empty()) {
+        return false;
+    }
+    priority = messages.begin()->first;
+    return true;
+}
+
+unsigned long long PriorityMemoryIndex::GetHighestDiskId(const int& depth) {
+    if (disk_.empty() || depth <= 0) {
+        return 0;
+    }
+
+    // Messages in memory are popped first when their priority is equal
+    auto priority = disk_.rbegin()->first;
+    int ahead = 0;
+    for (auto key = memory_.rbegin(); key != memory_.rend() && key->first >= priority; ++key) {
+        if (++ahead >= depth) {
+            return 0;
+        }
+    }
+    return oldest_(disk_);
+}
+
+unsigned long long PriorityMemoryIndex::GetMaxId() {
+    return max_id_;
+}
+
+bool PriorityMemoryIndex::Full() {
+    return disk_size_ > max_size_;
+}
+
+int PriorityMemoryIndex::GetDiskLength() {
+    return disk_.size();
+}
+
+unsigned long long PriorityMemoryIndex::GetDiskSize() {
+    return disk_size_;
+}
+
+std::vector<unsigned long long> PriorityMemoryIndex::GetSegmentIds(
+        const unsigned long long& segment) {
+    // Only compaction asks, and rarely, so this doesn't warrant a structure of its own
+    std::vector<unsigned long long> ids;
+    for (auto& entry : entries_) {
+        if (segment > 0 && entry.second.segment == segment) {
+            ids.push_back(entry.first);
+        }
+    }
+    return ids;
+}
+
+std::map<unsigned long long, unsigned long long> PriorityMemoryIndex::GetSegmentSizes() {
+    std::map<unsigned long long, unsigned long long> sizes;
+    for (auto& entry : entries_) {
+        if (entry.second.segment > 0) {
+            sizes[entry.second.segment] += entry.second.size;
+        }
+    }
+    return sizes;
+}
+
+bool PriorityMemoryIndex::find_(const unsigned long long& id, Entry& entry) {
+    auto find = entries_.find(id);
+    if (find == entries_.end()) {
+        return false;
+    }
+    entry = find->second;
+    return true;
+}
+
+void PriorityMemoryIndex::add_(const unsigned long long& id, const Entry& entry) {
+    if (depth_ > 0) {
+        undo_log_.push_back(Undo{id, false, entry});
+    }
+    entries_[id] = entry;
+    if (entry.on_disk) {
+        disk_.emplace(entry.priority, id);
+        disk_size_ += entry.size;
+    } else {
+        memory_.emplace(entry.priority, id);
+    }
+}
+
+void PriorityMemoryIndex::remove_(const unsigned long long& id) {
+    auto find = entries_.find(id);
+    if (find == entries_.end()) {
+        return;
+    }
+
+    auto& entry = find->second;
+    if (depth_ > 0) {
+        undo_log_.push_back(Undo{id, true, entry});
+    }
+    if (entry.on_disk) {
+        disk_.erase(Key{entry.priority, id});
+        disk_size_ -= entry.size;
+    } else {
+        memory_.erase(Key{entry.priority, id});
+    }
+    entries_.erase(find);
+}
+
+unsigned long long PriorityMemoryIndex::oldest_(const std::set<Key>& keys) {
+    // The first key of the highest priority, which has the lowest id of those tied with it
+    return keys.lower_bound(Key{keys.rbegin()->first, 0})->second;
+}
+
+void PriorityMemoryIndex::undo_() {
+    // Replaying the log backwards with the opposite change puts every entry back where it was.
+    // The depth is already zero, so none of this is logged again.
+    for (auto undo = undo_log_.rbegin(); undo != undo_log_.rend(); ++undo) {
+        if (undo->existed) {
+            add_(undo->id, undo->entry);
+        } else {
+            remove_(undo->id);
+        }
+    }
+    pending_.resize(saved_pending_);
+}
+
+void PriorityMemoryIndex::journal_(const unsigned long long& id, const Entry& entry) {
+    std::stringstream stream;
+    if (entry.on_disk) {
+        stream << "+ " << entry.priority << " " << entry.size << " " << id << " "
+               << entry.segment << " " << entry.offset << "\n";
+    } else {
+        stream << "- " << id << "\n";
+    }
+    pending_ += stream.str();
+}
+
+void PriorityMemoryIndex::load_() {
+    std::ifstream stream{path_};
+    std::string line;
+    while (std::getline(stream, line)) {
+        if (stream.eof()) {
+            // The last record was cut short, most likely by a crash halfway through a write
+            break;
+        }
+
+        std::istringstream record{line};
+        char operation;
+        unsigned long long id;
+        if (!(record >> operation)) {
+            continue;
+        }
+        if (operation == '+') {
+            unsigned long long priority, size, segment = 0, offset = 0;
+            if (record >> priority >> size >> id && id != 0) {
+                // Journals written before segments end with the id
+                record >> segment >> offset;
+                remove_(id);
+                add_(id, Entry{priority, size, true, segment, offset});
+                max_id_ = std::max(max_id_, id);
+            }
+        } else if (operation == '-') {
+            if (record >> id) {
+                remove_(id);
+            }
+        } else if (operation == '=') {
+            if (record >> id) {
+                max_id_ = std::max(max_id_, id);
+            }
+        }
+    }
+}
+
+void PriorityMemoryIndex::compact_() {
+    // The largest id survives the records it came from, so that ids are never handed out twice
+    std::stringstream stream;
+    stream << "= " << max_id_ << "\n";
+    for (auto& key : disk_) {
+        auto& entry = entries_[key.second];
+        stream << "+ " << key.first << " " << entry.size << " " << key.second << " "
+               << entry.segment << " " << entry.offset << "\n";
+    }
+
+    auto temporary_path = path_ + ".tmp";
+    auto fd = open(temporary_path.data(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw PriorityDBException{"Unable to open " + temporary_path + ": " + strerror(errno)};
+    }
+    try {
+        write_(fd, stream.str());
+        if (synchronous_ != PriorityDBOptions::Synchronous::OFF) {
+            sync_(fd);
+        }
+    } catch (const PriorityDBException&) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    if (rename(temporary_path.data(), path_.data()) != 0) {
+        throw PriorityDBException{"Unable to replace " + path_ + ": " + strerror(errno)};
+    }
+
+    journal_records_ = disk_.size() + 1;
+    open_journal_();
+}
+
+void PriorityMemoryIndex::open_journal_() {
+    if (journal_fd_ >= 0) {
+        close(journal_fd_);
+    }
+    journal_fd_ = open(path_.data(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (journal_fd_ < 0) {
+        throw PriorityDBException{"Unable to open " + path_ + ": " + strerror(errno)};
+    }
+}
+
+void PriorityMemoryIndex::write_(const int& fd, const std::string& data) {
+    auto written = std::string::size_type{0};
+    while (written < data.size()) {
+        auto result = write(fd, data.data() + written, data.size() - written);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw PriorityDBException{"Unable to write " + path_ + ": " + strerror(errno)};
+        }
+        written += result;
+    }
+}
+
+void PriorityMemoryIndex::sync_(const int& fd) {
+#ifdef __APPLE__
+    auto result = fsync(fd);
+#else
+    auto result = fdatasync(fd);
+#endif
+    if (result != 0) {
+        throw PriorityDBException{"Unable to sync " + path_ + ": " + strerror(errno)};
+    }
+}
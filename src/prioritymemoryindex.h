@@ -0,0 +1,97 @@
+#ifndef PRIORITY_MEMORY_INDEX_H
+#define PRIORITY_MEMORY_INDEX_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "prioritydb.h"
+#include "priorityindex.h"
+
+
+// Keeps the index in ordered in-process structures, so that every operation is a logarithmic
+// lookup without any system calls. Only messages on disk outlive the process: each change to them
+// is appended to a journal at Flush(), and the journal is replayed and compacted at startup.
+class PriorityMemoryIndex : public PriorityIndex {
+  public:
+    PriorityMemoryIndex(const unsigned long long& max_size, const std::string& path,
+                        const PriorityDBOptions& options);
+    ~PriorityMemoryIndex();
+
+    void Begin() override;
+    void Commit() override;
+    void Rollback() override;
+    void Flush() override;
+    void Insert(const unsigned long long& priority, const unsigned long long& id,
+                const unsigned long long& size, const bool& on_disk) override;
+    void Delete(const unsigned long long& id) override;
+    void Update(const unsigned long long& id, const bool& on_disk) override;
+    void SetLocation(const unsigned long long& id, const PriorityLocation& location) override;
+    bool GetLocation(const unsigned long long& id, PriorityLocation& location) override;
+    unsigned long long GetHighestId(bool& on_disk) override;
+    bool GetHighestPriority(unsigned long long& priority) override;
+    unsigned long long GetLowestMemoryId() override;
+    unsigned long long GetLowestDiskId() override;
+    bool GetLowestPriority(const bool& on_disk, unsigned long long& priority) override;
+    unsigned long long GetHighestDiskId(const int& depth) override;
+    unsigned long long GetMaxId() override;
+    bool Full() override;
+    int GetDiskLength() override;
+    unsigned long long GetDiskSize() override;
+    std::vector<unsigned long long> GetSegmentIds(const unsigned long long& segment) override;
+    std::map<unsigned long long, unsigned long long> GetSegmentSizes() override;
+
+  private:
+    // Priority first, and then the id, so that ties in priority are broken by age
+    typedef std::pair<unsigned long long, unsigned long long> Key;
+
+    struct Entry {
+        unsigned long long priority;
+        unsigned long long size;
+        bool on_disk;
+        unsigned long long segment;
+        unsigned long long offset;
+    };
+
+    struct Undo {
+        unsigned long long id;
+        bool existed;
+        Entry entry;
+    };
+
+    bool find_(const unsigned long long& id, Entry& entry);
+    void add_(const unsigned long long& id, const Entry& entry);
+    void remove_(const unsigned long long& id);
+    unsigned long long oldest_(const std::set<Key>& keys);
+    void undo_();
+    void journal_(const unsigned long long& id, const Entry& entry);
+    void load_();
+    void compact_();
+    void open_journal_();
+    void write_(const int& fd, const std::string& data);
+    void sync_(const int& fd);
+
+    std::string path_;
+    unsigned long long max_size_;
+    PriorityDBOptions::Synchronous synchronous_;
+
+    std::unordered_map<unsigned long long, Entry> entries_;
+    std::set<Key> memory_;
+    std::set<Key> disk_;
+    unsigned long long max_id_;
+    unsigned long long disk_size_;
+
+    int depth_;
+    bool rollback_only_;
+    std::vector<Undo> undo_log_;
+    std::string::size_type saved_pending_;
+
+    int journal_fd_;
+    std::string pending_;
+    unsigned long long journal_records_;
+};
+
+#endif
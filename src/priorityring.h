@@ -0,0 +1,111 @@
+#ifndef PRIORITY_RING_H
+#define PRIORITY_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Bytes kept between the positions that pushing and popping threads update
+#define PRIORITY_RING_CACHE_LINE 64
+
+// A bounded queue that any number of threads can push to and pop from without a lock. Every slot
+// carries a sequence number that says whose turn it is: a slot is free for the push that claims
+// position p while its sequence is p, and holds a value for the pop of position p once it is
+// p + 1. Claiming a position is a single compare and swap, so threads only ever retry, never wait.
+template <typename T>
+class PriorityRing {
+  public:
+    // The capacity is rounded up to a power of two of at least 2
+    PriorityRing(const size_t& capacity) : mask_{round_up_(capacity) - 1} {
+        push_.value.store(0, std::memory_order_relaxed);
+        pop_.value.store(0, std::memory_order_relaxed);
+        slots_.reset(new Slot[mask_ + 1]);
+        for (size_t i = 0; i <= mask_; ++i) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Moves value in and returns true, or returns false and leaves it alone if the ring is full
+    bool TryPush(T& value) {
+        auto position = push_.value.load(std::memory_order_relaxed);
+        while (true) {
+            auto& slot = slots_[position & mask_];
+            auto sequence = slot.sequence.load(std::memory_order_acquire);
+            auto difference = static_cast<long long>(sequence - position);
+            if (difference == 0) {
+                if (push_.value.compare_exchange_weak(position, position + 1,
+                                                      std::memory_order_relaxed)) {
+                    slot.value = std::move(value);
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = push_.value.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Moves the oldest value out into value and returns true, or returns false if the ring is empty
+    bool TryPop(T& value) {
+        auto position = pop_.value.load(std::memory_order_relaxed);
+        while (true) {
+            auto& slot = slots_[position & mask_];
+            auto sequence = slot.sequence.load(std::memory_order_acquire);
+            auto difference = static_cast<long long>(sequence - (position + 1));
+            if (difference == 0) {
+                if (pop_.value.compare_exchange_weak(position, position + 1,
+                                                     std::memory_order_relaxed)) {
+                    value = std::move(slot.value);
+                    slot.sequence.store(position + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = pop_.value.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Whether any push has claimed a slot that no pop has taken yet. Only a hint while other
+    // threads are at work.
+    bool Empty() {
+        return push_.value.load() == pop_.value.load();
+    }
+
+    size_t Capacity() {
+        return mask_ + 1;
+    }
+
+  private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    // Padded on either side rather than aligned, which new only honours from C++17 on, so that
+    // whatever surrounds a position never shares its cache line
+    struct Position {
+        char before[PRIORITY_RING_CACHE_LINE];
+        std::atomic<size_t> value;
+        char after[PRIORITY_RING_CACHE_LINE];
+    };
+
+    static size_t round_up_(const size_t& capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    std::unique_ptr<Slot[]> slots_;
+    const size_t mask_;
+    Position push_;
+    Position pop_;
+};
+
+#endif
@@ -0,0 +1,257 @@
+#ifndef SHARDED_PRIORITY_BUFFER_H
+#define SHARDED_PRIORITY_BUFFER_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "prioritybuffer.h"
+
+
+// Spreads messages over several PriorityBuffers, each with a lock, memory tier, index and
+// directory of its own, so that producers and consumers on different shards don't wait on each
+// other. Pushes go to the shards in turn, and Pop takes from the shard whose highest priority
+// message is the highest of all.
+//
+// The shards share one budget for buffer_size, max_memory and the memory budget, kept in atomic
+// totals that each shard updates under its own lock. While a total is over a limit, only the
+// shard with the lowest priority message of all in memory, or on disk, spills or evicts, so the
+// lowest priority messages go first as they would from a single buffer. A shard that finds a
+// limit exceeded without holding that message leaves it to the next Push, which has the shard
+// that does make room. Priority order holds across shards for messages pushed before a Pop, but
+// not between concurrent ones.
+template <typename T>
+class ShardedPriorityBuffer {
+    typedef std::function<unsigned long long(const T&)> PriorityFunction;
+
+  public:
+    ShardedPriorityBuffer(PriorityFunction make_priority, const int& shards)
+            : ShardedPriorityBuffer{make_priority, shards, DEFAULT_MAX_BUFFER_SIZE,
+                                    DEFAULT_MAX_MEMORY_SIZE} {}
+
+    ShardedPriorityBuffer(PriorityFunction make_priority, const int& shards,
+                          const unsigned long long& buffer_size, const int& max_memory,
+                          const PriorityDBOptions& db_options=PriorityDBOptions{},
+                          const PriorityFSOptions& fs_options=PriorityFSOptions{})
+            : ShardedPriorityBuffer{make_priority, shards, std::string{}, buffer_size,
+                                    max_memory, db_options, fs_options} {}
+
+    // Shard i is kept in prism_shard_i under buffer_root. At least one shard is always made.
+    ShardedPriorityBuffer(PriorityFunction make_priority, const int& shards,
+                          const std::string& buffer_root, const unsigned long long& buffer_size,
+                          const int& max_memory,
+                          const PriorityDBOptions& db_options=PriorityDBOptions{},
+                          const PriorityFSOptions& fs_options=PriorityFSOptions{})
+            : next_shard_{0}, waiting_{0} {
+        auto count = std::max(shards, 1);
+        for (int i = 0; i < count; ++i) {
+            shards_.emplace_back(new Shard{make_priority, buffer_root,
+                                           "prism_shard_" + std::to_string(i), buffer_size,
+                                           max_memory, db_options, fs_options, &budget_});
+        }
+    }
+
+    void SetFuzz(const unsigned long& fuzz_lower_ms, const unsigned long& fuzz_upper_ms) {
+        for (auto& shard : shards_) {
+            shard->SetFuzz(fuzz_lower_ms, fuzz_upper_ms);
+        }
+    }
+
+    void SetMemoryBudget(const unsigned long long& high_bytes,
+                         const unsigned long long& low_bytes) {
+        for (auto& shard : shards_) {
+            shard->SetMemoryBudget(high_bytes, low_bytes);
+        }
+    }
+
+    void SetGroupCommit(const unsigned long& window_ms) {
+        for (auto& shard : shards_) {
+            shard->SetGroupCommit(window_ms);
+        }
+    }
+
+    void SetBackgroundSpill(const bool& enabled, const int& max_backlog=DEFAULT_MAX_SPILL_BACKLOG) {
+        for (int i = 0; i < GetShards(); ++i) {
+            shards_[i]->SetBackgroundSpill(enabled, share_(max_backlog, i, GetShards()));
+        }
+    }
+
+    void SetPrefetch(const int& depth) {
+        for (int i = 0; i < GetShards(); ++i) {
+            shards_[i]->SetPrefetch(share_(depth, i, GetShards()));
+        }
+    }
+
+    unsigned long long GetCorruptMessages() {
+        unsigned long long corrupt = 0;
+        for (auto& shard : shards_) {
+            corrupt += shard->GetCorruptMessages();
+        }
+        return corrupt;
+    }
+
+    int GetShards() {
+        return shards_.size();
+    }
+
+    void Push(std::unique_ptr<T> t) {
+        if (!t) {
+            return;
+        }
+
+        shards_[next_shard_++ % shards_.size()]->Push(std::move(t));
+        make_room_();
+        if (waiting_ > 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            condition_.notify_one();
+        }
+    }
+
+    void Push(T&& t) {
+        auto object = std::unique_ptr<T>{new T{}};
+        object->Swap(&t);
+        Push(std::move(object));
+    }
+
+    std::unique_ptr<T> Pop(bool block=false) {
+        while (true) {
+            // A shard can be emptied by another consumer between the look and the Pop, or hold a
+            // message that can't be read back, so the heads are looked at again until one gives
+            for (auto shard = best_shard_(); shard != nullptr; shard = best_shard_()) {
+                auto t = shard->Pop();
+                if (t) {
+                    return t;
+                }
+            }
+            if (!block) {
+                return nullptr;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            ++waiting_;
+            condition_.wait(lock, [this] { return best_shard_() != nullptr; });
+            --waiting_;
+        }
+    }
+
+  private:
+    // A PriorityBuffer that publishes the priority of its highest message, for Pop to compare
+    // without taking the locks of the shards
+    class Shard : public PriorityBuffer<T> {
+      public:
+        Shard(PriorityFunction make_priority, const std::string& buffer_root,
+              const std::string& buffer_directory, const unsigned long long& buffer_size,
+              const int& max_memory, const PriorityDBOptions& db_options,
+              const PriorityFSOptions& fs_options, PriorityBudget* budget)
+                : PriorityBuffer<T>{make_priority, buffer_root, buffer_directory, buffer_size,
+                                    max_memory, db_options, fs_options, budget},
+                  has_head_{false}, head_{0} {
+            publish_head_();
+        }
+
+        void Push(std::unique_ptr<T> t) {
+            PriorityBuffer<T>::Push(std::move(t));
+            publish_head_();
+        }
+
+        std::unique_ptr<T> Pop() {
+            auto t = PriorityBuffer<T>::Pop();
+            publish_head_();
+            return t;
+        }
+
+        void MakeRoom() {
+            this->make_room_();
+            publish_head_();
+        }
+
+        bool GetHead(unsigned long long& priority) {
+            if (!has_head_) {
+                return false;
+            }
+            priority = head_;
+            return true;
+        }
+
+      private:
+        void publish_head_() {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            unsigned long long priority = 0;
+            if (this->db_.GetHighestPriority(priority)) {
+                head_ = priority;
+                has_head_ = true;
+            } else {
+                has_head_ = false;
+            }
+        }
+
+        std::atomic<bool> has_head_;
+        std::atomic<unsigned long long> head_;
+    };
+
+    // Splits total as evenly as it goes, handing what is left over to the first shards
+    static int share_(const int& total, const int& index, const int& count) {
+        return total / count + (index < total % count ? 1 : 0);
+    }
+
+    // Has the shards with the lowest priority messages in memory and on disk give them up, for as
+    // long as other shards find the budget unmet. Each round makes room or moves the lowest
+    // message on to another shard, so as many rounds as there are shards are enough.
+    void make_room_() {
+        for (size_t i = 0; i < shards_.size() && budget_.unmet.exchange(false); ++i) {
+            auto memory = lowest_shard_(false);
+            auto disk = lowest_shard_(true);
+            if (memory) {
+                memory->MakeRoom();
+            }
+            if (disk && disk != memory) {
+                disk->MakeRoom();
+            }
+        }
+    }
+
+    // The shard whose tail in memory, or on disk, is the lowest, or nullptr if all are empty there
+    Shard* lowest_shard_(const bool& on_disk) {
+        Shard* lowest = nullptr;
+        auto lowest_priority = std::numeric_limits<unsigned long long>::max();
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            auto& tails = budget_.tails[i];
+            auto priority = on_disk ? tails.disk.load() : tails.memory.load();
+            if (priority < lowest_priority) {
+                lowest = shards_[i].get();
+                lowest_priority = priority;
+            }
+        }
+        return lowest;
+    }
+
+    // The shard with the highest head, the first of them on a tie, or nullptr if all are empty
+    Shard* best_shard_() {
+        Shard* best = nullptr;
+        unsigned long long best_priority = 0;
+        for (auto& shard : shards_) {
+            unsigned long long priority;
+            if (shard->GetHead(priority) && (best == nullptr || priority > best_priority)) {
+                best = shard.get();
+                best_priority = priority;
+            }
+        }
+        return best;
+    }
+
+    // Outlives the shards, which take their share out of it as they go
+    PriorityBudget budget_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<unsigned long long> next_shard_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::atomic<int> waiting_;
+};
+
+#endif
@@ -79,6 +79,128 @@ TEST_F(FSFixture, OutOfOrderTest) {
     }
 }
 
+TEST_F(FSFixture, PushValueTest) {
+    PriorityBuffer<Basic> basics;
+    for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+        Basic basic;
+        basic.set_value(std::to_string(i));
+        basics.Push(std::move(basic));
+        EXPECT_FALSE(basic.has_value());
+        std::this_thread::sleep_for(std::chrono::nanoseconds(1));
+    }
+    for (int i = NUMBER_MESSAGES_IN_TEST - 1; i >= 0; --i) {
+        auto basic = basics.Pop();
+        ASSERT_NE(nullptr, basic);
+        EXPECT_EQ(std::to_string(i), basic->value());
+    }
+    EXPECT_EQ(nullptr, basics.Pop());
+}
+
+TEST_F(FSFixture, PushNullTest) {
+    PriorityBuffer<Basic> basics;
+    basics.Push(std::unique_ptr<Basic>{});
+    EXPECT_EQ(nullptr, basics.Pop());
+}
+
+TEST_F(FSFixture, MemoryBudgetTest) {
+    unsigned long long next_priority = 0;
+    auto increasing_priority = [&next_priority] (const Basic& basic) -> unsigned long long {
+        return next_priority++;
+    };
+
+    // Each message is a 100 byte string plus a tag and a length byte
+    PriorityBuffer<Basic> basics{increasing_priority, DEFAULT_MAX_BUFFER_SIZE, 1000};
+    basics.SetMemoryBudget(10 * 102, 5 * 102);
+    for (int i = 0; i < 10; ++i) {
+        Basic basic;
+        basic.set_value(std::string(100, 'a' + i));
+        basics.Push(std::move(basic));
+    }
+    EXPECT_EQ(0, number_of_files_());
+    {
+        Basic basic;
+        basic.set_value(std::string(100, 'k'));
+        basics.Push(std::move(basic));
+    }
+    EXPECT_EQ(6, number_of_files_());
+    for (int i = 10; i >= 0; --i) {
+        auto basic = basics.Pop();
+        ASSERT_NE(nullptr, basic);
+        EXPECT_EQ(std::string(100, 'a' + i), basic->value());
+    }
+    EXPECT_EQ(0, number_of_files_());
+}
+
+TEST_F(FSFixture, LargeMessageTest) {
+    PriorityBuffer<Basic> basics{[] (const Basic& basic) { return basic.value().size(); },
+                                 DEFAULT_MAX_BUFFER_SIZE, 0};
+    for (int i = 1; i <= 4; ++i) {
+        Basic basic;
+        basic.set_value(std::string(i << 18, 'a' + i));
+        basics.Push(std::move(basic));
+    }
+    ASSERT_EQ(4, number_of_files_());
+    for (auto& file : fs::directory_iterator{buffer_path_}) {
+        if (file.path().filename().native().substr(0, 10) != "prism_data") {
+            EXPECT_LT(1 << 18, fs::file_size(file.path()));
+        }
+    }
+    for (int i = 4; i >= 1; --i) {
+        auto basic = basics.Pop();
+        ASSERT_NE(nullptr, basic);
+        EXPECT_EQ(std::string(i << 18, 'a' + i), basic->value());
+    }
+    EXPECT_EQ(0, number_of_files_());
+}
+
+TEST_F(FSFixture, MappedLargeMessageTest) {
+    PriorityFSOptions fs_options;
+    fs_options.mmap_threshold = 1 << 18;
+    fs_options.segment_size = 1 << 20;
+    PriorityBuffer<Basic> basics{[] (const Basic& basic) { return basic.value().size(); },
+                                 DEFAULT_MAX_BUFFER_SIZE, 0, PriorityDBOptions{}, fs_options};
+    for (int i = 1; i <= 4; ++i) {
+        Basic basic;
+        basic.set_value(std::string(i << 17, 'a' + i));
+        basics.Push(std::move(basic));
+    }
+    for (int i = 4; i >= 1; --i) {
+        auto basic = basics.Pop();
+        ASSERT_NE(nullptr, basic);
+        EXPECT_EQ(std::string(i << 17, 'a' + i), basic->value());
+    }
+}
+
+#ifdef PRIORITYBUFFER_LZ4
+TEST_F(FSFixture, CompressedMessageTest) {
+    // A hundred messages of 2000 bytes of text only fit in 64 KiB once compressed
+    PriorityFSOptions fs_options;
+    fs_options.compression = PriorityFSOptions::Compression::LZ4;
+    PriorityBuffer<Basic> basics{[] (const Basic& basic) {
+                                     return std::stoull(basic.value().substr(0, 8));
+                                 }, 1 << 16, 0, PriorityDBOptions{}, fs_options};
+    auto make_value = [] (const int& i) {
+        auto value = std::to_string(10000000 + i);
+        while (value.size() < 2000) {
+            value += " sensor " + std::to_string(i % 7) + " reported nominal readings;";
+        }
+        return value;
+    };
+    for (int i = 0; i < 100; ++i) {
+        Basic basic;
+        basic.set_value(make_value(i));
+        basics.Push(std::move(basic));
+    }
+    for (int i = 99; i >= 0; --i) {
+        auto basic = basics.Pop();
+        ASSERT_NE(nullptr, basic);
+        EXPECT_EQ(make_value(i), basic->value());
+    }
+    EXPECT_EQ(nullptr, basics.Pop());
+    EXPECT_EQ(0, number_of_files_());
+}
+#endif
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     GOOGLE_PROTOBUF_VERIFY_VERSION;
@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <fstream>
+#include <iterator>
 #include <sstream>
 #include <string>
 
@@ -93,6 +96,51 @@ TEST_F(DBFixture, ConstructZeroSpaceTest) {
     EXPECT_TRUE(thrown);
 }
 
+TEST_F(DBFixture, ConstructDefaultJournalTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+    auto response = execute_("PRAGMA journal_mode;");
+    ASSERT_EQ(1, response.size());
+    EXPECT_EQ(std::string{"delete"}, response[0]["journal_mode"]);
+}
+
+TEST_F(DBFixture, ConstructWALTest) {
+    PriorityDBOptions options;
+    options.wal = true;
+    options.synchronous = PriorityDBOptions::Synchronous::NORMAL;
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options};
+    auto response = execute_("PRAGMA journal_mode;");
+    ASSERT_EQ(1, response.size());
+    EXPECT_EQ(std::string{"wal"}, response[0]["journal_mode"]);
+}
+
+TEST_F(DBFixture, ConstructWALThenDefaultTest) {
+    {
+        PriorityDBOptions options;
+        options.wal = true;
+        PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options};
+    }
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+    auto response = execute_("PRAGMA journal_mode;");
+    ASSERT_EQ(1, response.size());
+    EXPECT_EQ(std::string{"delete"}, response[0]["journal_mode"]);
+}
+
+TEST_F(DBFixture, ConstructAllOptionsTest) {
+    PriorityDBOptions options;
+    options.wal = true;
+    options.synchronous = PriorityDBOptions::Synchronous::OFF;
+    options.mmap_size = 1 << 20;
+    options.cache_size = -2000;
+    options.checkpoint_pages = 0;
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options};
+    db.Insert(1, 1, 5, false);
+    db.Insert(3, 2, 10, true);
+    bool on_disk = false;
+    EXPECT_EQ(2, db.GetHighestId(on_disk));
+    EXPECT_TRUE(on_disk);
+    EXPECT_EQ(10, db.GetDiskSize());
+}
+
 TEST_F(DBFixture, InitialDBTest) {
     ASSERT_FALSE(fs::exists(db_path_));
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
@@ -155,20 +203,193 @@ TEST_F(DBFixture, InitialEmptyDBAfterDestructorTest) {
     EXPECT_EQ(0, response.size());
 }
 
-TEST_F(DBFixture, InsertEmptyHashTest) {
+TEST_F(DBFixture, InitialIndexesTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "", 5, false);
     std::stringstream stream;
-    stream << "SELECT * FROM "
+    stream << "SELECT name FROM sqlite_master WHERE type='index' AND tbl_name='"
            << table_name_
-           << ";";
+           << "' ORDER BY name;";
     auto response = execute_(stream.str());
-    ASSERT_EQ(0, response.size());
+    ASSERT_EQ(3, response.size());
+    EXPECT_EQ(std::string{"prism_data_on_disk_priority"}, response[0]["name"]);
+    EXPECT_EQ(std::string{"prism_data_priority"}, response[1]["name"]);
+    EXPECT_EQ(std::string{"prism_data_segment"}, response[2]["name"]);
+}
+
+TEST_F(DBFixture, InitialSchemaVersionTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+    auto response = execute_("PRAGMA user_version;");
+    ASSERT_EQ(1, response.size());
+    EXPECT_EQ(3, std::stoi(response[0]["user_version"]));
+}
+
+TEST_F(DBFixture, MigrateHashesDBTest) {
+    {
+        std::stringstream stream;
+        stream << "CREATE TABLE "
+               << table_name_
+               << "("
+               << "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+               << "priority UNSIGNED BIGINT NOT NULL,"
+               << "hash TEXT NOT NULL,"
+               << "size UNSIGNED BIGINT NOT NULL,"
+               << "on_disk BOOL NOT NULL"
+               << ");"
+               << "INSERT INTO "
+               << table_name_
+               << "(priority, hash, size, on_disk) VALUES(1, 'hash', 5, 1);"
+               << "INSERT INTO "
+               << table_name_
+               << "(priority, hash, size, on_disk) VALUES(3, 'hashbrowns', 10, 0);";
+        execute_(stream.str());
+    }
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+    {
+        std::stringstream stream;
+        stream << "SELECT name FROM sqlite_master WHERE type='index' AND tbl_name='"
+               << table_name_
+               << "';";
+        EXPECT_EQ(3, execute_(stream.str()).size());
+    }
+    {
+        auto response = execute_("PRAGMA user_version;");
+        ASSERT_EQ(1, response.size());
+        EXPECT_EQ(3, std::stoi(response[0]["user_version"]));
+    }
+    {
+        std::stringstream stream;
+        stream << "SELECT * FROM "
+               << table_name_
+               << ";";
+        auto response = execute_(stream.str());
+        ASSERT_EQ(1, response.size());
+        EXPECT_EQ(6, response[0].size());
+        EXPECT_EQ(1, std::stoi(response[0]["id"]));
+        EXPECT_EQ(0, std::stoi(response[0]["segment"]));
+    }
+    EXPECT_EQ(1, db.GetDiskLength());
+    EXPECT_EQ(1, db.GetLowestDiskId());
+    EXPECT_EQ(0, db.GetLowestMemoryId());
+    EXPECT_EQ(2, db.GetMaxId());
+
+    auto hashes = db.GetLegacyHashes();
+    ASSERT_EQ(1, hashes.size());
+    EXPECT_EQ(std::string{"hash"}, hashes[1]);
+    db.DeleteLegacyHashes();
+    EXPECT_TRUE(db.GetLegacyHashes().empty());
+}
+
+TEST_F(DBFixture, MigrateLocationsDBTest) {
+    {
+        std::stringstream stream;
+        stream << "CREATE TABLE "
+               << table_name_
+               << "("
+               << "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+               << "priority UNSIGNED BIGINT NOT NULL,"
+               << "size UNSIGNED BIGINT NOT NULL,"
+               << "on_disk BOOL NOT NULL"
+               << ");"
+               << "INSERT INTO "
+               << table_name_
+               << "(priority, size, on_disk) VALUES(1, 5, 1);"
+               << "PRAGMA user_version=2;";
+        execute_(stream.str());
+    }
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+    {
+        auto response = execute_("PRAGMA user_version;");
+        ASSERT_EQ(1, response.size());
+        EXPECT_EQ(3, std::stoi(response[0]["user_version"]));
+    }
+    PriorityLocation location;
+    ASSERT_TRUE(db.GetLocation(1, location));
+    EXPECT_EQ(0, location.segment);
+    EXPECT_EQ(0, location.offset);
+    EXPECT_EQ(5, location.length);
+    EXPECT_TRUE(db.GetSegmentSizes().empty());
+}
+
+TEST_F(DBFixture, QueryPlanHighestIdTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+    std::stringstream stream;
+    stream << "SELECT id, on_disk FROM "
+           << table_name_
+           << " ORDER BY priority DESC, on_disk ASC LIMIT 1;";
+    auto plan = query_plan_(stream.str());
+    ASSERT_FALSE(plan.empty());
+    for (auto& detail : plan) {
+        EXPECT_NE(std::string::npos, detail.find("COVERING INDEX prism_data_priority")) << detail;
+        EXPECT_EQ(std::string::npos, detail.find("TEMP B-TREE")) << detail;
+    }
+}
+
+TEST_F(DBFixture, QueryPlanLowestIdTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+    std::stringstream stream;
+    stream << "SELECT id FROM "
+           << table_name_
+           << " WHERE on_disk=1 ORDER BY priority ASC LIMIT 1;";
+    auto plan = query_plan_(stream.str());
+    ASSERT_FALSE(plan.empty());
+    for (auto& detail : plan) {
+        EXPECT_NE(std::string::npos, detail.find("SEARCH")) << detail;
+        EXPECT_NE(std::string::npos, detail.find("COVERING INDEX prism_data_on_disk_priority"))
+                << detail;
+        EXPECT_EQ(std::string::npos, detail.find("TEMP B-TREE")) << detail;
+    }
+}
+
+TEST_F(DBFixture, QueryPlanSegmentIdsTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+    std::stringstream stream;
+    stream << "SELECT id FROM "
+           << table_name_
+           << " WHERE segment=1 AND segment>0;";
+    auto plan = query_plan_(stream.str());
+    ASSERT_FALSE(plan.empty());
+    for (auto& detail : plan) {
+        EXPECT_NE(std::string::npos, detail.find("COVERING INDEX prism_data_segment")) << detail;
+    }
+}
+
+TEST_F(DBFixture, QueryPlanDeleteTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+    std::stringstream stream;
+    stream << "DELETE FROM "
+           << table_name_
+           << " WHERE id=1;";
+    auto plan = query_plan_(stream.str());
+    ASSERT_FALSE(plan.empty());
+    for (auto& detail : plan) {
+        EXPECT_NE(std::string::npos, detail.find("SEARCH")) << detail;
+        EXPECT_NE(std::string::npos, detail.find("INTEGER PRIMARY KEY")) << detail;
+    }
+}
+
+TEST_F(DBFixture, QueryPlanUpdateTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+    std::stringstream stream;
+    stream << "UPDATE "
+           << table_name_
+           << " SET on_disk=1 WHERE id=1;";
+    auto plan = query_plan_(stream.str());
+    ASSERT_FALSE(plan.empty());
+    for (auto& detail : plan) {
+        EXPECT_NE(std::string::npos, detail.find("SEARCH")) << detail;
+        EXPECT_NE(std::string::npos, detail.find("INTEGER PRIMARY KEY")) << detail;
+    }
+}
+
+TEST_P(IndexFixture, InsertZeroIdTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 0, 5, false);
+    check_records_(0);
 }
 
 TEST_F(DBFixture, InsertSingleTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
+    db.Insert(1, 1, 5, false);
     std::stringstream stream;
     stream << "SELECT * FROM "
            << table_name_
@@ -176,17 +397,16 @@ TEST_F(DBFixture, InsertSingleTest) {
     auto response = execute_(stream.str());
     ASSERT_EQ(1, response.size());
     auto record = response[0];
-    ASSERT_EQ(5, record.size());
+    ASSERT_EQ(6, record.size());
     EXPECT_EQ(1, std::stoi(record["id"]));
     EXPECT_EQ(1, std::stoi(record["priority"]));
-    EXPECT_EQ(std::string{"hash"}, record["hash"]);
     EXPECT_EQ(false, std::stoi(record["on_disk"]));
 }
 
 TEST_F(DBFixture, InsertCoupleTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
-    db.Insert(3, "hashbrowns", 10, true);
+    db.Insert(1, 1, 5, false);
+    db.Insert(3, 2, 10, true);
     std::stringstream stream;
     stream << "SELECT * FROM "
            << table_name_
@@ -195,19 +415,17 @@ TEST_F(DBFixture, InsertCoupleTest) {
     ASSERT_EQ(2, response.size());
     {
         auto record = response[0];
-        ASSERT_EQ(5, record.size());
+        ASSERT_EQ(6, record.size());
         EXPECT_EQ(1, std::stoi(record["id"]));
         EXPECT_EQ(1, std::stoi(record["priority"]));
-        EXPECT_EQ(std::string{"hash"}, record["hash"]);
         EXPECT_EQ(5, std::stoi(record["size"]));
         EXPECT_EQ(false, std::stoi(record["on_disk"]));
     }
     {
         auto record = response[1];
-        ASSERT_EQ(5, record.size());
+        ASSERT_EQ(6, record.size());
         EXPECT_EQ(2, std::stoi(record["id"]));
         EXPECT_EQ(3, std::stoi(record["priority"]));
-        EXPECT_EQ(std::string{"hashbrowns"}, record["hash"]);
         EXPECT_EQ(10, std::stoi(record["size"]));
         EXPECT_EQ(true, std::stoi(record["on_disk"]));
     }
@@ -217,7 +435,7 @@ TEST_F(DBFixture, InsertManyTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
     auto number_of_records = 100;
     for (int i = 0; i < number_of_records; ++i) {
-        db.Insert(i, std::to_string(i * i), i * 2, i % 2);
+        db.Insert(i, i + 1, i * 2, i % 2);
     }
     std::stringstream stream;
     stream << "SELECT * FROM "
@@ -227,18 +445,17 @@ TEST_F(DBFixture, InsertManyTest) {
     ASSERT_EQ(number_of_records, response.size());
     for (int i = 0; i < number_of_records; ++i) {
         auto record = response[i];
-        ASSERT_EQ(5, record.size());
+        ASSERT_EQ(6, record.size());
         EXPECT_EQ(i + 1, std::stoi(record["id"]));
         EXPECT_EQ(i, std::stoi(record["priority"]));
-        EXPECT_EQ(std::to_string(i * i), record["hash"]);
         EXPECT_EQ(i * 2, std::stoi(record["size"]));
         EXPECT_EQ(i % 2, std::stoi(record["on_disk"]));
     }
 }
 
-TEST_F(DBFixture, DeleteNullTest) {
+TEST_F(DBFixture, DeleteZeroIdTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
+    db.Insert(1, 1, 5, false);
     { 
         std::stringstream stream;
         stream << "SELECT * FROM "
@@ -247,7 +464,7 @@ TEST_F(DBFixture, DeleteNullTest) {
         auto response = execute_(stream.str());
         ASSERT_EQ(1, response.size());
     }
-    db.Delete("");
+    db.Delete(0);
     std::stringstream stream;
     stream << "SELECT * FROM "
            << table_name_
@@ -256,9 +473,9 @@ TEST_F(DBFixture, DeleteNullTest) {
     ASSERT_EQ(1, response.size());
 }
 
-TEST_F(DBFixture, DeleteBadHashTest) {
+TEST_F(DBFixture, DeleteBadIdTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
+    db.Insert(1, 1, 5, false);
     { 
         std::stringstream stream;
         stream << "SELECT * FROM "
@@ -267,7 +484,7 @@ TEST_F(DBFixture, DeleteBadHashTest) {
         auto response = execute_(stream.str());
         ASSERT_EQ(1, response.size());
     }
-    db.Delete("h");
+    db.Delete(99);
     std::stringstream stream;
     stream << "SELECT * FROM "
            << table_name_
@@ -278,7 +495,7 @@ TEST_F(DBFixture, DeleteBadHashTest) {
 
 TEST_F(DBFixture, DeleteSingleTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
+    db.Insert(1, 1, 5, false);
     { 
         std::stringstream stream;
         stream << "SELECT * FROM "
@@ -287,7 +504,7 @@ TEST_F(DBFixture, DeleteSingleTest) {
         auto response = execute_(stream.str());
         ASSERT_EQ(1, response.size());
     }
-    db.Delete("hash");
+    db.Delete(1);
     std::stringstream stream;
     stream << "SELECT * FROM "
            << table_name_
@@ -298,8 +515,8 @@ TEST_F(DBFixture, DeleteSingleTest) {
 
 TEST_F(DBFixture, DeleteCoupleTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
-    db.Insert(2, "hashbrowns", 10, true);
+    db.Insert(1, 1, 5, false);
+    db.Insert(2, 2, 10, true);
     { 
         std::stringstream stream;
         stream << "SELECT * FROM "
@@ -308,8 +525,8 @@ TEST_F(DBFixture, DeleteCoupleTest) {
         auto response = execute_(stream.str());
         ASSERT_EQ(2, response.size());
     }
-    db.Delete("hash");
-    db.Delete("hashbrowns");
+    db.Delete(1);
+    db.Delete(2);
     std::stringstream stream;
     stream << "SELECT * FROM "
            << table_name_
@@ -322,7 +539,7 @@ TEST_F(DBFixture, DeleteManyTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
     auto number_of_records = 100;
     for (int i = 0; i < number_of_records; ++i) {
-        db.Insert(i, std::to_string(i * i), i * 2, i % 2);
+        db.Insert(i, i + 1, i * 2, i % 2);
     }
     {
         std::stringstream stream;
@@ -333,7 +550,7 @@ TEST_F(DBFixture, DeleteManyTest) {
         ASSERT_EQ(number_of_records, response.size());
     }
     for (int i = 0; i < number_of_records; ++i) {
-        db.Delete(std::to_string(i * i));
+        db.Delete(i + 1);
         std::stringstream stream;
         stream << "SELECT * FROM "
                << table_name_
@@ -343,9 +560,9 @@ TEST_F(DBFixture, DeleteManyTest) {
     }
 }
 
-TEST_F(DBFixture, UpdateNullTest) {
+TEST_F(DBFixture, UpdateZeroIdTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
+    db.Insert(1, 1, 5, false);
     { 
         std::stringstream stream;
         stream << "SELECT * FROM "
@@ -354,7 +571,7 @@ TEST_F(DBFixture, UpdateNullTest) {
         auto response = execute_(stream.str());
         ASSERT_EQ(1, response.size());
     }
-    db.Update("", true);
+    db.Update(0, true);
     std::stringstream stream;
     stream << "SELECT * FROM "
            << table_name_
@@ -362,17 +579,16 @@ TEST_F(DBFixture, UpdateNullTest) {
     auto response = execute_(stream.str());
     ASSERT_EQ(1, response.size());
     auto record = response[0];
-    ASSERT_EQ(5, record.size());
+    ASSERT_EQ(6, record.size());
     EXPECT_EQ(1, std::stoi(record["id"]));
     EXPECT_EQ(1, std::stoi(record["priority"]));
-    EXPECT_EQ(std::string{"hash"}, record["hash"]);
     EXPECT_EQ(5, std::stoi(record["size"]));
     EXPECT_EQ(false, std::stoi(record["on_disk"]));
 }
 
-TEST_F(DBFixture, UpdateBadHashTest) {
+TEST_F(DBFixture, UpdateBadIdTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
+    db.Insert(1, 1, 5, false);
     { 
         std::stringstream stream;
         stream << "SELECT * FROM "
@@ -381,7 +597,7 @@ TEST_F(DBFixture, UpdateBadHashTest) {
         auto response = execute_(stream.str());
         ASSERT_EQ(1, response.size());
     }
-    db.Update("h", true);
+    db.Update(99, true);
     std::stringstream stream;
     stream << "SELECT * FROM "
            << table_name_
@@ -389,17 +605,16 @@ TEST_F(DBFixture, UpdateBadHashTest) {
     auto response = execute_(stream.str());
     ASSERT_EQ(1, response.size());
     auto record = response[0];
-    ASSERT_EQ(5, record.size());
+    ASSERT_EQ(6, record.size());
     EXPECT_EQ(1, std::stoi(record["id"]));
     EXPECT_EQ(1, std::stoi(record["priority"]));
-    EXPECT_EQ(std::string{"hash"}, record["hash"]);
     EXPECT_EQ(5, std::stoi(record["size"]));
     EXPECT_EQ(false, std::stoi(record["on_disk"]));
 }
 
 TEST_F(DBFixture, UpdateSingleFalseToTrueTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
+    db.Insert(1, 1, 5, false);
     { 
         std::stringstream stream;
         stream << "SELECT * FROM "
@@ -408,7 +623,7 @@ TEST_F(DBFixture, UpdateSingleFalseToTrueTest) {
         auto response = execute_(stream.str());
         ASSERT_EQ(1, response.size());
     }
-    db.Update("hash", true);
+    db.Update(1, true);
     std::stringstream stream;
     stream << "SELECT * FROM "
            << table_name_
@@ -416,17 +631,16 @@ TEST_F(DBFixture, UpdateSingleFalseToTrueTest) {
     auto response = execute_(stream.str());
     ASSERT_EQ(1, response.size());
     auto record = response[0];
-    ASSERT_EQ(5, record.size());
+    ASSERT_EQ(6, record.size());
     EXPECT_EQ(1, std::stoi(record["id"]));
     EXPECT_EQ(1, std::stoi(record["priority"]));
-    EXPECT_EQ(std::string{"hash"}, record["hash"]);
     EXPECT_EQ(5, std::stoi(record["size"]));
     EXPECT_EQ(true, std::stoi(record["on_disk"]));
 }
 
 TEST_F(DBFixture, UpdateSingleTrueToFalseTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, true);
+    db.Insert(1, 1, 5, true);
     { 
         std::stringstream stream;
         stream << "SELECT * FROM "
@@ -435,7 +649,7 @@ TEST_F(DBFixture, UpdateSingleTrueToFalseTest) {
         auto response = execute_(stream.str());
         ASSERT_EQ(1, response.size());
     }
-    db.Update("hash", false);
+    db.Update(1, false);
     std::stringstream stream;
     stream << "SELECT * FROM "
            << table_name_
@@ -443,17 +657,16 @@ TEST_F(DBFixture, UpdateSingleTrueToFalseTest) {
     auto response = execute_(stream.str());
     ASSERT_EQ(1, response.size());
     auto record = response[0];
-    ASSERT_EQ(5, record.size());
+    ASSERT_EQ(6, record.size());
     EXPECT_EQ(1, std::stoi(record["id"]));
     EXPECT_EQ(1, std::stoi(record["priority"]));
-    EXPECT_EQ(std::string{"hash"}, record["hash"]);
     EXPECT_EQ(5, std::stoi(record["size"]));
     EXPECT_EQ(false, std::stoi(record["on_disk"]));
 }
 
 TEST_F(DBFixture, UpdateSingleFalseToFalseTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
+    db.Insert(1, 1, 5, false);
     { 
         std::stringstream stream;
         stream << "SELECT * FROM "
@@ -462,7 +675,7 @@ TEST_F(DBFixture, UpdateSingleFalseToFalseTest) {
         auto response = execute_(stream.str());
         ASSERT_EQ(1, response.size());
     }
-    db.Update("hash", false);
+    db.Update(1, false);
     std::stringstream stream;
     stream << "SELECT * FROM "
            << table_name_
@@ -470,17 +683,16 @@ TEST_F(DBFixture, UpdateSingleFalseToFalseTest) {
     auto response = execute_(stream.str());
     ASSERT_EQ(1, response.size());
     auto record = response[0];
-    ASSERT_EQ(5, record.size());
+    ASSERT_EQ(6, record.size());
     EXPECT_EQ(1, std::stoi(record["id"]));
     EXPECT_EQ(1, std::stoi(record["priority"]));
-    EXPECT_EQ(std::string{"hash"}, record["hash"]);
     EXPECT_EQ(5, std::stoi(record["size"]));
     EXPECT_EQ(false, std::stoi(record["on_disk"]));
 }
 
 TEST_F(DBFixture, UpdateSingleTrueToTrueTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, true);
+    db.Insert(1, 1, 5, true);
     { 
         std::stringstream stream;
         stream << "SELECT * FROM "
@@ -489,7 +701,7 @@ TEST_F(DBFixture, UpdateSingleTrueToTrueTest) {
         auto response = execute_(stream.str());
         ASSERT_EQ(1, response.size());
     }
-    db.Update("hash", true);
+    db.Update(1, true);
     std::stringstream stream;
     stream << "SELECT * FROM "
            << table_name_
@@ -497,18 +709,17 @@ TEST_F(DBFixture, UpdateSingleTrueToTrueTest) {
     auto response = execute_(stream.str());
     ASSERT_EQ(1, response.size());
     auto record = response[0];
-    ASSERT_EQ(5, record.size());
+    ASSERT_EQ(6, record.size());
     EXPECT_EQ(1, std::stoi(record["id"]));
     EXPECT_EQ(1, std::stoi(record["priority"]));
-    EXPECT_EQ(std::string{"hash"}, record["hash"]);
     EXPECT_EQ(5, std::stoi(record["size"]));
     EXPECT_EQ(true, std::stoi(record["on_disk"]));
 }
 
 TEST_F(DBFixture, UpdateCoupleTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
-    db.Insert(3, "hashbrowns", 10, true);
+    db.Insert(1, 1, 5, false);
+    db.Insert(3, 2, 10, true);
     { 
         std::stringstream stream;
         stream << "SELECT * FROM "
@@ -517,8 +728,8 @@ TEST_F(DBFixture, UpdateCoupleTest) {
         auto response = execute_(stream.str());
         ASSERT_EQ(2, response.size());
     }
-    db.Update("hash", true);
-    db.Update("hashbrowns", false);
+    db.Update(1, true);
+    db.Update(2, false);
     std::stringstream stream;
     stream << "SELECT * FROM "
            << table_name_
@@ -527,19 +738,17 @@ TEST_F(DBFixture, UpdateCoupleTest) {
     ASSERT_EQ(2, response.size());
     {
         auto record = response[0];
-        ASSERT_EQ(5, record.size());
+        ASSERT_EQ(6, record.size());
         EXPECT_EQ(1, std::stoi(record["id"]));
         EXPECT_EQ(1, std::stoi(record["priority"]));
-        EXPECT_EQ(std::string{"hash"}, record["hash"]);
         EXPECT_EQ(5, std::stoi(record["size"]));
         EXPECT_EQ(true, std::stoi(record["on_disk"]));
     }
     {
         auto record = response[1];
-        ASSERT_EQ(5, record.size());
+        ASSERT_EQ(6, record.size());
         EXPECT_EQ(2, std::stoi(record["id"]));
         EXPECT_EQ(3, std::stoi(record["priority"]));
-        EXPECT_EQ(std::string{"hashbrowns"}, record["hash"]);
         EXPECT_EQ(10, std::stoi(record["size"]));
         EXPECT_EQ(false, std::stoi(record["on_disk"]));
     }
@@ -549,8 +758,8 @@ TEST_F(DBFixture, UpdateManyTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
     auto number_of_records = 100;
     for (int i = 0; i < number_of_records; ++i) {
-        db.Insert(i, std::to_string(i * i), i * 2, i % 2);
-        db.Update(std::to_string(i * i), (i + 1) % 2);
+        db.Insert(i, i + 1, i * 2, i % 2);
+        db.Update(i + 1, (i + 1) % 2);
     }
     std::stringstream stream;
     stream << "SELECT * FROM "
@@ -560,511 +769,569 @@ TEST_F(DBFixture, UpdateManyTest) {
     ASSERT_EQ(number_of_records, response.size());
     for (int i = 0; i < number_of_records; ++i) {
         auto record = response[i];
-        ASSERT_EQ(5, record.size());
+        ASSERT_EQ(6, record.size());
         EXPECT_EQ(i + 1, std::stoi(record["id"]));
         EXPECT_EQ(i, std::stoi(record["priority"]));
-        EXPECT_EQ(std::to_string(i * i), record["hash"]);
         EXPECT_EQ(i * 2, std::stoi(record["size"]));
         EXPECT_EQ((i + 1) % 2, std::stoi(record["on_disk"]));
     }
 }
 
-TEST_F(DBFixture, HighestHashNoneFalseOnDiskTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(0, response.size());
+TEST_P(IndexFixture, HighestIdNoneFalseOnDiskTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    check_records_(0);
     bool on_disk = false;
-    EXPECT_TRUE(db.GetHighestHash(on_disk).empty());
+    EXPECT_EQ(0, db.GetHighestId(on_disk));
     EXPECT_FALSE(on_disk);
 }
 
-TEST_F(DBFixture, HighestHashNoneTrueOnDiskTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(0, response.size());
+TEST_P(IndexFixture, HighestIdNoneTrueOnDiskTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    check_records_(0);
     bool on_disk = true;
-    EXPECT_TRUE(db.GetHighestHash(on_disk).empty());
+    EXPECT_EQ(0, db.GetHighestId(on_disk));
     EXPECT_TRUE(on_disk);
 }
 
-TEST_F(DBFixture, HighestHashSingleInMemoryTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(1, response.size());
+TEST_P(IndexFixture, HighestIdSingleInMemoryTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
+    check_records_(1);
     {
         bool on_disk = true;
-        EXPECT_EQ(std::string{"hash"}, db.GetHighestHash(on_disk));
+        EXPECT_EQ(1, db.GetHighestId(on_disk));
         EXPECT_FALSE(on_disk);
     }
     {
         bool on_disk = false;
-        EXPECT_EQ(std::string{"hash"}, db.GetHighestHash(on_disk));
+        EXPECT_EQ(1, db.GetHighestId(on_disk));
         EXPECT_FALSE(on_disk);
     }
 }
 
-TEST_F(DBFixture, HighestHashSingleOnDiskTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, true);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(1, response.size());
+TEST_P(IndexFixture, HighestIdSingleOnDiskTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, true);
+    check_records_(1);
     {
         bool on_disk = true;
-        EXPECT_EQ(std::string{"hash"}, db.GetHighestHash(on_disk));
+        EXPECT_EQ(1, db.GetHighestId(on_disk));
         EXPECT_TRUE(on_disk);
     }
     {
         bool on_disk = false;
-        EXPECT_EQ(std::string{"hash"}, db.GetHighestHash(on_disk));
+        EXPECT_EQ(1, db.GetHighestId(on_disk));
         EXPECT_TRUE(on_disk);
     }
 }
 
-TEST_F(DBFixture, HighestHashCoupleInMemoryTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, true);
-    db.Insert(3, "hashbrowns", 10, false);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(2, response.size());
+TEST_P(IndexFixture, HighestIdCoupleInMemoryTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, true);
+    db.Insert(3, 2, 10, false);
+    check_records_(2);
     bool on_disk;
-    EXPECT_EQ(std::string{"hashbrowns"}, db.GetHighestHash(on_disk));
+    EXPECT_EQ(2, db.GetHighestId(on_disk));
     EXPECT_FALSE(on_disk);
 }
 
-TEST_F(DBFixture, HighestHashCoupleOnDiskTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
-    db.Insert(3, "hashbrowns", 10, true);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(2, response.size());
+TEST_P(IndexFixture, HighestIdCoupleOnDiskTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
+    db.Insert(3, 2, 10, true);
+    check_records_(2);
     bool on_disk;
-    EXPECT_EQ(std::string{"hashbrowns"}, db.GetHighestHash(on_disk));
+    EXPECT_EQ(2, db.GetHighestId(on_disk));
     EXPECT_TRUE(on_disk);
 }
 
-TEST_F(DBFixture, HighestHashCoupleTiedTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, true);
-    db.Insert(1, "hashbrowns", 10, false);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(2, response.size());
+TEST_P(IndexFixture, HighestIdCoupleTiedTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, true);
+    db.Insert(1, 2, 10, false);
+    check_records_(2);
     bool on_disk;
-    EXPECT_EQ(std::string{"hashbrowns"}, db.GetHighestHash(on_disk));
+    EXPECT_EQ(2, db.GetHighestId(on_disk));
     EXPECT_FALSE(on_disk);
 }
 
-TEST_F(DBFixture, HighestHashCoupleTiedAgainTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
-    db.Insert(1, "hashbrowns", 10, true);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(2, response.size());
+TEST_P(IndexFixture, HighestIdCoupleTiedAgainTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
+    db.Insert(1, 2, 10, true);
+    check_records_(2);
     bool on_disk;
-    EXPECT_EQ(std::string{"hash"}, db.GetHighestHash(on_disk));
+    EXPECT_EQ(1, db.GetHighestId(on_disk));
     EXPECT_FALSE(on_disk);
 }
 
-TEST_F(DBFixture, HighestHashManyInMemoryTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+TEST_P(IndexFixture, HighestIdManyInMemoryTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
     auto number_of_records = 100;
     for (int i = 0; i < number_of_records; ++i) {
-        db.Insert(i, std::to_string(i * i), i * 2, (i + 1) % 2);
+        db.Insert(i, i + 1, i * 2, (i + 1) % 2);
     }
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(number_of_records, response.size());
+    check_records_(number_of_records);
     bool on_disk;
-    EXPECT_EQ(std::to_string(99 * 99), db.GetHighestHash(on_disk));
+    EXPECT_EQ(100, db.GetHighestId(on_disk));
     EXPECT_FALSE(on_disk);
 }
 
-TEST_F(DBFixture, HighestHashManyOnDiskTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+TEST_P(IndexFixture, HighestIdManyOnDiskTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
     auto number_of_records = 100;
     for (int i = 0; i < number_of_records; ++i) {
-        db.Insert(i, std::to_string(i * i), i * 2, i % 2);
+        db.Insert(i, i + 1, i * 2, i % 2);
     }
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(number_of_records, response.size());
+    check_records_(number_of_records);
     bool on_disk;
-    EXPECT_EQ(std::to_string(99 * 99), db.GetHighestHash(on_disk));
+    EXPECT_EQ(100, db.GetHighestId(on_disk));
     EXPECT_TRUE(on_disk);
 }
 
-TEST_F(DBFixture, LowestMemoryHashNoneTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(0, response.size());
-    EXPECT_TRUE(db.GetLowestMemoryHash().empty());
+TEST_P(IndexFixture, LowestMemoryIdNoneTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    check_records_(0);
+    EXPECT_EQ(0, db.GetLowestMemoryId());
 }
 
-TEST_F(DBFixture, LowestMemoryHashNoneAgainTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, true);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(1, response.size());
-    EXPECT_TRUE(db.GetLowestMemoryHash().empty());
+TEST_P(IndexFixture, LowestMemoryIdNoneAgainTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, true);
+    check_records_(1);
+    EXPECT_EQ(0, db.GetLowestMemoryId());
 }
 
-TEST_F(DBFixture, LowestMemoryHashSingleTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(1, response.size());
-    EXPECT_EQ(std::string{"hash"}, db.GetLowestMemoryHash());
+TEST_P(IndexFixture, LowestMemoryIdSingleTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
+    check_records_(1);
+    EXPECT_EQ(1, db.GetLowestMemoryId());
 }
 
-TEST_F(DBFixture, LowestMemoryHashCoupleATest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
-    db.Insert(3, "hashbrowns", 10, true);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(2, response.size());
-    EXPECT_EQ(std::string{"hash"}, db.GetLowestMemoryHash());
+TEST_P(IndexFixture, LowestMemoryIdCoupleATest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
+    db.Insert(3, 2, 10, true);
+    check_records_(2);
+    EXPECT_EQ(1, db.GetLowestMemoryId());
 }
 
-TEST_F(DBFixture, LowestMemoryHashCoupleBTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, true);
-    db.Insert(3, "hashbrowns", 10, false);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(2, response.size());
-    EXPECT_EQ(std::string{"hashbrowns"}, db.GetLowestMemoryHash());
+TEST_P(IndexFixture, LowestMemoryIdCoupleBTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, true);
+    db.Insert(3, 2, 10, false);
+    check_records_(2);
+    EXPECT_EQ(2, db.GetLowestMemoryId());
 }
 
-TEST_F(DBFixture, LowestMemoryHashCoupleCTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
-    db.Insert(3, "hashbrowns", 10, false);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(2, response.size());
-    EXPECT_EQ(std::string{"hash"}, db.GetLowestMemoryHash());
+TEST_P(IndexFixture, LowestMemoryIdCoupleCTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
+    db.Insert(3, 2, 10, false);
+    check_records_(2);
+    EXPECT_EQ(1, db.GetLowestMemoryId());
 }
 
-TEST_F(DBFixture, LowestMemoryHashCoupleDTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(3, "hash", 5, false);
-    db.Insert(1, "hashbrowns", 10, false);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(2, response.size());
-    EXPECT_EQ(std::string{"hashbrowns"}, db.GetLowestMemoryHash());
+TEST_P(IndexFixture, LowestMemoryIdCoupleDTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(3, 1, 5, false);
+    db.Insert(1, 2, 10, false);
+    check_records_(2);
+    EXPECT_EQ(2, db.GetLowestMemoryId());
 }
 
-TEST_F(DBFixture, LowestMemoryHashCoupleETest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, true);
-    db.Insert(3, "hashbrowns", 10, true);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(2, response.size());
-    EXPECT_TRUE(db.GetLowestMemoryHash().empty());
+TEST_P(IndexFixture, LowestMemoryIdCoupleETest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, true);
+    db.Insert(3, 2, 10, true);
+    check_records_(2);
+    EXPECT_EQ(0, db.GetLowestMemoryId());
 }
 
-TEST_F(DBFixture, LowestMemoryHashManyATest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+TEST_P(IndexFixture, LowestMemoryIdManyATest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
     auto number_of_records = 100;
     for (int i = 0; i < number_of_records; ++i) {
-        db.Insert(i, std::to_string(i * i), i * 2, i % 2);
+        db.Insert(i, i + 1, i * 2, i % 2);
     }
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(number_of_records, response.size());
-    EXPECT_EQ(std::to_string(0), db.GetLowestMemoryHash());
+    check_records_(number_of_records);
+    EXPECT_EQ(1, db.GetLowestMemoryId());
 }
 
-TEST_F(DBFixture, LowestMemoryHashManyBTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+TEST_P(IndexFixture, LowestMemoryIdManyBTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
     auto number_of_records = 100;
     for (int i = 0; i < number_of_records; ++i) {
-        db.Insert(i, std::to_string(i * i), i * 2, (i + 1) % 2);
+        db.Insert(i, i + 1, i * 2, (i + 1) % 2);
     }
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(number_of_records, response.size());
-    EXPECT_EQ(std::to_string(1), db.GetLowestMemoryHash());
+    check_records_(number_of_records);
+    EXPECT_EQ(2, db.GetLowestMemoryId());
 }
 
-TEST_F(DBFixture, LowestDiskHashNoneTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(0, response.size());
-    EXPECT_TRUE(db.GetLowestDiskHash().empty());
+TEST_P(IndexFixture, LowestDiskIdNoneTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    check_records_(0);
+    EXPECT_EQ(0, db.GetLowestDiskId());
 }
 
-TEST_F(DBFixture, LowestDiskHashNoneAgainTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(1, response.size());
-    EXPECT_TRUE(db.GetLowestDiskHash().empty());
+TEST_P(IndexFixture, LowestDiskIdNoneAgainTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
+    check_records_(1);
+    EXPECT_EQ(0, db.GetLowestDiskId());
 }
 
-TEST_F(DBFixture, LowestDiskHashSingleTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, true);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(1, response.size());
-    EXPECT_EQ(std::string{"hash"}, db.GetLowestDiskHash());
+TEST_P(IndexFixture, LowestDiskIdSingleTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, true);
+    check_records_(1);
+    EXPECT_EQ(1, db.GetLowestDiskId());
 }
 
-TEST_F(DBFixture, LowestDiskHashCoupleATest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, true);
-    db.Insert(3, "hashbrowns", 10, false);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(2, response.size());
-    EXPECT_EQ(std::string{"hash"}, db.GetLowestDiskHash());
+TEST_P(IndexFixture, LowestDiskIdCoupleATest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, true);
+    db.Insert(3, 2, 10, false);
+    check_records_(2);
+    EXPECT_EQ(1, db.GetLowestDiskId());
 }
 
-TEST_F(DBFixture, LowestDiskHashCoupleBTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
-    db.Insert(3, "hashbrowns", 10, true);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(2, response.size());
-    EXPECT_EQ(std::string{"hashbrowns"}, db.GetLowestDiskHash());
+TEST_P(IndexFixture, LowestDiskIdCoupleBTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
+    db.Insert(3, 2, 10, true);
+    check_records_(2);
+    EXPECT_EQ(2, db.GetLowestDiskId());
 }
 
-TEST_F(DBFixture, LowestDiskHashCoupleCTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, true);
-    db.Insert(3, "hashbrowns", 10, true);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(2, response.size());
-    EXPECT_EQ(std::string{"hash"}, db.GetLowestDiskHash());
+TEST_P(IndexFixture, LowestDiskIdCoupleCTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, true);
+    db.Insert(3, 2, 10, true);
+    check_records_(2);
+    EXPECT_EQ(1, db.GetLowestDiskId());
 }
 
-TEST_F(DBFixture, LowestDiskHashCoupleDTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(3, "hash", 5, true);
-    db.Insert(1, "hashbrowns", 10, true);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(2, response.size());
-    EXPECT_EQ(std::string{"hashbrowns"}, db.GetLowestDiskHash());
+TEST_P(IndexFixture, LowestDiskIdCoupleDTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(3, 1, 5, true);
+    db.Insert(1, 2, 10, true);
+    check_records_(2);
+    EXPECT_EQ(2, db.GetLowestDiskId());
 }
 
-TEST_F(DBFixture, LowestDiskHashCoupleETest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
-    db.Insert(3, "hashbrowns", 10, false);
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(2, response.size());
-    EXPECT_TRUE(db.GetLowestDiskHash().empty());
+TEST_P(IndexFixture, LowestDiskIdCoupleETest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
+    db.Insert(3, 2, 10, false);
+    check_records_(2);
+    EXPECT_EQ(0, db.GetLowestDiskId());
 }
 
-TEST_F(DBFixture, LowestDiskHashManyATest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+TEST_P(IndexFixture, LowestDiskIdManyATest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
     auto number_of_records = 100;
     for (int i = 0; i < number_of_records; ++i) {
-        db.Insert(i, std::to_string(i * i), i * 2, i % 2);
+        db.Insert(i, i + 1, i * 2, i % 2);
     }
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(number_of_records, response.size());
-    EXPECT_EQ(std::to_string(1), db.GetLowestDiskHash());
+    check_records_(number_of_records);
+    EXPECT_EQ(2, db.GetLowestDiskId());
 }
 
-TEST_F(DBFixture, LowestDiskHashManyBTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+TEST_P(IndexFixture, LowestDiskIdManyBTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
     auto number_of_records = 100;
     for (int i = 0; i < number_of_records; ++i) {
-        db.Insert(i, std::to_string(i * i), i * 2, (i + 1) % 2);
+        db.Insert(i, i + 1, i * 2, (i + 1) % 2);
     }
-    std::stringstream stream;
-    stream << "SELECT * FROM "
-           << table_name_
-           << ";";
-    auto response = execute_(stream.str());
-    ASSERT_EQ(number_of_records, response.size());
-    EXPECT_EQ(std::to_string(0), db.GetLowestDiskHash());
+    check_records_(number_of_records);
+    EXPECT_EQ(1, db.GetLowestDiskId());
+}
+
+TEST_P(IndexFixture, SetLocationTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
+    PriorityLocation location;
+    location.segment = 2;
+    location.offset = 100;
+    location.length = 7;
+    db.SetLocation(1, location);
+    EXPECT_EQ(1, db.GetDiskLength());
+    EXPECT_EQ(7, db.GetDiskSize());
+    EXPECT_EQ(1, db.GetLowestDiskId());
+    EXPECT_EQ(0, db.GetLowestMemoryId());
+
+    PriorityLocation stored;
+    ASSERT_TRUE(db.GetLocation(1, stored));
+    EXPECT_EQ(2, stored.segment);
+    EXPECT_EQ(100, stored.offset);
+    EXPECT_EQ(7, stored.length);
+}
+
+TEST_P(IndexFixture, SetLocationMoveTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, true);
+    PriorityLocation location;
+    location.segment = 3;
+    location.length = 4;
+    db.SetLocation(1, location);
+    EXPECT_EQ(1, db.GetDiskLength());
+    EXPECT_EQ(4, db.GetDiskSize());
 }
 
-TEST_F(DBFixture, FullEmptyTest) { // Yeah this test name is silly
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+TEST_P(IndexFixture, SetLocationBadIdTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    PriorityLocation location;
+    location.segment = 1;
+    location.length = 4;
+    db.SetLocation(99, location);
+    EXPECT_EQ(0, db.GetDiskLength());
+    EXPECT_EQ(0, db.GetDiskSize());
+    EXPECT_FALSE(db.GetLocation(99, location));
+}
+
+TEST_P(IndexFixture, SetLocationRollbackTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
+    {
+        PriorityDBTransaction transaction{db};
+        PriorityLocation location;
+        location.segment = 1;
+        location.length = 5;
+        db.SetLocation(1, location);
+    }
+    PriorityLocation location;
+    EXPECT_FALSE(db.GetLocation(1, location));
+    EXPECT_EQ(0, db.GetDiskLength());
+    EXPECT_EQ(0, db.GetDiskSize());
+}
+
+TEST_P(IndexFixture, GetLocationMemoryTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
+    PriorityLocation location;
+    EXPECT_FALSE(db.GetLocation(1, location));
+}
+
+TEST_P(IndexFixture, UpdateClearsLocationTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
+    PriorityLocation location;
+    location.segment = 2;
+    location.offset = 10;
+    location.length = 5;
+    db.SetLocation(1, location);
+    db.Update(1, false);
+    db.Update(1, true);
+    ASSERT_TRUE(db.GetLocation(1, location));
+    EXPECT_EQ(0, location.segment);
+    EXPECT_EQ(0, location.offset);
+    EXPECT_TRUE(db.GetSegmentIds(2).empty());
+}
+
+TEST_P(IndexFixture, GetSegmentIdsTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    for (int i = 0; i < 6; ++i) {
+        db.Insert(i, i + 1, 5, false);
+        PriorityLocation location;
+        location.segment = i % 2 + 1;
+        location.offset = i * 5;
+        location.length = 5;
+        db.SetLocation(i + 1, location);
+    }
+    db.Delete(3);
+    auto ids = db.GetSegmentIds(1);
+    std::sort(ids.begin(), ids.end());
+    ASSERT_EQ(2, ids.size());
+    EXPECT_EQ(1, ids[0]);
+    EXPECT_EQ(5, ids[1]);
+    EXPECT_EQ(3, db.GetSegmentIds(2).size());
+    EXPECT_TRUE(db.GetSegmentIds(0).empty());
+}
+
+TEST_P(IndexFixture, GetSegmentSizesTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, true);
+    for (int i = 0; i < 3; ++i) {
+        db.Insert(i, i + 2, 0, false);
+        PriorityLocation location;
+        location.segment = i == 2 ? 4 : 3;
+        location.length = 10 + i;
+        db.SetLocation(i + 2, location);
+    }
+    auto sizes = db.GetSegmentSizes();
+    ASSERT_EQ(2, sizes.size());
+    EXPECT_EQ(21, sizes[3]);
+    EXPECT_EQ(12, sizes[4]);
+}
+
+TEST_P(IndexFixture, GetHighestPriorityTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    unsigned long long priority = 42;
+    EXPECT_FALSE(db.GetHighestPriority(priority));
+    EXPECT_EQ(42, priority);
+
+    db.Insert(5, 1, 1, false);
+    db.Insert(9, 2, 1, true);
+    db.Insert(7, 3, 1, false);
+    ASSERT_TRUE(db.GetHighestPriority(priority));
+    EXPECT_EQ(9, priority);
+    db.Delete(2);
+    ASSERT_TRUE(db.GetHighestPriority(priority));
+    EXPECT_EQ(7, priority);
+    db.Delete(1);
+    db.Delete(3);
+    EXPECT_FALSE(db.GetHighestPriority(priority));
+}
+
+TEST_P(IndexFixture, GetLowestPriorityTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    unsigned long long priority = 42;
+    EXPECT_FALSE(db.GetLowestPriority(false, priority));
+    EXPECT_FALSE(db.GetLowestPriority(true, priority));
+    EXPECT_EQ(42, priority);
+
+    db.Insert(5, 1, 1, false);
+    db.Insert(9, 2, 1, true);
+    db.Insert(3, 3, 1, false);
+    db.Insert(7, 4, 1, true);
+    ASSERT_TRUE(db.GetLowestPriority(false, priority));
+    EXPECT_EQ(3, priority);
+    ASSERT_TRUE(db.GetLowestPriority(true, priority));
+    EXPECT_EQ(7, priority);
+    db.Update(3, true);
+    ASSERT_TRUE(db.GetLowestPriority(false, priority));
+    EXPECT_EQ(5, priority);
+    ASSERT_TRUE(db.GetLowestPriority(true, priority));
+    EXPECT_EQ(3, priority);
+    db.Delete(1);
+    EXPECT_FALSE(db.GetLowestPriority(false, priority));
+}
+
+TEST_P(IndexFixture, SetLocationReopenTest) {
+    {
+        PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+        db.Insert(1, 1, 5, false);
+        PriorityLocation location;
+        location.segment = 2;
+        location.offset = 100;
+        location.length = 7;
+        db.SetLocation(1, location);
+    }
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    PriorityLocation location;
+    ASSERT_TRUE(db.GetLocation(1, location));
+    EXPECT_EQ(2, location.segment);
+    EXPECT_EQ(100, location.offset);
+    EXPECT_EQ(7, location.length);
+    EXPECT_EQ(7, db.GetDiskSize());
+}
+
+TEST_P(IndexFixture, HighestDiskIdEmptyTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    EXPECT_EQ(0, db.GetHighestDiskId(1));
+}
+
+TEST_P(IndexFixture, HighestDiskIdInMemoryTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
+    EXPECT_EQ(0, db.GetHighestDiskId(1));
+}
+
+TEST_P(IndexFixture, HighestDiskIdDepthTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(5, 1, 5, true);
+    db.Insert(3, 2, 5, true);
+    db.Insert(7, 3, 5, false);
+    db.Insert(5, 4, 5, false);
+    db.Insert(1, 5, 5, false);
+    EXPECT_EQ(0, db.GetHighestDiskId(0));
+    EXPECT_EQ(0, db.GetHighestDiskId(2));
+    EXPECT_EQ(1, db.GetHighestDiskId(3));
+}
+
+TEST_P(IndexFixture, HighestDiskIdTiedTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(5, 1, 5, true);
+    db.Insert(5, 2, 5, true);
+    db.Insert(3, 3, 5, true);
+    EXPECT_EQ(1, db.GetHighestDiskId(1));
+}
+
+TEST_P(IndexFixture, FullEmptyTest) { // Yeah this test name is silly
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
     EXPECT_FALSE(db.Full());
 }
 
-TEST_F(DBFixture, FullInMemoryUnderTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", DEFAULT_MAX_SIZE - 1, false);
+TEST_P(IndexFixture, FullInMemoryUnderTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, DEFAULT_MAX_SIZE - 1, false);
     EXPECT_FALSE(db.Full());
 }
 
-TEST_F(DBFixture, FullInMemoryExactTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", DEFAULT_MAX_SIZE, false);
+TEST_P(IndexFixture, FullInMemoryExactTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, DEFAULT_MAX_SIZE, false);
     EXPECT_FALSE(db.Full());
 }
 
-TEST_F(DBFixture, FullInMemoryOverTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", DEFAULT_MAX_SIZE + 1, false);
+TEST_P(IndexFixture, FullInMemoryOverTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, DEFAULT_MAX_SIZE + 1, false);
     EXPECT_FALSE(db.Full());
 }
 
-TEST_F(DBFixture, FullOnDiskUnderTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", DEFAULT_MAX_SIZE - 1, true);
+TEST_P(IndexFixture, FullOnDiskUnderTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, DEFAULT_MAX_SIZE - 1, true);
     EXPECT_FALSE(db.Full());
 }
 
-TEST_F(DBFixture, FullOnDiskExactTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", DEFAULT_MAX_SIZE, true);
+TEST_P(IndexFixture, FullOnDiskExactTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, DEFAULT_MAX_SIZE, true);
     EXPECT_FALSE(db.Full());
 }
 
-TEST_F(DBFixture, FullOnDiskOverTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", DEFAULT_MAX_SIZE + 1, true);
+TEST_P(IndexFixture, FullOnDiskOverTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, DEFAULT_MAX_SIZE + 1, true);
     EXPECT_TRUE(db.Full());
 }
 
-TEST_F(DBFixture, FullMixedOverCoupleTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", DEFAULT_MAX_SIZE, true);
+TEST_P(IndexFixture, FullMixedOverCoupleTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, DEFAULT_MAX_SIZE, true);
     ASSERT_FALSE(db.Full());
-    db.Insert(3, "hashbrowns", 1, false);
+    db.Insert(3, 2, 1, false);
     EXPECT_FALSE(db.Full());
 }
 
-TEST_F(DBFixture, FullOnDiskOverCoupleTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", DEFAULT_MAX_SIZE, true);
+TEST_P(IndexFixture, FullOnDiskOverCoupleTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, DEFAULT_MAX_SIZE, true);
     ASSERT_FALSE(db.Full());
-    db.Insert(3, "hashbrowns", 1, true);
+    db.Insert(3, 2, 1, true);
     EXPECT_TRUE(db.Full());
 }
 
-TEST_F(DBFixture, FullOnDiskDeleteCoupleTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", DEFAULT_MAX_SIZE, true);
+TEST_P(IndexFixture, FullOnDiskDeleteCoupleTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, DEFAULT_MAX_SIZE, true);
     ASSERT_FALSE(db.Full());
-    db.Insert(3, "hashbrowns", 1, true);
+    db.Insert(3, 2, 1, true);
     ASSERT_TRUE(db.Full());
-    db.Delete("hashbrowns");
+    db.Delete(2);
     EXPECT_FALSE(db.Full());
 }
 
-TEST_F(DBFixture, DeletedDBThrowInsertTest) {
+TEST_F(DBFixture, DroppedTableThrowInsertTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    fs::remove(db_path_);
-    ASSERT_FALSE(fs::exists(db_path_));
+    drop_table_();
     bool thrown = false;
     try {
-        db.Insert(1, "hash", 5, false);
+        db.Insert(1, 1, 5, false);
     } catch (const PriorityDBException& e) {
         thrown = true;
         EXPECT_EQ(std::string{"no such table: prism_data"},
@@ -1073,13 +1340,12 @@ TEST_F(DBFixture, DeletedDBThrowInsertTest) {
     EXPECT_TRUE(thrown);
 }
 
-TEST_F(DBFixture, DeletedDBThrowDeleteTest) {
+TEST_F(DBFixture, DroppedTableThrowDeleteTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    fs::remove(db_path_);
-    ASSERT_FALSE(fs::exists(db_path_));
+    drop_table_();
     bool thrown = false;
     try {
-        db.Delete("hash");
+        db.Delete(1);
     } catch (const PriorityDBException& e) {
         thrown = true;
         EXPECT_EQ(std::string{"no such table: prism_data"},
@@ -1088,13 +1354,12 @@ TEST_F(DBFixture, DeletedDBThrowDeleteTest) {
     EXPECT_TRUE(thrown);
 }
 
-TEST_F(DBFixture, DeletedDBThrowUpdateTest) {
+TEST_F(DBFixture, DroppedTableThrowUpdateTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    fs::remove(db_path_);
-    ASSERT_FALSE(fs::exists(db_path_));
+    drop_table_();
     bool thrown = false;
     try {
-        db.Update("hash", true);
+        db.Update(1, true);
     } catch (const PriorityDBException& e) {
         thrown = true;
         EXPECT_EQ(std::string{"no such table: prism_data"},
@@ -1103,14 +1368,13 @@ TEST_F(DBFixture, DeletedDBThrowUpdateTest) {
     EXPECT_TRUE(thrown);
 }
 
-TEST_F(DBFixture, DeletedDBThrowGetHighestHashTest) {
+TEST_F(DBFixture, DroppedTableThrowGetHighestIdTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    fs::remove(db_path_);
-    ASSERT_FALSE(fs::exists(db_path_));
+    drop_table_();
     bool thrown = false;
     try {
         bool on_disk;
-        db.GetHighestHash(on_disk);
+        db.GetHighestId(on_disk);
     } catch (const PriorityDBException& e) {
         thrown = true;
         EXPECT_EQ(std::string{"no such table: prism_data"},
@@ -1119,13 +1383,12 @@ TEST_F(DBFixture, DeletedDBThrowGetHighestHashTest) {
     EXPECT_TRUE(thrown);
 }
 
-TEST_F(DBFixture, DeletedDBThrowGetLowestMemoryHashTest) {
+TEST_F(DBFixture, DroppedTableThrowGetLowestMemoryIdTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    fs::remove(db_path_);
-    ASSERT_FALSE(fs::exists(db_path_));
+    drop_table_();
     bool thrown = false;
     try {
-        db.GetLowestMemoryHash();
+        db.GetLowestMemoryId();
     } catch (const PriorityDBException& e) {
         thrown = true;
         EXPECT_EQ(std::string{"no such table: prism_data"},
@@ -1134,13 +1397,12 @@ TEST_F(DBFixture, DeletedDBThrowGetLowestMemoryHashTest) {
     EXPECT_TRUE(thrown);
 }
 
-TEST_F(DBFixture, DeletedDBThrowGetLowestDiskashTest) {
+TEST_F(DBFixture, DroppedTableThrowGetLowestDiskIdTest) {
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    fs::remove(db_path_);
-    ASSERT_FALSE(fs::exists(db_path_));
+    drop_table_();
     bool thrown = false;
     try {
-        db.GetLowestDiskHash();
+        db.GetLowestDiskId();
     } catch (const PriorityDBException& e) {
         thrown = true;
         EXPECT_EQ(std::string{"no such table: prism_data"},
@@ -1149,101 +1411,400 @@ TEST_F(DBFixture, DeletedDBThrowGetLowestDiskashTest) {
     EXPECT_TRUE(thrown);
 }
 
-TEST_F(DBFixture, DeletedDBThrowFullTest) {
+TEST_F(DBFixture, DroppedTableNoThrowFullTest) {
+    // Full() is answered from running totals and never touches the table
     PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    fs::remove(db_path_);
-    ASSERT_FALSE(fs::exists(db_path_));
-    bool thrown = false;
-    try {
-        db.Full();
-    } catch (const PriorityDBException& e) {
-        thrown = true;
-        EXPECT_EQ(std::string{"no such table: prism_data"},
-                  std::string{e.what()});
-    }
-    EXPECT_TRUE(thrown);
+    db.Insert(1, 1, DEFAULT_MAX_SIZE + 1, true);
+    drop_table_();
+    EXPECT_TRUE(db.Full());
 }
 
-TEST_F(DBFixture, GetDiskLengthZeroTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+TEST_P(IndexFixture, GetDiskLengthZeroTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
     EXPECT_EQ(0, db.GetDiskLength());
 }
 
-TEST_F(DBFixture, GetDiskLengthStillZeroTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
+TEST_P(IndexFixture, GetDiskLengthStillZeroTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
     EXPECT_EQ(0, db.GetDiskLength());
 }
 
-TEST_F(DBFixture, GetDiskLengthOneTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, true);
+TEST_P(IndexFixture, GetDiskLengthOneTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, true);
     EXPECT_EQ(1, db.GetDiskLength());
 }
 
-TEST_F(DBFixture, GetDiskLengthStillOneTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, true);
-    db.Insert(3, "hashbrowns", 10, false);
+TEST_P(IndexFixture, GetDiskLengthStillOneTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, true);
+    db.Insert(3, 2, 10, false);
     EXPECT_EQ(1, db.GetDiskLength());
 }
 
-TEST_F(DBFixture, GetDiskLengthManyTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+TEST_P(IndexFixture, GetDiskLengthManyTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
     auto number_of_records = 100;
     for (int i = 0; i < number_of_records; ++i) {
-        db.Insert(i, std::to_string(i * i), i * 2, true);
+        db.Insert(i, i + 1, i * 2, true);
     }
     EXPECT_EQ(number_of_records, db.GetDiskLength());
 }
 
-TEST_F(DBFixture, GetDiskLengthManyAlternateTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+TEST_P(IndexFixture, GetDiskLengthManyAlternateTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
     auto number_of_records = 100;
     for (int i = 0; i < number_of_records; ++i) {
-        db.Insert(i, std::to_string(i * i), i * 2, i % 2);
+        db.Insert(i, i + 1, i * 2, i % 2);
     }
     EXPECT_EQ(number_of_records / 2, db.GetDiskLength());
 }
 
-TEST_F(DBFixture, GetDiskSizeZeroTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+TEST_P(IndexFixture, GetDiskSizeZeroTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
     EXPECT_EQ(0, db.GetDiskSize());
 }
 
-TEST_F(DBFixture, GetDiskSizeStillZeroTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, false);
+TEST_P(IndexFixture, GetDiskSizeStillZeroTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
     EXPECT_EQ(0, db.GetDiskSize());
 }
 
-TEST_F(DBFixture, GetDiskSizeOneTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, true);
+TEST_P(IndexFixture, GetDiskSizeOneTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, true);
     EXPECT_EQ(5, db.GetDiskSize());
 }
 
-TEST_F(DBFixture, GetDiskSizeStillOneTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
-    db.Insert(1, "hash", 5, true);
-    db.Insert(3, "hashbrowns", 10, false);
+TEST_P(IndexFixture, GetDiskSizeStillOneTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, true);
+    db.Insert(3, 2, 10, false);
     EXPECT_EQ(5, db.GetDiskSize());
 }
 
-TEST_F(DBFixture, GetDiskSizeManyTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+TEST_P(IndexFixture, GetDiskSizeManyTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
     auto number_of_records = 100;
     for (int i = 0; i < number_of_records; ++i) {
-        db.Insert(i, std::to_string(i * i), i * 2, true);
+        db.Insert(i, i + 1, i * 2, true);
     }
     EXPECT_EQ(99 * number_of_records, db.GetDiskSize());
 }
 
-TEST_F(DBFixture, GetDiskSizeManyAlternateTest) {
-    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+TEST_P(IndexFixture, GetDiskSizeManyAlternateTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
     auto number_of_records = 100;
     for (int i = 0; i < number_of_records; ++i) {
-        db.Insert(i, std::to_string(i * i), i * 2, i % 2);
+        db.Insert(i, i + 1, i * 2, i % 2);
     }
     EXPECT_EQ(100 * number_of_records / 2, db.GetDiskSize());
 }
+
+TEST_P(IndexFixture, GetDiskSizeLargeTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    auto size = 3000000000LL;
+    db.Insert(1, 1, size, true);
+    db.Insert(3, 2, size, true);
+    EXPECT_EQ(2 * size, db.GetDiskSize());
+}
+
+TEST_P(IndexFixture, GetDiskTotalsUpdateTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
+    db.Insert(3, 2, 10, true);
+    ASSERT_EQ(1, db.GetDiskLength());
+    ASSERT_EQ(10, db.GetDiskSize());
+    db.Update(1, true);
+    EXPECT_EQ(2, db.GetDiskLength());
+    EXPECT_EQ(15, db.GetDiskSize());
+    db.Update(1, true);
+    EXPECT_EQ(2, db.GetDiskLength());
+    EXPECT_EQ(15, db.GetDiskSize());
+    db.Update(2, false);
+    EXPECT_EQ(1, db.GetDiskLength());
+    EXPECT_EQ(5, db.GetDiskSize());
+    db.Update(99, false);
+    EXPECT_EQ(1, db.GetDiskLength());
+    EXPECT_EQ(5, db.GetDiskSize());
+}
+
+TEST_P(IndexFixture, GetDiskTotalsDeleteTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, false);
+    db.Insert(3, 2, 10, true);
+    db.Delete(1);
+    EXPECT_EQ(1, db.GetDiskLength());
+    EXPECT_EQ(10, db.GetDiskSize());
+    db.Delete(2);
+    EXPECT_EQ(0, db.GetDiskLength());
+    EXPECT_EQ(0, db.GetDiskSize());
+    db.Delete(2);
+    EXPECT_EQ(0, db.GetDiskLength());
+    EXPECT_EQ(0, db.GetDiskSize());
+}
+
+TEST_P(IndexFixture, GetDiskTotalsReopenTest) {
+    {
+        PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+        db.Insert(1, 1, 5, false);
+        db.Insert(3, 2, 10, true);
+        db.Insert(5, 3, 20, true);
+    }
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    EXPECT_EQ(2, db.GetDiskLength());
+    EXPECT_EQ(30, db.GetDiskSize());
+}
+
+TEST_P(IndexFixture, InsertDuplicateIdThrowTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 1, 5, true);
+    EXPECT_THROW(db.Insert(3, 1, 10, false), PriorityDBException);
+    check_records_(1);
+    EXPECT_EQ(5, db.GetDiskSize());
+}
+
+TEST_P(IndexFixture, GetMaxIdEmptyTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    EXPECT_EQ(0, db.GetMaxId());
+}
+
+TEST_P(IndexFixture, GetMaxIdTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    db.Insert(1, 7, 5, true);
+    db.Insert(3, 2, 10, false);
+    EXPECT_EQ(7, db.GetMaxId());
+}
+
+TEST_P(IndexFixture, GetMaxIdReopenTest) {
+    {
+        PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+        db.Insert(1, 1, 5, true);
+        db.Insert(3, 5, 10, true);
+        db.Delete(5);
+    }
+    {
+        PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+        EXPECT_EQ(5, db.GetMaxId());
+    }
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    EXPECT_EQ(5, db.GetMaxId());
+}
+
+TEST_F(DBFixture, TransactionCommitTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+    std::stringstream stream;
+    stream << "SELECT * FROM "
+           << table_name_
+           << ";";
+    db.Begin();
+    db.Insert(1, 1, 5, true);
+    db.Insert(3, 2, 10, false);
+    db.Commit();
+    EXPECT_EQ(0, execute_(stream.str()).size());
+    EXPECT_EQ(5, db.GetDiskSize());
+    db.Flush();
+    EXPECT_EQ(2, execute_(stream.str()).size());
+    EXPECT_EQ(5, db.GetDiskSize());
+}
+
+TEST_F(DBFixture, TransactionRollbackTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+    db.Insert(1, 1, 5, true);
+    db.Begin();
+    db.Insert(3, 2, 10, true);
+    db.Delete(1);
+    db.Rollback();
+    db.Flush();
+    std::stringstream stream;
+    stream << "SELECT * FROM "
+           << table_name_
+           << ";";
+    auto response = execute_(stream.str());
+    ASSERT_EQ(1, response.size());
+    EXPECT_EQ(1, std::stoi(response[0]["id"]));
+    EXPECT_EQ(1, db.GetDiskLength());
+    EXPECT_EQ(5, db.GetDiskSize());
+}
+
+TEST_F(DBFixture, TransactionGroupTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+    db.Begin();
+    db.Insert(1, 1, 5, true);
+    db.Commit();
+    db.Begin();
+    db.Insert(3, 2, 10, true);
+    db.Rollback();
+    db.Begin();
+    db.Insert(5, 3, 20, true);
+    db.Commit();
+    db.Flush();
+    std::stringstream stream;
+    stream << "SELECT * FROM "
+           << table_name_
+           << ";";
+    auto response = execute_(stream.str());
+    ASSERT_EQ(2, response.size());
+    EXPECT_EQ(1, std::stoi(response[0]["id"]));
+    EXPECT_EQ(3, std::stoi(response[1]["id"]));
+    EXPECT_EQ(2, db.GetDiskLength());
+    EXPECT_EQ(25, db.GetDiskSize());
+}
+
+TEST_F(DBFixture, TransactionNestedRollbackTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+    db.Begin();
+    db.Insert(1, 1, 5, true);
+    db.Begin();
+    db.Insert(3, 2, 10, true);
+    db.Rollback();
+    db.Commit();
+    db.Flush();
+    std::stringstream stream;
+    stream << "SELECT * FROM "
+           << table_name_
+           << ";";
+    EXPECT_EQ(0, execute_(stream.str()).size());
+    EXPECT_EQ(0, db.GetDiskLength());
+    EXPECT_EQ(0, db.GetDiskSize());
+}
+
+TEST_P(IndexFixture, TransactionGuardTest) {
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options_()};
+    {
+        PriorityDBTransaction transaction{db};
+        db.Insert(1, 1, 5, true);
+        transaction.Commit();
+    }
+    {
+        PriorityDBTransaction transaction{db};
+        db.Insert(3, 2, 10, true);
+    }
+    db.Flush();
+    bool on_disk = false;
+    EXPECT_EQ(1, db.GetHighestId(on_disk));
+    EXPECT_EQ(1, db.GetDiskLength());
+}
+
+TEST_F(DBFixture, TransactionFlushOnDestructTest) {
+    {
+        PriorityDB db{DEFAULT_MAX_SIZE, db_string_};
+        db.Begin();
+        db.Insert(1, 1, 5, true);
+        db.Commit();
+    }
+    std::stringstream stream;
+    stream << "SELECT * FROM "
+           << table_name_
+           << ";";
+    EXPECT_EQ(1, execute_(stream.str()).size());
+}
+
+TEST_F(DBFixture, MemoryIndexFilesTest) {
+    PriorityDBOptions options;
+    options.backend = PriorityDBOptions::Backend::MEMORY;
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options};
+    EXPECT_FALSE(fs::exists(db_path_));
+    EXPECT_TRUE(fs::exists(fs::path{db_string_ + "-index"}));
+}
+
+TEST_F(DBFixture, MemoryIndexReopenTest) {
+    PriorityDBOptions options;
+    options.backend = PriorityDBOptions::Backend::MEMORY;
+    {
+        PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options};
+        db.Insert(1, 1, 5, true);
+        db.Insert(3, 2, 10, false);
+        db.Insert(5, 3, 20, true);
+        db.Insert(7, 4, 40, true);
+        db.Update(3, false);
+        db.Update(2, true);
+        db.Delete(4);
+    }
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options};
+    bool on_disk = false;
+    EXPECT_EQ(2, db.GetHighestId(on_disk));
+    EXPECT_TRUE(on_disk);
+    EXPECT_EQ(1, db.GetLowestDiskId());
+    EXPECT_EQ(0, db.GetLowestMemoryId());
+    EXPECT_EQ(2, db.GetDiskLength());
+    EXPECT_EQ(15, db.GetDiskSize());
+}
+
+TEST_F(DBFixture, MemoryIndexRollbackTest) {
+    PriorityDBOptions options;
+    options.backend = PriorityDBOptions::Backend::MEMORY;
+    {
+        PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options};
+        db.Insert(1, 1, 5, true);
+        db.Begin();
+        db.Insert(3, 2, 10, true);
+        db.Delete(1);
+        db.Rollback();
+        db.Flush();
+        bool on_disk = false;
+        EXPECT_EQ(1, db.GetHighestId(on_disk));
+        EXPECT_EQ(1, db.GetDiskLength());
+        EXPECT_EQ(5, db.GetDiskSize());
+    }
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options};
+    bool on_disk = false;
+    EXPECT_EQ(1, db.GetHighestId(on_disk));
+    EXPECT_EQ(1, db.GetDiskLength());
+}
+
+TEST_F(DBFixture, MemoryIndexCompactTest) {
+    PriorityDBOptions options;
+    options.backend = PriorityDBOptions::Backend::MEMORY;
+    auto index_path = db_string_ + "-index";
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options};
+    db.Insert(1, 1, 5, true);
+    db.Flush();
+    for (int i = 0; i < 2000; ++i) {
+        db.Insert(i, i + 2, 1, true);
+        db.Flush();
+        db.Delete(i + 2);
+        db.Flush();
+    }
+    std::ifstream stream{index_path};
+    auto lines = std::count(std::istreambuf_iterator<char>(stream),
+                            std::istreambuf_iterator<char>(), '\n');
+    EXPECT_GT(1100, lines);
+    EXPECT_EQ(1, db.GetDiskLength());
+}
+
+TEST_F(DBFixture, MemoryIndexTruncatedJournalTest) {
+    PriorityDBOptions options;
+    options.backend = PriorityDBOptions::Backend::MEMORY;
+    {
+        PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options};
+        db.Insert(1, 1, 5, true);
+    }
+    {
+        std::ofstream stream{db_string_ + "-index", std::ios::app};
+        stream << "+ 3 10 2";
+    }
+    PriorityDB db{DEFAULT_MAX_SIZE, db_string_, options};
+    EXPECT_EQ(1, db.GetDiskLength());
+    EXPECT_EQ(1, db.GetLowestDiskId());
+}
+
+TEST_F(DBFixture, MemoryIndexConstructZeroSpaceTest) {
+    PriorityDBOptions options;
+    options.backend = PriorityDBOptions::Backend::MEMORY;
+    bool thrown = false;
+    try {
+        PriorityDB db{0LL, db_string_, options};
+    } catch (const PriorityDBException& e) {
+        thrown = true;
+        EXPECT_EQ(std::string{"Must specify a nonzero max_size"},
+                  std::string{e.what()});
+    }
+    EXPECT_TRUE(thrown);
+}
+
+INSTANTIATE_TEST_CASE_P(Backends, IndexFixture,
+                        ::testing::Values(PriorityDBOptions::Backend::SQLITE,
+                                          PriorityDBOptions::Backend::MEMORY));
@@ -1,7 +1,9 @@
 #include <gtest/gtest.h>
 
 #include <map>
+#include <sstream>
 #include <string>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 #include <sqlite3.h>
@@ -64,7 +66,47 @@ class DBFixture : public FSFixture {
         return response;
     }
 
+    // PriorityDB keeps its connection open, so deleting the file underneath it goes unnoticed.
+    // Dropping the table from a second connection invalidates every cached statement instead.
+    void drop_table_() {
+        std::stringstream stream;
+        stream << "DROP TABLE "
+               << table_name_
+               << ";";
+        execute_(stream.str());
+    }
+
+    std::vector<std::string> query_plan_(const std::string& sql) {
+        std::vector<std::string> plan;
+        for (auto& record : execute_("EXPLAIN QUERY PLAN " + sql)) {
+            plan.push_back(record["detail"]);
+        }
+
+        return plan;
+    }
+
     fs::path db_path_;
     std::string db_string_;
     std::string table_name_;
 };
+
+// Runs a test against every index backend. Only the SQLite one can also be inspected from outside.
+class IndexFixture : public DBFixture,
+                     public ::testing::WithParamInterface<PriorityDBOptions::Backend> {
+  protected:
+    PriorityDBOptions options_() {
+        PriorityDBOptions options;
+        options.backend = GetParam();
+        return options;
+    }
+
+    void check_records_(const int& number_of_records) {
+        if (GetParam() == PriorityDBOptions::Backend::SQLITE) {
+            std::stringstream stream;
+            stream << "SELECT * FROM "
+                   << table_name_
+                   << ";";
+            EXPECT_EQ(number_of_records, execute_(stream.str()).size());
+        }
+    }
+};
@@ -55,20 +55,20 @@ TEST_F(FailureFixture, DeleteSomeDiskMessagesTest) {
     }
 
     fs::directory_iterator begin(buffer_path_), end;
-    std::vector<std::string> hashes;
+    std::vector<std::string> files;
     for (auto iterator = begin; iterator != end; ++iterator) {
         if (!(fs::is_directory(*iterator) || 
                 iterator->path().filename().native().substr(0, 10) == "prism_data")) {
-            if (hashes.size() >= number_to_delete) {
+            if (files.size() >= number_to_delete) {
                 break;
             }
 
-            hashes.push_back(iterator->path().filename().native());
+            files.push_back(iterator->path().filename().native());
         }
     }
 
-    for (auto& hash : hashes) {
-        ASSERT_TRUE(fs::remove(buffer_path_ / fs::path{hash}));
+    for (auto& file : files) {
+        ASSERT_TRUE(fs::remove(buffer_path_ / fs::path{file}));
     }
     {
         ASSERT_EQ(number_of_files - number_to_delete, number_of_files_());
@@ -112,7 +112,7 @@ TEST_F(FailureFixture, ExistingDiskMessageTest) {
     auto number_to_create = distribution(generator);
 
     std::stringstream stream;
-    stream << "SELECT hash FROM "
+    stream << "SELECT id FROM "
            << table_name_
            << " ORDER BY priority LIMIT "
            << number_to_create
@@ -121,7 +121,8 @@ TEST_F(FailureFixture, ExistingDiskMessageTest) {
     ASSERT_EQ(number_to_create, response.size());
 
     for (auto& record : response) {
-        auto file_path = buffer_path_ / fs::path{record["hash"]};
+        auto file = PriorityFS::GetFileName(std::stoull(record["id"]));
+        auto file_path = buffer_path_ / fs::path{file};
         std::ofstream file_out{file_path.native()};
         file_out << "hello world";
     }
@@ -161,7 +162,7 @@ TEST_F(FailureFixture, ExistingDiskMessageOnDestructTest) {
         }
 
         std::stringstream stream;
-        stream << "SELECT hash FROM "
+        stream << "SELECT id FROM "
                << table_name_
                << " ORDER BY priority LIMIT "
                << number_to_create
@@ -170,7 +171,8 @@ TEST_F(FailureFixture, ExistingDiskMessageOnDestructTest) {
         ASSERT_EQ(number_to_create, response.size());
 
         for (auto& record : response) {
-            auto file_path = buffer_path_ / fs::path{record["hash"]};
+            auto file = PriorityFS::GetFileName(std::stoull(record["id"]));
+        auto file_path = buffer_path_ / fs::path{file};
             std::ofstream file_out{file_path.native()};
             file_out << "hello world";
         }
@@ -180,6 +182,92 @@ TEST_F(FailureFixture, ExistingDiskMessageOnDestructTest) {
     EXPECT_EQ(DEFAULT_MAX_MEMORY_SIZE - number_to_create, number_of_files_());
 }
 
+TEST_F(FailureFixture, CorruptDiskMessageTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+
+    // The messages with 1 priority are pushed out to disk by those with 2 priority
+    for (auto priority : {1, 2}) {
+        for (int i = 0; i < DEFAULT_MAX_MEMORY_SIZE; ++i) {
+            auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+            message->set_priority(priority);
+            ASSERT_TRUE(message->IsInitialized());
+            buffer.Push(std::move(message));
+        }
+    }
+
+    fs::directory_iterator begin(buffer_path_), end;
+    int corrupted = 0;
+    for (auto iterator = begin; iterator != end; ++iterator) {
+        if (fs::is_directory(*iterator) ||
+                iterator->path().filename().native().substr(0, 10) == "prism_data") {
+            continue;
+        }
+        std::fstream file{iterator->path().native(),
+                          std::ios::in | std::ios::out | std::ios::binary};
+        file.seekp(-1, std::ios::end);
+        file.put('\x7f');
+        ++corrupted;
+    }
+    ASSERT_EQ(DEFAULT_MAX_MEMORY_SIZE, corrupted);
+
+    for (int i = 0; i < DEFAULT_MAX_MEMORY_SIZE; ++i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(2, message->priority());
+    }
+    for (int i = 0; i < DEFAULT_MAX_MEMORY_SIZE; ++i) {
+        EXPECT_EQ(nullptr, buffer.Pop());
+    }
+    EXPECT_EQ(DEFAULT_MAX_MEMORY_SIZE, buffer.GetCorruptMessages());
+    EXPECT_EQ(0, number_of_files_());
+}
+
+TEST_F(FailureFixture, BatchDurabilityIndexTest) {
+    PriorityFSOptions fs_options;
+    fs_options.durability = PriorityFSOptions::Durability::BATCH;
+    fs_options.batch_messages = 3;
+    fs_options.batch_ms = 60000;
+    PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE, 0,
+                                           PriorityDBOptions{}, fs_options};
+    std::stringstream stream;
+    stream << "SELECT id FROM "
+           << table_name_
+           << ";";
+
+    // The index doesn't refer to messages on disk before their batch has been synced
+    for (int i = 0; i < 2; ++i) {
+        auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+        message->set_priority(i);
+        buffer.Push(std::move(message));
+    }
+    EXPECT_EQ(2, number_of_files_());
+    EXPECT_EQ(0, execute_(stream.str()).size());
+
+    auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+    message->set_priority(2);
+    buffer.Push(std::move(message));
+    EXPECT_EQ(3, execute_(stream.str()).size());
+}
+
+TEST_F(FailureFixture, LeftoverFileRecoveryTest) {
+    // A file of a message that a crash kept out of the index, whose id is handed out again
+    {
+        std::ofstream file_out{(buffer_path_ / fs::path{PriorityFS::GetFileName(1)}).native()};
+        file_out << "hello world";
+    }
+
+    PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE, 0};
+    auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+    message->set_priority(7);
+    buffer.Push(std::move(message));
+    EXPECT_EQ(1, number_of_files_());
+
+    message = buffer.Pop();
+    ASSERT_NE(nullptr, message);
+    EXPECT_EQ(7, message->priority());
+    EXPECT_EQ(0, number_of_files_());
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     GOOGLE_PROTOBUF_VERIFY_VERSION;
@@ -1,13 +1,31 @@
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <cstddef>
 #include <fstream>
+#include <map>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#endif
 
 #include "fsfixture.h"
+#ifdef PRIORITYBUFFER_LZ4
+#include "lz4.h"
+#endif
+#include "prioritycrc.h"
 #include "priorityfs.h"
+#include "priorityio.h"
 
 
 TEST_F(FSFixture, EmptyFSTest) {
@@ -251,3 +269,951 @@ TEST_F(FSFixture, DeleteTrueRelativeTest) {
     EXPECT_TRUE(priority_fs.Delete("../prism_buffer/file"));
     EXPECT_FALSE(fs::exists(buffer_path_ / fs::path{"../prism_buffer/file"}));
 }
+
+TEST_F(FSFixture, RenameFalseTest) {
+    PriorityFS priority_fs{"prism_buffer"};
+    EXPECT_FALSE(priority_fs.Rename("file", "new_file"));
+    EXPECT_FALSE(fs::exists(buffer_path_ / fs::path{"new_file"}));
+}
+
+TEST_F(FSFixture, RenameFalseExistingTest) {
+    PriorityFS priority_fs{"prism_buffer"};
+    for (auto& file : {"file", "new_file"}) {
+        std::ofstream out_stream{(buffer_path_ / fs::path{file}).native()};
+        out_stream << file;
+    }
+    EXPECT_FALSE(priority_fs.Rename("file", "new_file"));
+    EXPECT_TRUE(fs::exists(buffer_path_ / fs::path{"file"}));
+    std::ifstream in_stream{(buffer_path_ / fs::path{"new_file"}).native()};
+    std::string contents;
+    in_stream >> contents;
+    EXPECT_EQ(std::string{"new_file"}, contents);
+}
+
+TEST_F(FSFixture, RenameTrueTest) {
+    PriorityFS priority_fs{"prism_buffer"};
+    {
+        std::ofstream out_stream{(buffer_path_ / fs::path{"file"}).native()};
+        out_stream << "hello world";
+    }
+    EXPECT_TRUE(priority_fs.Rename("file", "new_file"));
+    EXPECT_FALSE(fs::exists(buffer_path_ / fs::path{"file"}));
+    EXPECT_TRUE(fs::exists(buffer_path_ / fs::path{"new_file"}));
+}
+
+TEST_F(FSFixture, GetFileNameTest) {
+    EXPECT_EQ(std::string{"0000000000000001"}, PriorityFS::GetFileName(1));
+    EXPECT_EQ(std::string{"00000000deadbeef"}, PriorityFS::GetFileName(0xdeadbeefULL));
+    EXPECT_EQ(std::string{"ffffffffffffffff"}, PriorityFS::GetFileName(~0ULL));
+}
+
+TEST_F(FSFixture, WriteReadFileTest) {
+    PriorityFS priority_fs{"prism_buffer"};
+    PriorityLocation location;
+    ASSERT_TRUE(priority_fs.Write(1, "hello world", location));
+    EXPECT_EQ(0, location.segment);
+    EXPECT_EQ(23, location.length);
+    EXPECT_TRUE(fs::exists(buffer_path_ / fs::path{PriorityFS::GetFileName(1)}));
+
+    std::string data;
+    ASSERT_TRUE(priority_fs.Read(1, location, data));
+    EXPECT_EQ(std::string{"hello world"}, data);
+    EXPECT_TRUE(priority_fs.Release(1, location));
+    EXPECT_EQ(0, number_of_files_());
+}
+
+TEST_F(FSFixture, WriteFileExistingTest) {
+    PriorityFS priority_fs{"prism_buffer"};
+    PriorityLocation location;
+    ASSERT_TRUE(priority_fs.Write(1, "hello", location));
+    EXPECT_FALSE(priority_fs.Write(1, "world", location));
+    EXPECT_EQ(0, number_of_files_());
+}
+
+TEST_F(FSFixture, ReadFileMissingTest) {
+    PriorityFS priority_fs{"prism_buffer"};
+    PriorityLocation location;
+    std::string data;
+    EXPECT_FALSE(priority_fs.Read(1, location, data));
+}
+
+TEST_F(FSFixture, WriteReadSegmentTest) {
+    PriorityFSOptions options;
+    options.segment_size = 1024;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    PriorityLocation first, second;
+    ASSERT_TRUE(priority_fs.Write(1, "hello", first));
+    ASSERT_TRUE(priority_fs.Write(2, "world", second));
+    EXPECT_NE(0, first.segment);
+    EXPECT_EQ(first.segment, second.segment);
+    EXPECT_EQ(0, first.offset);
+    EXPECT_EQ(17, second.offset);
+    EXPECT_EQ(0, number_of_files_());
+
+    std::string data;
+    ASSERT_TRUE(priority_fs.Read(2, second, data));
+    EXPECT_EQ(std::string{"world"}, data);
+    ASSERT_TRUE(priority_fs.Read(1, first, data));
+    EXPECT_EQ(std::string{"hello"}, data);
+}
+
+TEST_F(FSFixture, SegmentRollOverTest) {
+    PriorityFSOptions options;
+    options.segment_size = 8;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    PriorityLocation first, second, third;
+    ASSERT_TRUE(priority_fs.Write(1, "hello", first));
+    ASSERT_TRUE(priority_fs.Write(2, "world", second));
+    ASSERT_TRUE(priority_fs.Write(3, "0123456789", third));
+    EXPECT_NE(first.segment, second.segment);
+    EXPECT_NE(second.segment, third.segment);
+    EXPECT_EQ(0, third.offset);
+
+    std::string data;
+    ASSERT_TRUE(priority_fs.Read(3, third, data));
+    EXPECT_EQ(std::string{"0123456789"}, data);
+}
+
+TEST_F(FSFixture, ReleaseSegmentTest) {
+    PriorityFSOptions options;
+    options.segment_size = 8;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    PriorityLocation first, second;
+    ASSERT_TRUE(priority_fs.Write(1, "hello", first));
+    ASSERT_TRUE(priority_fs.Write(2, "world", second));
+    auto segment_path = buffer_path_ / fs::path{"segments"} /
+                        fs::path{PriorityFS::GetFileName(first.segment)};
+    ASSERT_TRUE(fs::exists(segment_path));
+
+    EXPECT_TRUE(priority_fs.Release(1, first));
+    EXPECT_FALSE(fs::exists(segment_path));
+    std::string data;
+    EXPECT_FALSE(priority_fs.Read(1, first, data));
+    EXPECT_FALSE(priority_fs.Release(1, first));
+}
+
+TEST_F(FSFixture, ReleaseActiveSegmentTest) {
+    PriorityFSOptions options;
+    options.segment_size = 1024;
+    {
+        PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+        PriorityLocation location;
+        ASSERT_TRUE(priority_fs.Write(1, "hello", location));
+        EXPECT_TRUE(priority_fs.Release(1, location));
+        EXPECT_FALSE(fs::is_empty(buffer_path_ / fs::path{"segments"}));
+    }
+    EXPECT_TRUE(fs::is_empty(buffer_path_ / fs::path{"segments"}));
+}
+
+TEST_F(FSFixture, GetSparseSegmentTest) {
+    PriorityFSOptions options;
+    options.segment_size = 88;
+    options.segment_compact_ratio = 0.5;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    PriorityLocation locations[5];
+    for (int i = 0; i < 5; ++i) {
+        ASSERT_TRUE(priority_fs.Write(i + 1, "0123456789", locations[i]));
+    }
+    EXPECT_EQ(0, priority_fs.GetSparseSegment());
+
+    priority_fs.Release(1, locations[0]);
+    priority_fs.Release(2, locations[1]);
+    EXPECT_EQ(0, priority_fs.GetSparseSegment());
+    priority_fs.Release(3, locations[2]);
+    EXPECT_EQ(locations[0].segment, priority_fs.GetSparseSegment());
+}
+
+TEST_F(FSFixture, RecoverSegmentsTest) {
+    PriorityFSOptions options;
+    options.segment_size = 8;
+    PriorityLocation first, second;
+    {
+        PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+        ASSERT_TRUE(priority_fs.Write(1, "hello", first));
+        ASSERT_TRUE(priority_fs.Write(2, "world", second));
+    }
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    priority_fs.RecoverSegments(std::map<unsigned long long, unsigned long long>{{2, 5}});
+    auto segment_path = buffer_path_ / fs::path{"segments"};
+    EXPECT_FALSE(fs::exists(segment_path / fs::path{PriorityFS::GetFileName(first.segment)}));
+    ASSERT_TRUE(fs::exists(segment_path / fs::path{PriorityFS::GetFileName(second.segment)}));
+
+    std::string data;
+    ASSERT_TRUE(priority_fs.Read(2, second, data));
+    EXPECT_EQ(std::string{"world"}, data);
+
+    PriorityLocation third;
+    ASSERT_TRUE(priority_fs.Write(3, "again", third));
+    EXPECT_GT(third.segment, second.segment);
+    EXPECT_TRUE(priority_fs.Release(2, second));
+    EXPECT_FALSE(fs::exists(segment_path / fs::path{PriorityFS::GetFileName(second.segment)}));
+}
+
+TEST_F(FSFixture, ConstructDirectoryLevelsThrowTest) {
+    PriorityFSOptions options;
+    options.directory_levels = 3;
+    bool thrown = false;
+    try {
+        PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    } catch (const PriorityFSException& e) {
+        thrown = true;
+        EXPECT_EQ(std::string{"PriorityFS supports up to 2 directory levels"},
+                  std::string{e.what()});
+    }
+    EXPECT_TRUE(thrown);
+}
+
+TEST_F(FSFixture, GetFilePathDirectoryLevelsTest) {
+    PriorityFSOptions options;
+    options.directory_levels = 2;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    auto file = PriorityFS::GetFileName(0x0201);
+    EXPECT_EQ((buffer_path_ / fs::path{"01"} / fs::path{"02"} / fs::path{file}).native(),
+              priority_fs.GetFilePath(file));
+    EXPECT_EQ((buffer_path_ / fs::path{"prism_data.db"}).native(),
+              priority_fs.GetFilePath("prism_data.db"));
+}
+
+TEST_F(FSFixture, WriteReadDirectoryLevelsTest) {
+    PriorityFSOptions options;
+    options.directory_levels = 1;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    PriorityLocation location;
+    ASSERT_TRUE(priority_fs.Write(0x0201, "hello world", location));
+    auto file = PriorityFS::GetFileName(0x0201);
+    EXPECT_TRUE(fs::exists(buffer_path_ / fs::path{"01"} / fs::path{file}));
+    EXPECT_EQ(1, number_of_files_());
+
+    std::string data;
+    ASSERT_TRUE(priority_fs.Read(0x0201, location, data));
+    EXPECT_EQ(std::string{"hello world"}, data);
+    EXPECT_TRUE(priority_fs.Release(0x0201, location));
+    EXPECT_FALSE(fs::exists(buffer_path_ / fs::path{"01"} / fs::path{file}));
+}
+
+TEST_F(FSFixture, MigrateDirectoryLevelsTest) {
+    std::vector<unsigned long long> ids{1, 0x0201, 0x0301, 0xffff};
+    {
+        PriorityFS priority_fs{"prism_buffer"};
+        for (auto id : ids) {
+            PriorityLocation location;
+            ASSERT_TRUE(priority_fs.Write(id, std::to_string(id), location));
+        }
+    }
+    ASSERT_EQ(ids.size(), number_of_files_());
+
+    PriorityFSOptions options;
+    options.directory_levels = 2;
+    {
+        PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+        EXPECT_EQ(1, number_of_files_());
+        EXPECT_TRUE(fs::exists(buffer_path_ / fs::path{"layout"}));
+        for (auto id : ids) {
+            PriorityLocation location;
+            std::string data;
+            ASSERT_TRUE(priority_fs.Read(id, location, data));
+            EXPECT_EQ(std::to_string(id), data);
+        }
+    }
+
+    PriorityFS priority_fs{"prism_buffer"};
+    EXPECT_EQ(ids.size(), number_of_files_());
+    EXPECT_FALSE(fs::exists(buffer_path_ / fs::path{"layout"}));
+    EXPECT_FALSE(fs::exists(buffer_path_ / fs::path{"01"}));
+    for (auto id : ids) {
+        PriorityLocation location;
+        std::string data;
+        ASSERT_TRUE(priority_fs.Read(id, location, data));
+        EXPECT_EQ(std::to_string(id), data);
+    }
+}
+
+TEST_F(FSFixture, ReadParseTest) {
+    PriorityFS priority_fs{"prism_buffer"};
+    PriorityLocation location;
+    ASSERT_TRUE(priority_fs.Write(1, "hello world", location));
+    std::string data;
+    auto parse = [&data] (const char* begin, const size_t& size) {
+        data.assign(begin, size);
+        return true;
+    };
+    ASSERT_TRUE(priority_fs.Read(1, location, parse));
+    EXPECT_EQ(std::string{"hello world"}, data);
+    EXPECT_FALSE(priority_fs.Read(1, location, [] (const char*, const size_t&) {
+        return false;
+    }));
+}
+
+TEST_F(FSFixture, ReadMappedFileTest) {
+    PriorityFSOptions options;
+    options.mmap_threshold = 1;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    PriorityLocation location;
+    auto contents = std::string(100000, 'a');
+    ASSERT_TRUE(priority_fs.Write(1, contents, location));
+    std::string data;
+    ASSERT_TRUE(priority_fs.Read(1, location, [&data] (const char* begin, const size_t& size) {
+        data.assign(begin, size);
+        return true;
+    }));
+    EXPECT_EQ(contents, data);
+}
+
+TEST_F(FSFixture, ReadMappedSegmentTest) {
+    PriorityFSOptions options;
+    options.segment_size = 1 << 20;
+    options.mmap_threshold = 1;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    std::vector<PriorityLocation> locations(3);
+    for (int i = 0; i < 3; ++i) {
+        // Lengths that leave the later records off page boundaries
+        ASSERT_TRUE(priority_fs.Write(i + 1, std::string(5000 + i, 'a' + i), locations[i]));
+    }
+    for (int i = 2; i >= 0; --i) {
+        std::string data;
+        ASSERT_TRUE(priority_fs.Read(i + 1, locations[i],
+                                     [&data] (const char* begin, const size_t& size) {
+            data.assign(begin, size);
+            return true;
+        }));
+        EXPECT_EQ(std::string(5000 + i, 'a' + i), data);
+    }
+}
+
+TEST_F(FSFixture, ReadMappedPastEndTest) {
+    PriorityFSOptions options;
+    options.segment_size = 1 << 20;
+    options.mmap_threshold = 1;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    PriorityLocation location;
+    ASSERT_TRUE(priority_fs.Write(1, "hello world", location));
+    location.length += 1;
+    EXPECT_FALSE(priority_fs.Read(1, location, [] (const char*, const size_t&) {
+        return true;
+    }));
+}
+
+TEST_F(FSFixture, WriteMessageDurabilityTest) {
+    PriorityFSOptions options;
+    options.durability = PriorityFSOptions::Durability::MESSAGE;
+    options.sync_directories = true;
+    options.directory_levels = 1;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    PriorityLocation location;
+    ASSERT_TRUE(priority_fs.Write(1, "hello world", location));
+    std::string data;
+    ASSERT_TRUE(priority_fs.Read(1, location, data));
+    EXPECT_EQ(std::string{"hello world"}, data);
+}
+
+TEST_F(FSFixture, WriteMessageDurabilitySegmentTest) {
+    PriorityFSOptions options;
+    options.durability = PriorityFSOptions::Durability::MESSAGE;
+    options.sync_directories = true;
+    options.segment_size = 8;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    PriorityLocation first, second;
+    ASSERT_TRUE(priority_fs.Write(1, "hello", first));
+    ASSERT_TRUE(priority_fs.Write(2, "world", second));
+    std::string data;
+    ASSERT_TRUE(priority_fs.Read(2, second, data));
+    EXPECT_EQ(std::string{"world"}, data);
+}
+
+#ifdef __linux__
+TEST_F(FSFixture, WriteBatchDurabilityTest) {
+    auto open_files = [] () {
+        return std::distance(fs::directory_iterator{"/proc/self/fd"}, fs::directory_iterator{});
+    };
+    PriorityFSOptions options;
+    options.durability = PriorityFSOptions::Durability::BATCH;
+    options.batch_messages = 3;
+    options.batch_ms = 60000;
+    options.sync_directories = true;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    auto files = open_files();
+
+    // Files are kept open until their batch is synced
+    PriorityLocation location;
+    ASSERT_TRUE(priority_fs.Write(1, "hello", location));
+    ASSERT_TRUE(priority_fs.Write(2, "world", location));
+    EXPECT_EQ(files + 2, open_files());
+    EXPECT_TRUE(priority_fs.Flush());
+    EXPECT_EQ(files + 2, open_files());
+    ASSERT_TRUE(priority_fs.Write(3, "again", location));
+    EXPECT_EQ(files, open_files());
+
+    ASSERT_TRUE(priority_fs.Write(4, "hello", location));
+    EXPECT_EQ(files + 1, open_files());
+    EXPECT_TRUE(priority_fs.Sync());
+    EXPECT_EQ(files, open_files());
+
+    std::string data;
+    ASSERT_TRUE(priority_fs.Read(4, location, data));
+    EXPECT_EQ(std::string{"hello"}, data);
+}
+
+TEST_F(FSFixture, FlushBatchDurabilityTest) {
+    auto open_files = [] () {
+        return std::distance(fs::directory_iterator{"/proc/self/fd"}, fs::directory_iterator{});
+    };
+    PriorityFSOptions options;
+    options.durability = PriorityFSOptions::Durability::BATCH;
+    options.batch_messages = 100;
+    options.batch_ms = 0;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    auto files = open_files();
+
+    PriorityLocation location;
+    ASSERT_TRUE(priority_fs.Write(1, "hello", location));
+    EXPECT_EQ(files + 1, open_files());
+    EXPECT_TRUE(priority_fs.Flush());
+    EXPECT_EQ(files, open_files());
+}
+#endif
+
+TEST_F(FSFixture, SyncedBatchDurabilityTest) {
+    PriorityFSOptions options;
+    options.durability = PriorityFSOptions::Durability::BATCH;
+    options.batch_messages = 3;
+    options.batch_ms = 60000;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    EXPECT_TRUE(priority_fs.Synced());
+
+    PriorityLocation location;
+    ASSERT_TRUE(priority_fs.Write(1, "hello", location));
+    EXPECT_FALSE(priority_fs.Synced());
+    EXPECT_TRUE(priority_fs.Flush());
+    EXPECT_FALSE(priority_fs.Synced());
+    ASSERT_TRUE(priority_fs.Write(2, "world", location));
+    ASSERT_TRUE(priority_fs.Write(3, "again", location));
+    EXPECT_TRUE(priority_fs.Synced());
+
+    ASSERT_TRUE(priority_fs.Write(4, "hello", location));
+    EXPECT_FALSE(priority_fs.Synced());
+    EXPECT_TRUE(priority_fs.Sync());
+    EXPECT_TRUE(priority_fs.Synced());
+}
+
+TEST_F(FSFixture, SyncedLargeBatchDurabilityTest) {
+    PriorityFSOptions options;
+    options.durability = PriorityFSOptions::Durability::BATCH;
+    options.batch_messages = 100000;
+    options.batch_ms = 60000;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+
+    // The batch is cut short well before its files could run out of descriptors
+    PriorityLocation location;
+    for (unsigned long long id = 1; id < 256; ++id) {
+        ASSERT_TRUE(priority_fs.Write(id, "hello", location));
+    }
+    EXPECT_FALSE(priority_fs.Synced());
+    ASSERT_TRUE(priority_fs.Write(256, "hello", location));
+    EXPECT_TRUE(priority_fs.Synced());
+}
+
+TEST_F(FSFixture, SyncedNoDurabilityTest) {
+    PriorityFS priority_fs{"prism_buffer", std::string{}};
+    PriorityLocation location;
+    ASSERT_TRUE(priority_fs.Write(1, "hello", location));
+    EXPECT_TRUE(priority_fs.Synced());
+}
+
+TEST_F(FSFixture, SubmitIOTest) {
+    fs::create_directory(buffer_path_);
+    // Calls made one after the other, on threads, and through io_uring where there is one
+    for (auto depth : {0, 4}) {
+        for (auto uring : {false, true}) {
+            PriorityIO io{depth, uring};
+            std::vector<std::string> paths;
+            std::vector<int> fds;
+            std::vector<std::string> data;
+            std::vector<PriorityIORequest> requests;
+            for (int i = 0; i < 8; ++i) {
+                paths.push_back((buffer_path_ / fs::path{PriorityFS::GetFileName(i + 1)}).string());
+                fds.push_back(open(paths.back().c_str(), O_RDWR | O_CREAT, 0644));
+                ASSERT_LE(0, fds.back());
+                data.push_back(std::string(1000 * i, 'a' + i));
+            }
+            for (int i = 0; i < 8; ++i) {
+                requests.emplace_back(PriorityIORequest::Operation::WRITE, fds[i], &data[i][0],
+                                      data[i].size(), 0);
+            }
+            io.Submit(requests);
+            for (int i = 0; i < 8; ++i) {
+                EXPECT_EQ(data[i].size(), requests[i].result);
+            }
+
+            requests.clear();
+            for (int i = 0; i < 8; ++i) {
+                requests.emplace_back(PriorityIORequest::Operation::SYNC, fds[i], nullptr, 0, 0);
+            }
+            io.Submit(requests);
+            for (auto& request : requests) {
+                EXPECT_EQ(0, request.result);
+            }
+
+            // Reads past the end of a file stop there
+            requests.clear();
+            std::vector<std::string> read(8, std::string(8000, '\0'));
+            for (int i = 0; i < 8; ++i) {
+                requests.emplace_back(PriorityIORequest::Operation::READ, fds[i], &read[i][0],
+                                      read[i].size(), 0);
+            }
+            io.Submit(requests);
+            for (int i = 0; i < 8; ++i) {
+                ASSERT_EQ(data[i].size(), requests[i].result);
+                EXPECT_EQ(data[i], read[i].substr(0, data[i].size()));
+                close(fds[i]);
+            }
+
+            requests.clear();
+            for (auto& path : paths) {
+                requests.emplace_back(PriorityIORequest::Operation::UNLINK, path);
+            }
+            requests.emplace_back(PriorityIORequest::Operation::UNLINK, paths.front());
+            io.Submit(requests);
+            for (int i = 0; i < 8; ++i) {
+                EXPECT_EQ(0, requests[i].result);
+            }
+            EXPECT_EQ(-ENOENT, requests.back().result);
+            EXPECT_EQ(0, number_of_files_());
+        }
+    }
+}
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+TEST_F(FSFixture, SubmitIOFallbackTest) {
+    fs::create_directory(buffer_path_);
+    // A kernel without io_uring, or one that forbids it, answers io_uring_setup with an error.
+    // The filter only applies to the thread that installs it and the threads it starts.
+    std::thread thread([this] {
+        struct sock_filter filter[] = {
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_io_uring_setup, 0, 1),
+            BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | ENOSYS),
+            BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+        };
+        struct sock_fprog program = {sizeof(filter) / sizeof(filter[0]), filter};
+        ASSERT_EQ(0, prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0));
+        ASSERT_EQ(0, prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &program));
+
+        PriorityIO io{4, true};
+        EXPECT_FALSE(io.Uring());
+        auto path = (buffer_path_ / fs::path{PriorityFS::GetFileName(1)}).string();
+        auto fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        ASSERT_LE(0, fd);
+        std::string data(1000, 'a');
+        std::vector<PriorityIORequest> requests;
+        requests.emplace_back(PriorityIORequest::Operation::WRITE, fd, &data[0], data.size(), 0);
+        requests.emplace_back(PriorityIORequest::Operation::SYNC, fd, nullptr, 0, 0);
+        io.Submit(requests);
+        EXPECT_EQ(data.size(), requests[0].result);
+        EXPECT_EQ(0, requests[1].result);
+
+        std::string read(data.size(), '\0');
+        requests.clear();
+        requests.emplace_back(PriorityIORequest::Operation::READ, fd, &read[0], read.size(), 0);
+        io.Submit(requests);
+        EXPECT_EQ(data.size(), requests[0].result);
+        EXPECT_EQ(data, read);
+        close(fd);
+    });
+    thread.join();
+}
+#endif
+
+TEST_F(FSFixture, WriteReadBatchTest) {
+    for (auto segment_size : {0, 64}) {
+        PriorityFSOptions options;
+        options.segment_size = segment_size;
+        options.io_depth = 4;
+        options.durability = PriorityFSOptions::Durability::MESSAGE;
+        {
+            PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+            std::vector<PriorityRecord> records;
+            for (int i = 0; i < 20; ++i) {
+                records.emplace_back(i + 1);
+                records.back().data = std::string(i, 'a' + i);
+            }
+            ASSERT_TRUE(priority_fs.Write(records));
+            for (auto& record : records) {
+                EXPECT_TRUE(record.done);
+                EXPECT_EQ(record.id + 11, record.location.length);
+                EXPECT_EQ(segment_size == 0, record.location.segment == 0);
+                record.data.clear();
+            }
+
+            ASSERT_TRUE(priority_fs.Read(records));
+            for (auto& record : records) {
+                EXPECT_TRUE(record.done);
+                EXPECT_EQ(std::string(record.id - 1, 'a' + record.id - 1), record.data);
+            }
+            ASSERT_TRUE(priority_fs.Release(records));
+        }
+        EXPECT_EQ(0, number_of_files_());
+        EXPECT_FALSE(fs::exists(buffer_path_ / fs::path{"segments"}) &&
+                     !fs::is_empty(buffer_path_ / fs::path{"segments"}));
+    }
+}
+
+TEST_F(FSFixture, WriteBatchExistingTest) {
+    PriorityFSOptions options;
+    options.io_depth = 4;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    PriorityLocation location;
+    ASSERT_TRUE(priority_fs.Write(2, "hello", location));
+
+    // Only the record that collides is not written
+    std::vector<PriorityRecord> records{PriorityRecord{1}, PriorityRecord{2}, PriorityRecord{3}};
+    for (auto& record : records) {
+        record.data = "world";
+    }
+    EXPECT_FALSE(priority_fs.Write(records));
+    EXPECT_TRUE(records[0].done);
+    EXPECT_FALSE(records[1].done);
+    EXPECT_TRUE(records[2].done);
+    EXPECT_EQ(2, number_of_files_());
+}
+
+TEST_F(FSFixture, ReadBatchMissingTest) {
+    PriorityFSOptions options;
+    options.io_depth = 4;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    PriorityLocation location;
+    ASSERT_TRUE(priority_fs.Write(1, "hello", location));
+
+    std::vector<PriorityRecord> records{PriorityRecord{1}, PriorityRecord{2}};
+    records[0].location = location;
+    records[1].location = location;
+    EXPECT_FALSE(priority_fs.Read(records));
+    EXPECT_TRUE(records[0].done);
+    EXPECT_EQ(std::string{"hello"}, records[0].data);
+    EXPECT_FALSE(records[1].done);
+    EXPECT_TRUE(records[1].data.empty());
+
+    EXPECT_FALSE(priority_fs.Release(records));
+    EXPECT_TRUE(records[0].done);
+    EXPECT_FALSE(records[1].done);
+    EXPECT_EQ(0, number_of_files_());
+}
+
+TEST_F(FSFixture, DiscardTest) {
+    PriorityFS priority_fs{"prism_buffer"};
+    PriorityLocation location;
+    ASSERT_TRUE(priority_fs.Write(1, "hello", location));
+    EXPECT_TRUE(priority_fs.Discard(1, location));
+    EXPECT_EQ(0, number_of_files_());
+    EXPECT_FALSE(priority_fs.Discard(1, location));
+}
+
+TEST_F(FSFixture, DiscardDeferredTest) {
+    PriorityFSOptions options;
+    options.deferred_unlink = true;
+    {
+        PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+        std::vector<PriorityRecord> records;
+        for (int i = 0; i < 10; ++i) {
+            PriorityLocation location;
+            ASSERT_TRUE(priority_fs.Write(i + 1, "hello", location));
+            records.emplace_back(i + 1);
+            records.back().location = location;
+        }
+        EXPECT_TRUE(priority_fs.Discard(records));
+
+        // The background thread gets to them once they are logged, and then empties the log
+        EXPECT_TRUE(priority_fs.Flush());
+        auto unlinks_path = buffer_path_ / fs::path{"unlinks"};
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while ((number_of_files_() > 1 || fs::file_size(unlinks_path) > 0) &&
+                std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT_EQ(1, number_of_files_());
+        EXPECT_EQ(0, fs::file_size(unlinks_path));
+
+        // Unlinks that are still queued are made on destruction
+        PriorityLocation location;
+        ASSERT_TRUE(priority_fs.Write(11, "hello", location));
+        EXPECT_TRUE(priority_fs.Discard(11, location));
+    }
+    EXPECT_EQ(0, number_of_files_());
+}
+
+TEST_F(FSFixture, DiscardDeferredSegmentTest) {
+    PriorityFSOptions options;
+    options.deferred_unlink = true;
+    options.segment_size = 8;
+    auto segment_path = buffer_path_ / fs::path{"segments"};
+    {
+        PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+        PriorityLocation first, second;
+        ASSERT_TRUE(priority_fs.Write(1, "hello", first));
+        ASSERT_TRUE(priority_fs.Write(2, "world", second));
+        EXPECT_TRUE(priority_fs.Discard(1, first));
+        EXPECT_TRUE(priority_fs.Discard(2, second));
+    }
+    EXPECT_TRUE(fs::is_empty(segment_path));
+    EXPECT_EQ(0, number_of_files_());
+}
+
+TEST_F(FSFixture, RecoverUnlinksTest) {
+    {
+        PriorityFSOptions options;
+        options.directory_levels = 1;
+        PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+        PriorityLocation location;
+        ASSERT_TRUE(priority_fs.Write(1, "hello", location));
+        ASSERT_TRUE(priority_fs.Write(2, "world", location));
+    }
+
+    // A run that crashed with an unlink still pending
+    {
+        std::ofstream stream{(buffer_path_ / fs::path{"unlinks"}).native()};
+        stream << "f " << PriorityFS::GetFileName(1) << "\n"
+               << "f ../prism_data.db\n";
+    }
+    PriorityFSOptions options;
+    options.directory_levels = 1;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    EXPECT_FALSE(fs::exists(priority_fs.GetFilePath(PriorityFS::GetFileName(1))));
+    EXPECT_TRUE(fs::exists(priority_fs.GetFilePath(PriorityFS::GetFileName(2))));
+    EXPECT_FALSE(fs::exists(buffer_path_ / fs::path{"unlinks"}));
+}
+
+TEST_F(FSFixture, RecoverUnlinksReusedTest) {
+    // Runs that crashed with an unlink pending, whose names the next run hands out again. The old
+    // unlinks must not touch what is written under them.
+    PriorityFSOptions options;
+    options.deferred_unlink = true;
+    for (auto segment_size : {0, 64}) {
+        options.segment_size = segment_size;
+        fs::create_directories(buffer_path_ / fs::path{"segments"});
+        {
+            std::ofstream stream{(buffer_path_ / fs::path{"unlinks"}).native()};
+            stream << (segment_size == 0 ? "f " : "s ") << PriorityFS::GetFileName(1) << "\n";
+        }
+
+        PriorityLocation location;
+        {
+            PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+            ASSERT_TRUE(priority_fs.Write(1, "hello", location));
+            EXPECT_EQ(segment_size == 0 ? 0 : 1, location.segment);
+            EXPECT_TRUE(priority_fs.Flush());
+        }
+
+        PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+        std::string data;
+        ASSERT_TRUE(priority_fs.Read(1, location, data));
+        EXPECT_EQ("hello", data);
+    }
+}
+
+TEST_F(FSFixture, CRC32CTest) {
+    EXPECT_EQ(0, PriorityCRC32C(nullptr, 0));
+    EXPECT_EQ(0xe3069283, PriorityCRC32C("123456789", 9));
+    EXPECT_EQ(0xe3069283, PriorityCRC32C("6789", 4, PriorityCRC32C("12345", 5)));
+    EXPECT_EQ(0x8a9136aa, PriorityCRC32C(std::string(32, '\x00').data(), 32));
+    EXPECT_EQ(0x62a8ab43, PriorityCRC32C(std::string(32, '\xff').data(), 32));
+    EXPECT_EQ(0xe3069283, PriorityCRC32CTable("123456789", 9));
+
+    // Whatever the CPU, every length and alignment has to agree with the tables
+    std::string data;
+    for (int i = 0; i < 300; ++i) {
+        data.push_back(static_cast<char>(i * 7 + 3));
+    }
+    for (size_t offset = 0; offset < 8; ++offset) {
+        for (size_t size = 0; size + offset <= data.size(); size += 13) {
+            EXPECT_EQ(PriorityCRC32CTable(data.data() + offset, size),
+                      PriorityCRC32C(data.data() + offset, size));
+        }
+    }
+}
+
+TEST_F(FSFixture, ReadCorruptFileTest) {
+    PriorityFS priority_fs{"prism_buffer"};
+    PriorityLocation location;
+    ASSERT_TRUE(priority_fs.Write(1, "hello world", location));
+    auto path = priority_fs.GetFilePath(PriorityFS::GetFileName(1));
+    {
+        std::fstream stream{path, std::ios::in | std::ios::out | std::ios::binary};
+        stream.seekp(location.length - 1);
+        stream.put('D');
+    }
+
+    std::string data;
+    EXPECT_FALSE(priority_fs.Read(1, location, data));
+    EXPECT_TRUE(data.empty());
+    EXPECT_FALSE(priority_fs.Read(1, location, [] (const char*, const size_t&) {
+        return true;
+    }));
+    EXPECT_EQ(2, priority_fs.GetCorruptRecords());
+
+    // Missing messages are not corrupt ones
+    EXPECT_FALSE(priority_fs.Read(2, location, data));
+    EXPECT_EQ(2, priority_fs.GetCorruptRecords());
+}
+
+TEST_F(FSFixture, ReadCorruptSegmentTest) {
+    PriorityFSOptions options;
+    options.segment_size = 1024;
+    options.mmap_threshold = 16;
+    PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+    std::vector<PriorityRecord> records;
+    for (int i = 0; i < 3; ++i) {
+        records.emplace_back(i + 1);
+        records.back().data = std::string(10, 'a' + i);
+    }
+    ASSERT_TRUE(priority_fs.Write(records));
+    auto path = buffer_path_ / fs::path{"segments"} /
+                fs::path{PriorityFS::GetFileName(records[1].location.segment)};
+    {
+        std::fstream stream{path.native(), std::ios::in | std::ios::out | std::ios::binary};
+        stream.seekp(records[1].location.offset + 1);
+        stream.put('X');
+    }
+
+    EXPECT_FALSE(priority_fs.Read(records));
+    EXPECT_TRUE(records[0].done);
+    EXPECT_EQ(std::string(10, 'a'), records[0].data);
+    EXPECT_FALSE(records[1].done);
+    EXPECT_TRUE(records[1].data.empty());
+    EXPECT_TRUE(records[2].done);
+    EXPECT_EQ(std::string(10, 'c'), records[2].data);
+    EXPECT_EQ(1, priority_fs.GetCorruptRecords());
+
+    auto parsed = false;
+    EXPECT_FALSE(priority_fs.Read(2, records[1].location, [&parsed] (const char*, const size_t&) {
+        parsed = true;
+        return true;
+    }));
+    EXPECT_FALSE(parsed);
+    EXPECT_EQ(2, priority_fs.GetCorruptRecords());
+}
+
+TEST_F(FSFixture, ReadUnframedFileTest) {
+    PriorityFS priority_fs{"prism_buffer"};
+    auto path = priority_fs.GetFilePath(PriorityFS::GetFileName(1));
+    {
+        std::ofstream stream{path, std::ios::binary};
+        stream << "hello world";
+    }
+
+    // Files written before records had headers are taken as they are, as long as they are as
+    // long as the index says
+    PriorityLocation location;
+    location.length = 11;
+    std::string data;
+    ASSERT_TRUE(priority_fs.Read(1, location, data));
+    EXPECT_EQ(std::string{"hello world"}, data);
+
+    location.length = 12;
+    EXPECT_FALSE(priority_fs.Read(1, location, data));
+    EXPECT_EQ(1, priority_fs.GetCorruptRecords());
+}
+
+#ifdef PRIORITYBUFFER_LZ4
+TEST_F(FSFixture, LZ4Test) {
+    std::string text;
+    for (int i = 0; i < 1000; ++i) {
+        text += "message " + std::to_string(i % 13) + " of " + std::to_string(i) + "\n";
+    }
+    std::string noise;
+    unsigned long long state = 88172645463325252ULL;
+    for (int i = 0; i < 5000; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        noise.push_back(static_cast<char>(state));
+    }
+
+    for (auto& data : {std::string{}, std::string{"short"}, std::string(70000, 'x'), text, noise}) {
+        std::string compressed(LZ4_compressBound(data.size()), '\0');
+        auto size = LZ4_compress_default(data.data(), &compressed[0], data.size(),
+                                         compressed.size());
+        ASSERT_LT(0, size);
+        std::string decompressed(data.size(), '\0');
+        EXPECT_EQ(static_cast<int>(data.size()),
+                  LZ4_decompress_safe(compressed.data(), &decompressed[0], size,
+                                      decompressed.size()));
+        EXPECT_EQ(data, decompressed);
+        if (data.size() > 1000 && data != noise) {
+            EXPECT_GT(data.size() / 2, static_cast<size_t>(size));
+        }
+
+        // Blocks cut short or decompressed into too little space are rejected, not overrun
+        if (!data.empty()) {
+            EXPECT_GT(0, LZ4_decompress_safe(compressed.data(), &decompressed[0], size - 1,
+                                             decompressed.size()));
+            EXPECT_GT(0, LZ4_decompress_safe(compressed.data(), &decompressed[0], size,
+                                             decompressed.size() - 1));
+        }
+    }
+
+    // Too little space to compress into is reported rather than overrun
+    std::string compressed(10, '\0');
+    EXPECT_EQ(0, LZ4_compress_default(noise.data(), &compressed[0], noise.size(),
+                                      compressed.size()));
+
+    // A block put together by hand: three literals, a match 3 back of 13, then five literals
+    std::string reference{"\x39\x61\x62\x63\x03\x00\x50\x62\x63\x61\x62\x63", 12};
+    std::string decompressed(21, '\0');
+    ASSERT_EQ(21, LZ4_decompress_safe(reference.data(), &decompressed[0], reference.size(),
+                                      decompressed.size()));
+    EXPECT_EQ(std::string{"abcabcabcabcabcabcabc"}, decompressed);
+}
+
+TEST_F(FSFixture, WriteReadCompressedTest) {
+    std::string text;
+    for (int i = 0; i < 100; ++i) {
+        text += "temperature " + std::to_string(i % 5) + " degrees; ";
+    }
+    for (auto segment_size : {0, 1 << 16}) {
+        PriorityFSOptions options;
+        options.segment_size = segment_size;
+        options.compression = PriorityFSOptions::Compression::LZ4;
+        options.compression_threshold = 64;
+        options.mmap_threshold = 1;
+        PriorityFS priority_fs{"prism_buffer", std::string{}, options};
+        std::vector<PriorityRecord> records;
+        std::string distinct{"0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ!@"};
+        for (auto& data : {text, std::string(32, 'a'), distinct}) {
+            records.emplace_back(records.size() + 1);
+            records.back().data = data;
+        }
+        ASSERT_TRUE(priority_fs.Write(records));
+
+        // Below the threshold, or no smaller compressed, records are kept as they are
+        EXPECT_GT(text.size() / 4, records[0].location.length);
+        EXPECT_EQ(12 + 32, records[1].location.length);
+        EXPECT_EQ(12 + 64, records[2].location.length);
+
+        auto expected = records;
+        ASSERT_TRUE(priority_fs.Read(records));
+        for (size_t i = 0; i < records.size(); ++i) {
+            EXPECT_EQ(expected[i].data, records[i].data);
+        }
+        std::string parsed;
+        ASSERT_TRUE(priority_fs.Read(1, records[0].location, [&parsed] (const char* data,
+                                                                     const size_t& size) {
+            parsed.assign(data, size);
+            return true;
+        }));
+        EXPECT_EQ(text, parsed);
+
+        PriorityLocation location;
+        ASSERT_TRUE(priority_fs.Write(4, text, location));
+        EXPECT_EQ(records[0].location.length, location.length);
+        std::string data;
+        ASSERT_TRUE(priority_fs.Read(4, location, data));
+        EXPECT_EQ(text, data);
+        EXPECT_EQ(0, priority_fs.GetCorruptRecords());
+    }
+}
+#else
+TEST_F(FSFixture, CompressionUnavailableTest) {
+    PriorityFSOptions options;
+    options.compression = PriorityFSOptions::Compression::LZ4;
+    EXPECT_THROW((PriorityFS{"prism_buffer", std::string{}, options}), PriorityFSException);
+}
+#endif
@@ -1,13 +1,18 @@
 #include <gtest/gtest.h>
+#include <algorithm>
 
+#include <atomic>
 #include <chrono>
 #include <memory>
+#include <mutex>
 #include <random>
 #include <thread>
+#include <vector>
 
 #include "fsfixture.h"
 #include "priority.pb.h"
 #include "prioritybuffer.h"
+#include "shardedprioritybuffer.h"
 
 #ifndef NUMBER_MESSAGES_IN_TEST
 #define NUMBER_MESSAGES_IN_TEST 1000
@@ -43,6 +48,22 @@ void pull(PriorityBuffer<PriorityMessage>& buffer) {
     EXPECT_EQ(nullptr, buffer.Pop());
 }
 
+void pull_timed(PriorityBuffer<PriorityMessage>& buffer, int messages) {
+    PriorityMessage message;
+    for (int i = 0; i < messages; ) {
+        auto start = std::chrono::steady_clock::now();
+        auto status = buffer.TryPopFor(message, std::chrono::milliseconds(100));
+        if (status == PriorityPopStatus::OK) {
+            EXPECT_TRUE(message.IsInitialized());
+            ++i;
+        } else {
+            EXPECT_EQ(PriorityPopStatus::TIMEOUT, status);
+            EXPECT_LE(std::chrono::milliseconds(100), std::chrono::steady_clock::now() - start);
+        }
+    }
+    EXPECT_EQ(PriorityPopStatus::EMPTY, buffer.TryPop(message));
+}
+
 void pull_block(PriorityBuffer<PriorityMessage>& buffer, int messages) {
     for (int i = 0; i < messages; ++i) {
         auto message = buffer.Pop(true);
@@ -51,6 +72,73 @@ void pull_block(PriorityBuffer<PriorityMessage>& buffer, int messages) {
     EXPECT_EQ(nullptr, buffer.Pop());
 }
 
+void push_many(PriorityBuffer<PriorityMessage>& buffer, int messages) {
+    std::random_device generator;
+    std::uniform_int_distribution<unsigned long long> distribution(0, 100LL);
+    std::vector<std::unique_ptr<PriorityMessage>> batch;
+    for (int i = 0; i < messages; ++i) {
+        batch.emplace_back(new PriorityMessage{});
+        batch.back()->set_priority(distribution(generator));
+        if (batch.size() == 50 || i == messages - 1) {
+            buffer.PushMany(batch.begin(), batch.end());
+            batch.clear();
+        }
+    }
+}
+
+void pull_many(PriorityBuffer<PriorityMessage>& buffer, int messages) {
+    for (int i = 0; i < messages; ) {
+        auto batch = buffer.PopMany(32);
+        if (batch.empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT_GE(32, batch.size());
+        for (auto& message : batch) {
+            EXPECT_TRUE(message->IsInitialized());
+            ++i;
+        }
+        for (size_t j = 1; j < batch.size(); ++j) {
+            EXPECT_GE(batch[j - 1]->priority(), batch[j]->priority());
+        }
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+typedef void (*Worker)(PriorityBuffer<PriorityMessage>&, int);
+
+// Two producers of NUMBER_MESSAGES_IN_TEST messages each, the first of them running producer,
+// against a consumer that takes all of them
+void produce_and_consume(PriorityBuffer<PriorityMessage>& buffer, Worker producer=push,
+                         Worker consumer=pull_block) {
+    std::thread pull_thread(consumer, std::ref(buffer), 2 * NUMBER_MESSAGES_IN_TEST);
+    std::thread push_thread(producer, std::ref(buffer), NUMBER_MESSAGES_IN_TEST);
+    std::thread other_push_thread(push, std::ref(buffer), NUMBER_MESSAGES_IN_TEST);
+
+    push_thread.join();
+    other_push_thread.join();
+    pull_thread.join();
+}
+
+// Lets a test hold the lock of the buffer, to see what gets done without it
+class LockableBuffer : public PriorityBuffer<PriorityMessage> {
+  public:
+    LockableBuffer() : PriorityBuffer<PriorityMessage>{get_priority} {}
+
+    std::mutex& GetMutex() {
+        return mutex_;
+    }
+};
+
+// Pushes count messages with one PushMany
+void push_batch(PriorityBuffer<PriorityMessage>& buffer, const int& count) {
+    std::vector<std::unique_ptr<PriorityMessage>> batch;
+    for (int i = 0; i < count; ++i) {
+        batch.emplace_back(new PriorityMessage{});
+        batch.back()->set_priority(i);
+    }
+    buffer.PushMany(batch.begin(), batch.end());
+}
+
 TEST_F(FSFixture, RandomMultithreadedTest) {
     PriorityBuffer<PriorityMessage> buffer{get_priority};
 
@@ -119,6 +207,457 @@ TEST_F(FSFixture, RandomMultithreadedWithBlockingBadFuzzTest) {
     EXPECT_LT(end - start, std::chrono::seconds(5));
 }
 
+TEST_F(FSFixture, RandomMultithreadedGroupCommitTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+    buffer.SetGroupCommit(1);
+    produce_and_consume(buffer);
+}
+
+TEST_F(FSFixture, RandomMultithreadedBackgroundSpillTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE, 5};
+    buffer.SetBackgroundSpill(true, 10);
+    std::thread push_thread(push, std::ref(buffer), NUMBER_MESSAGES_IN_TEST);
+    std::thread other_push_thread(push, std::ref(buffer), NUMBER_MESSAGES_IN_TEST);
+    push_thread.join();
+    other_push_thread.join();
+
+    // Neither producer got more than 10 spills ahead of the background thread, which then
+    // catches up on its own
+    EXPECT_LE(2 * NUMBER_MESSAGES_IN_TEST - 5 - 10, number_of_files_());
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (number_of_files_() < 2 * NUMBER_MESSAGES_IN_TEST - 5 &&
+            std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(2 * NUMBER_MESSAGES_IN_TEST - 5, number_of_files_());
+
+    unsigned long long priority = 100LL;
+    for (int i = 0; i < 2 * NUMBER_MESSAGES_IN_TEST; ++i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_GE(priority, message->priority());
+        priority = message->priority();
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, RandomMultithreadedSegmentTest) {
+    PriorityFSOptions fs_options;
+    fs_options.segment_size = 256;
+    PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE,
+                                           DEFAULT_MAX_MEMORY_SIZE, PriorityDBOptions{},
+                                           fs_options};
+    buffer.SetBackgroundSpill(true, 10);
+    buffer.SetPrefetch(10);
+    produce_and_consume(buffer);
+}
+
+TEST_F(FSFixture, SegmentCompactionTest) {
+    // Every record of a 2 byte message takes 14 bytes, so each segment holds ten of them
+    PriorityFSOptions fs_options;
+    fs_options.segment_size = 140;
+    PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE, 0,
+                                           PriorityDBOptions{}, fs_options};
+    for (int i = 1; i <= 30; ++i) {
+        auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+        message->set_priority(i);
+        buffer.Push(std::move(message));
+    }
+    auto segment_path = buffer_path_ / fs::path{"segments"};
+    auto number_of_segments = [&segment_path] {
+        fs::directory_iterator begin(segment_path), end;
+        return std::distance(begin, end);
+    };
+    ASSERT_EQ(3, number_of_segments());
+
+    // Once only 11 and 12 are left of the second segment they are moved to the active one
+    for (int i = 30; i >= 13; --i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+    EXPECT_EQ(2, number_of_segments());
+
+    for (int i = 12; i >= 1; --i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, RandomMultithreadedBatchIOTest) {
+    PriorityFSOptions fs_options;
+    fs_options.io_depth = 8;
+    fs_options.durability = PriorityFSOptions::Durability::BATCH;
+    PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE,
+                                           DEFAULT_MAX_MEMORY_SIZE, PriorityDBOptions{},
+                                           fs_options};
+    buffer.SetBackgroundSpill(true, 100);
+    buffer.SetPrefetch(10);
+    produce_and_consume(buffer);
+}
+
+TEST_F(FSFixture, RandomMultithreadedDeferredUnlinkTest) {
+    PriorityFSOptions fs_options;
+    fs_options.deferred_unlink = true;
+    PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE,
+                                           DEFAULT_MAX_MEMORY_SIZE, PriorityDBOptions{},
+                                           fs_options};
+    buffer.SetBackgroundSpill(true, 10);
+    produce_and_consume(buffer);
+}
+
+TEST_F(FSFixture, DeferredUnlinkDrainTest) {
+    PriorityFSOptions fs_options;
+    fs_options.deferred_unlink = true;
+    PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE, 0,
+                                           PriorityDBOptions{}, fs_options};
+    for (int i = 0; i < 100; ++i) {
+        auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+        message->set_priority(i);
+        buffer.Push(std::move(message));
+    }
+    ASSERT_EQ(100, number_of_files_());
+    for (int i = 99; i >= 0; --i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+
+    // The background thread unlinks the files of popped messages while the buffer is still in
+    // use, and then empties the log of them
+    auto unlinks_path = buffer_path_ / fs::path{"unlinks"};
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while ((number_of_files_() > 1 || fs::file_size(unlinks_path) > 0) &&
+            std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(1, number_of_files_());
+    EXPECT_EQ(0, fs::file_size(unlinks_path));
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, RandomMultithreadedShardedTest) {
+    fs::create_directory(buffer_path_);
+    ShardedPriorityBuffer<PriorityMessage> buffer{get_priority, 4, buffer_path_.native(),
+                                                  DEFAULT_MAX_BUFFER_SIZE,
+                                                  DEFAULT_MAX_MEMORY_SIZE};
+    auto push_sharded = [&buffer] () {
+        std::random_device generator;
+        std::uniform_int_distribution<unsigned long long> distribution(0, 100LL);
+        for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+            auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+            message->set_priority(distribution(generator));
+            buffer.Push(std::move(message));
+        }
+    };
+    auto pull_sharded = [&buffer] () {
+        for (int i = 0; i < 2 * NUMBER_MESSAGES_IN_TEST; ++i) {
+            auto message = buffer.Pop(true);
+            ASSERT_NE(nullptr, message);
+            EXPECT_TRUE(message->IsInitialized());
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.emplace_back(pull_sharded);
+    threads.emplace_back(pull_sharded);
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back(push_sharded);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, BackgroundSpillTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE, 5};
+    buffer.SetBackgroundSpill(true);
+    push(buffer, NUMBER_MESSAGES_IN_TEST);
+
+    // Spilling catches up on its own, without any further calls into the buffer
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (number_of_files_() < NUMBER_MESSAGES_IN_TEST - 5 &&
+            std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(NUMBER_MESSAGES_IN_TEST - 5, number_of_files_());
+
+    unsigned long long priority = 100LL;
+    for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_GE(priority, message->priority());
+        priority = message->priority();
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, BackgroundEvictTest) {
+    {
+        // Without a backlog, each Push waits for the background thread to keep up
+        PriorityBuffer<PriorityMessage> buffer{get_priority, 1, 5};
+        buffer.SetBackgroundSpill(true, 0);
+        push(buffer, NUMBER_MESSAGES_IN_TEST);
+    }
+    // What was left in memory is saved on destruction, next to at most a couple of files that
+    // the background thread had not evicted yet
+    EXPECT_GE(8, number_of_files_());
+}
+
+TEST_F(FSFixture, PrefetchTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE, 5};
+    for (int i = 0; i < 20; ++i) {
+        auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+        message->set_priority(i);
+        buffer.Push(std::move(message));
+    }
+    ASSERT_EQ(15, number_of_files_());
+
+    buffer.SetPrefetch(3);
+    for (int i = 19; i >= 15; --i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+
+    // The next three messages are read back from disk without another call into the buffer
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (number_of_files_() > 12 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(12, number_of_files_());
+
+    for (int i = 14; i >= 0; --i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, PrefetchMemoryBudgetTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE, 5};
+    for (int i = 1; i <= 20; ++i) {
+        auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+        message->set_priority(i);
+        buffer.Push(std::move(message));
+    }
+    ASSERT_EQ(15, number_of_files_());
+
+    // Each message takes 2 bytes, so only three of them fit into memory again
+    buffer.SetMemoryBudget(7, 2);
+    buffer.SetPrefetch(5);
+    for (int i = 20; i >= 16; --i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (number_of_files_() > 12 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(12, number_of_files_());
+
+    // A fourth promotion would have the lowest of them spilled straight back to disk
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    EXPECT_EQ(12, number_of_files_());
+
+    for (int i = 15; i >= 1; --i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, RandomMultithreadedPrefetchTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+    buffer.SetPrefetch(10);
+    buffer.SetBackgroundSpill(true);
+    produce_and_consume(buffer);
+}
+
+TEST_F(FSFixture, RandomMultithreadedIngressTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+    buffer.SetIngress(8);
+    produce_and_consume(buffer);
+}
+
+TEST_F(FSFixture, RandomMultithreadedIngressSpinTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+    buffer.SetIngress(8, PriorityIngressPolicy::SPIN);
+    buffer.SetBackgroundSpill(true);
+    produce_and_consume(buffer);
+}
+
+TEST_F(FSFixture, IngressLockedTest) {
+    LockableBuffer buffer;
+    buffer.SetIngress(8);
+    std::atomic<int> pushed{0};
+    std::unique_ptr<std::thread> push_thread;
+
+    // Pushes only need the lock of the buffer once the ring is full
+    {
+        std::lock_guard<std::mutex> lock(buffer.GetMutex());
+        push_thread.reset(new std::thread([&buffer, &pushed] {
+            for (int i = 1; i <= 9; ++i) {
+                auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+                message->set_priority(i);
+                buffer.Push(std::move(message));
+                ++pushed;
+            }
+        }));
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+        while (pushed < 8 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT_EQ(8, pushed);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        EXPECT_EQ(8, pushed);
+    }
+    push_thread->join();
+
+    for (int i = 9; i >= 1; --i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, RandomMultithreadedBatchTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+    produce_and_consume(buffer, push_many, pull_many);
+}
+
+TEST_F(FSFixture, RandomMultithreadedTimedPopTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+    produce_and_consume(buffer, push, pull_timed);
+}
+
+TEST_F(FSFixture, TimedPopCloseTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+    int popped = 0;
+    int timeouts = 0;
+    std::thread pull_thread([&buffer, &popped, &timeouts] {
+        PriorityMessage message;
+        while (true) {
+            auto start = std::chrono::steady_clock::now();
+            auto status = buffer.TryPopFor(message, std::chrono::milliseconds(20));
+            if (status == PriorityPopStatus::CLOSED) {
+                break;
+            } else if (status == PriorityPopStatus::TIMEOUT) {
+                EXPECT_LE(std::chrono::milliseconds(20),
+                          std::chrono::steady_clock::now() - start);
+                ++timeouts;
+            } else {
+                EXPECT_EQ(PriorityPopStatus::OK, status);
+                ++popped;
+            }
+        }
+    });
+
+    // The consumer times out on the empty buffer before any producer starts, takes everything
+    // they push, then waits until the buffer is closed
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::thread push_thread(push, std::ref(buffer), NUMBER_MESSAGES_IN_TEST);
+    std::thread other_push_thread(push, std::ref(buffer), NUMBER_MESSAGES_IN_TEST);
+    push_thread.join();
+    other_push_thread.join();
+    buffer.Close();
+    pull_thread.join();
+    EXPECT_EQ(2 * NUMBER_MESSAGES_IN_TEST, popped);
+    EXPECT_LE(2, timeouts);
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, CloseTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+    std::thread block_thread([&buffer] {
+        EXPECT_EQ(nullptr, buffer.Pop(true));
+    });
+    std::thread timed_thread([&buffer] {
+        PriorityMessage message;
+        EXPECT_EQ(PriorityPopStatus::CLOSED, buffer.TryPopFor(message, std::chrono::hours(1)));
+    });
+
+    // Both consumers are woken long before their waits would end on their own
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    auto start = std::chrono::steady_clock::now();
+    buffer.Close();
+    block_thread.join();
+    timed_thread.join();
+    EXPECT_GT(std::chrono::seconds(10), std::chrono::steady_clock::now() - start);
+}
+
+TEST_F(FSFixture, RandomMultithreadedManyConsumersTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+
+    // Batches wake only as many of the consumers as they have messages for, so none of them may
+    // be left parked while there is something to take
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&buffer] {
+            for (int j = 0; j < NUMBER_MESSAGES_IN_TEST / 2; ++j) {
+                auto message = buffer.Pop(true);
+                ASSERT_NE(nullptr, message);
+                EXPECT_TRUE(message->IsInitialized());
+            }
+        });
+    }
+    threads.emplace_back(push_many, std::ref(buffer), NUMBER_MESSAGES_IN_TEST);
+    threads.emplace_back(push, std::ref(buffer), NUMBER_MESSAGES_IN_TEST);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, ParkedConsumersTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+
+    std::mutex mutex;
+    std::vector<PriorityPopStatus> statuses;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&buffer, &mutex, &statuses] {
+            PriorityMessage message;
+            auto status = buffer.TryPopFor(message, std::chrono::hours(1));
+            std::lock_guard<std::mutex> lock(mutex);
+            statuses.push_back(status);
+        });
+    }
+    auto returned = [&mutex, &statuses] {
+        std::lock_guard<std::mutex> lock(mutex);
+        return statuses.size();
+    };
+    // Long past any spin, so that all of them are parked
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(0, returned());
+
+    // Two messages let two of the consumers return, and the other two stay parked
+    push_batch(buffer, 2);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (returned() < 2 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(2, returned());
+
+    // Until the buffer is closed
+    buffer.Close();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(2, std::count(statuses.begin(), statuses.end(), PriorityPopStatus::OK));
+    EXPECT_EQ(2, std::count(statuses.begin(), statuses.end(), PriorityPopStatus::CLOSED));
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     GOOGLE_PROTOBUF_VERIFY_VERSION;
@@ -1,14 +1,18 @@
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <iterator>
 #include <memory>
 #include <random>
 #include <string>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 
 #include "fsfixture.h"
 #include "priority.pb.h"
 #include "prioritybuffer.h"
+#include "shardedprioritybuffer.h"
 
 #ifndef NUMBER_MESSAGES_IN_TEST
 #define NUMBER_MESSAGES_IN_TEST 1000
@@ -43,10 +47,11 @@ TEST_F(FSFixture, RandomPriorityTest) {
 }
 
 TEST_F(FSFixture, MaxSizePriorityTest) {
-    // Each message takes 2 bytes to store. At NUMBER_MESSAGES_IN_TEST max byte size, we can store
-    // half of all messages on disk, and DEFAULT_MAX_MEMORY_SIZE messages in memory, for a total of
+    // Each message takes 14 bytes to store, 2 of its own and 12 for the header of its record. At
+    // 7 * NUMBER_MESSAGES_IN_TEST max byte size, we can store half of all messages on disk, and
+    // DEFAULT_MAX_MEMORY_SIZE messages in memory, for a total of
     // NUMBER_MESSAGES_IN_TEST / 2 + DEFAULT_MAX_MEMORY_SIZE.
-    PriorityBuffer<PriorityMessage> buffer{get_priority, NUMBER_MESSAGES_IN_TEST,
+    PriorityBuffer<PriorityMessage> buffer{get_priority, 7 * NUMBER_MESSAGES_IN_TEST,
                                            DEFAULT_MAX_MEMORY_SIZE};
     std::random_device generator;
     std::uniform_int_distribution<unsigned long long> distribution(0, 100LL);
@@ -71,10 +76,10 @@ TEST_F(FSFixture, MaxSizePriorityTest) {
 }
 
 TEST_F(FSFixture, NoMemoryPriorityTest) {
-    // Each message takes 2 bytes to store. At NUMBER_MESSAGES_IN_TEST max byte size, we can store
-    // half of all messages on disk, and 0 messages in memory, for a total of
-    // NUMBER_MESSAGES_IN_TEST / 2.
-    PriorityBuffer<PriorityMessage> buffer{get_priority, NUMBER_MESSAGES_IN_TEST, 0};
+    // Each message takes 14 bytes to store, 2 of its own and 12 for the header of its record. At
+    // 7 * NUMBER_MESSAGES_IN_TEST max byte size, we can store half of all messages on disk, and 0
+    // messages in memory, for a total of NUMBER_MESSAGES_IN_TEST / 2.
+    PriorityBuffer<PriorityMessage> buffer{get_priority, 7 * NUMBER_MESSAGES_IN_TEST, 0};
     std::random_device generator;
     std::uniform_int_distribution<unsigned long long> distribution(0, 100LL);
     for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
@@ -150,6 +155,565 @@ TEST_F(FSFixture, DiskDumpSomePriorityTest) {
     EXPECT_EQ(number_of_files_(), NUMBER_MESSAGES_IN_TEST - number_of_popped);
 }
 
+TEST_F(FSFixture, DirectoryLevelsPriorityTest) {
+    PriorityFSOptions fs_options;
+    fs_options.directory_levels = 2;
+    {
+        PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE,
+                                               DEFAULT_MAX_MEMORY_SIZE, PriorityDBOptions{},
+                                               fs_options};
+        for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+            auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+            message->set_priority(i);
+            buffer.Push(std::move(message));
+        }
+        // Only the layout record is left at the top
+        EXPECT_EQ(1, number_of_files_());
+    }
+
+    // Reopening without subdirectories moves every file back
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+    EXPECT_EQ(NUMBER_MESSAGES_IN_TEST, number_of_files_());
+    for (int i = NUMBER_MESSAGES_IN_TEST - 1; i >= 0; --i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, SegmentPriorityTest) {
+    PriorityFSOptions fs_options;
+    fs_options.segment_size = 64;
+    auto segment_path = buffer_path_ / fs::path{"segments"};
+    {
+        PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE,
+                                               DEFAULT_MAX_MEMORY_SIZE, PriorityDBOptions{},
+                                               fs_options};
+        std::random_device generator;
+        std::uniform_int_distribution<unsigned long long> distribution(0, 100LL);
+        for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+            auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+            message->set_priority(distribution(generator));
+            buffer.Push(std::move(message));
+        }
+        // Every message on disk is in a segment instead of a file of its own
+        EXPECT_EQ(0, number_of_files_());
+        EXPECT_LT(1, std::distance(fs::directory_iterator{segment_path},
+                                   fs::directory_iterator{}));
+
+        unsigned long long priority = 100LL;
+        for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+            auto message = buffer.Pop();
+            ASSERT_NE(nullptr, message);
+            EXPECT_GE(priority, message->priority());
+            priority = message->priority();
+        }
+        EXPECT_EQ(nullptr, buffer.Pop());
+    }
+
+    EXPECT_TRUE(fs::is_empty(segment_path));
+}
+
+TEST_F(FSFixture, SegmentReopenPriorityTest) {
+    PriorityFSOptions fs_options;
+    fs_options.segment_size = 64;
+    std::random_device generator;
+    std::uniform_int_distribution<unsigned long long> distribution(0, 100LL);
+    auto number_of_popped = distribution(generator);
+    {
+        PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE,
+                                               DEFAULT_MAX_MEMORY_SIZE, PriorityDBOptions{},
+                                               fs_options};
+        for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+            auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+            message->set_priority(distribution(generator));
+            buffer.Push(std::move(message));
+        }
+        for (int i = 0; i < number_of_popped; ++i) {
+            ASSERT_NE(nullptr, buffer.Pop());
+        }
+    }
+
+    // Messages in segments and in files of their own are read back alike
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+    unsigned long long priority = 100LL;
+    for (int i = number_of_popped; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_GE(priority, message->priority());
+        priority = message->priority();
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, SegmentCompactPriorityTest) {
+    // Popping every other priority leaves each segment half empty, which is rewritten
+    PriorityFSOptions fs_options;
+    fs_options.segment_size = 64;
+    fs_options.segment_compact_ratio = 0.75;
+    auto segment_path = buffer_path_ / fs::path{"segments"};
+    PriorityBuffer<PriorityMessage> buffer{[] (const PriorityMessage& message) {
+                                               return message.priority() % 2 ?
+                                                      message.priority() + 1000 :
+                                                      message.priority();
+                                           },
+                                           DEFAULT_MAX_BUFFER_SIZE, 0, PriorityDBOptions{},
+                                           fs_options};
+    for (int i = 0; i < 200; ++i) {
+        auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+        message->set_priority(i);
+        buffer.Push(std::move(message));
+    }
+    auto segments = std::distance(fs::directory_iterator{segment_path}, fs::directory_iterator{});
+    for (int i = 199; i >= 0; i -= 2) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+    EXPECT_GT(segments, std::distance(fs::directory_iterator{segment_path},
+                                      fs::directory_iterator{}));
+
+    for (int i = 198; i >= 0; i -= 2) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, BatchSpillPriorityTest) {
+    // Draining the memory budget down to nothing spills everything in memory in one batch
+    PriorityFSOptions fs_options;
+    fs_options.io_depth = 4;
+    PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE,
+                                           NUMBER_MESSAGES_IN_TEST, PriorityDBOptions{},
+                                           fs_options};
+    buffer.SetMemoryBudget(100, 0);
+    std::random_device generator;
+    std::uniform_int_distribution<unsigned long long> distribution(0, 100LL);
+    for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+        auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+        message->set_priority(distribution(generator));
+        buffer.Push(std::move(message));
+    }
+    EXPECT_LT(NUMBER_MESSAGES_IN_TEST - 50, number_of_files_());
+
+    unsigned long long priority = 100LL;
+    for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_GE(priority, message->priority());
+        priority = message->priority();
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, DeferredUnlinkPriorityTest) {
+    PriorityFSOptions fs_options;
+    fs_options.deferred_unlink = true;
+    {
+        PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE,
+                                               DEFAULT_MAX_MEMORY_SIZE, PriorityDBOptions{},
+                                               fs_options};
+        std::random_device generator;
+        std::uniform_int_distribution<unsigned long long> distribution(0, 100LL);
+        for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+            auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+            message->set_priority(distribution(generator));
+            buffer.Push(std::move(message));
+        }
+
+        unsigned long long priority = 100LL;
+        for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+            auto message = buffer.Pop();
+            ASSERT_NE(nullptr, message);
+            EXPECT_GE(priority, message->priority());
+            priority = message->priority();
+        }
+        EXPECT_EQ(nullptr, buffer.Pop());
+    }
+    EXPECT_EQ(0, number_of_files_());
+}
+
+TEST_F(FSFixture, BatchDurabilityPriorityTest) {
+    PriorityFSOptions fs_options;
+    fs_options.durability = PriorityFSOptions::Durability::BATCH;
+    fs_options.batch_messages = 10;
+    fs_options.sync_directories = true;
+    {
+        PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE,
+                                               DEFAULT_MAX_MEMORY_SIZE, PriorityDBOptions{},
+                                               fs_options};
+        for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+            auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+            message->set_priority(i);
+            buffer.Push(std::move(message));
+        }
+    }
+
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+    for (int i = NUMBER_MESSAGES_IN_TEST - 1; i >= 0; --i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, ShardedPriorityTest) {
+    fs::create_directory(buffer_path_);
+    ShardedPriorityBuffer<PriorityMessage> buffer{get_priority, 4, buffer_path_.native(),
+                                                  DEFAULT_MAX_BUFFER_SIZE,
+                                                  DEFAULT_MAX_MEMORY_SIZE};
+    EXPECT_EQ(4, buffer.GetShards());
+    std::random_device generator;
+    std::uniform_int_distribution<unsigned long long> distribution(0, 100LL);
+    for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+        auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+        message->set_priority(distribution(generator));
+        buffer.Push(std::move(message));
+    }
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(fs::exists(buffer_path_ / fs::path{"prism_shard_" + std::to_string(i)}));
+    }
+
+    unsigned long long priority = 100LL;
+    for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_GE(priority, message->priority());
+        priority = message->priority();
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, ShardedMaxSizePriorityTest) {
+    // As in MaxSizePriorityTest, but with the disk and memory limits shared by 4 shards, each of
+    // which gets a quarter of the messages
+    fs::create_directory(buffer_path_);
+    ShardedPriorityBuffer<PriorityMessage> buffer{get_priority, 4, buffer_path_.native(),
+                                                  7 * NUMBER_MESSAGES_IN_TEST,
+                                                  DEFAULT_MAX_MEMORY_SIZE};
+    std::random_device generator;
+    std::uniform_int_distribution<unsigned long long> distribution(0, 100LL);
+    for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+        auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+        message->set_priority(distribution(generator));
+        buffer.Push(std::move(message));
+    }
+    unsigned long long priority = 100LL;
+    for (int i = 0; i < NUMBER_MESSAGES_IN_TEST / 2 + DEFAULT_MAX_MEMORY_SIZE; ++i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_GE(priority, message->priority());
+        priority = message->priority();
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, ShardedReopenPriorityTest) {
+    fs::create_directory(buffer_path_);
+    {
+        ShardedPriorityBuffer<PriorityMessage> buffer{get_priority, 3, buffer_path_.native(),
+                                                      DEFAULT_MAX_BUFFER_SIZE, 0};
+        for (int i = 0; i < 30; ++i) {
+            PriorityMessage message;
+            message.set_priority(i);
+            buffer.Push(std::move(message));
+            EXPECT_FALSE(message.has_priority());
+        }
+    }
+
+    ShardedPriorityBuffer<PriorityMessage> buffer{get_priority, 3, buffer_path_.native(),
+                                                  DEFAULT_MAX_BUFFER_SIZE, 0};
+    for (int i = 29; i >= 0; --i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, ShardedDiskBudgetPriorityTest) {
+    // Every message takes 14 bytes on disk, so the shards hold 10 of them together
+    fs::create_directory(buffer_path_);
+    ShardedPriorityBuffer<PriorityMessage> buffer{get_priority, 2, buffer_path_.native(), 140, 0};
+    for (int i = 1; i <= 5; ++i) {
+        PriorityMessage low, high;
+        low.set_priority(i);
+        high.set_priority(99 + i);
+        buffer.Push(std::move(low));
+        buffer.Push(std::move(high));
+    }
+    for (int i = 104; i >= 100; --i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+
+    // The first shard takes more than half of the disk, which is fine as long as the second
+    // leaves it room. Only the eleventh message has one evicted, the lowest of all, even though
+    // it went to the second shard.
+    for (int i = 6; i <= 11; ++i) {
+        PriorityMessage message;
+        message.set_priority(i);
+        buffer.Push(std::move(message));
+    }
+    for (int i = 11; i >= 2; --i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, ShardedLowestEvictedPriorityTest) {
+    // The first shard only ever gets the higher half of the messages, which all fit on disk
+    fs::create_directory(buffer_path_);
+    ShardedPriorityBuffer<PriorityMessage> buffer{get_priority, 2, buffer_path_.native(), 140, 0};
+    for (int i = 1; i <= 10; ++i) {
+        PriorityMessage high, low;
+        high.set_priority(100 + i);
+        low.set_priority(i);
+        buffer.Push(std::move(high));
+        buffer.Push(std::move(low));
+    }
+    for (int i = 110; i >= 101; --i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+// Message files in each of the shards under buffer_path
+std::vector<int> number_of_shard_files(const fs::path& buffer_path, const int& shards) {
+    std::vector<int> files;
+    for (int i = 0; i < shards; ++i) {
+        auto shard_path = buffer_path / fs::path{"prism_shard_" + std::to_string(i)};
+        files.push_back(std::count_if(fs::directory_iterator{shard_path},
+                                      fs::directory_iterator{},
+                [] (const fs::directory_entry& f) {
+                    return !(fs::is_directory(f.path()) ||
+                             f.path().filename().native().substr(0, 10) == "prism_data");
+                }));
+    }
+    return files;
+}
+
+TEST_F(FSFixture, ShardedLowestSpilledPriorityTest) {
+    // Half of the messages fit in memory, which the first shard's all do
+    fs::create_directory(buffer_path_);
+    ShardedPriorityBuffer<PriorityMessage> buffer{get_priority, 2, buffer_path_.native(),
+                                                  DEFAULT_MAX_BUFFER_SIZE, 4};
+    for (int i = 1; i <= 4; ++i) {
+        PriorityMessage high, low;
+        high.set_priority(100 + i);
+        low.set_priority(i);
+        buffer.Push(std::move(high));
+        buffer.Push(std::move(low));
+    }
+    EXPECT_EQ((std::vector<int>{0, 4}), number_of_shard_files(buffer_path_, 2));
+}
+
+TEST_F(FSFixture, ShardedMemoryBudgetPriorityTest) {
+    fs::create_directory(buffer_path_);
+    auto number_of_files = [this] () {
+        auto files = number_of_shard_files(buffer_path_, 2);
+        return files[0] + files[1];
+    };
+    ShardedPriorityBuffer<PriorityMessage> buffer{get_priority, 2, buffer_path_.native(),
+                                                  DEFAULT_MAX_BUFFER_SIZE, 4};
+    for (int i = 1; i <= 2; ++i) {
+        PriorityMessage low, high;
+        low.set_priority(i);
+        high.set_priority(99 + i);
+        buffer.Push(std::move(low));
+        buffer.Push(std::move(high));
+    }
+    for (int i = 101; i >= 100; --i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+
+    // Three of the four messages in memory are in the first shard
+    for (int i = 3; i <= 4; ++i) {
+        PriorityMessage message;
+        message.set_priority(i);
+        buffer.Push(std::move(message));
+    }
+    EXPECT_EQ(0, number_of_files());
+    PriorityMessage message;
+    message.set_priority(5);
+    buffer.Push(std::move(message));
+    EXPECT_EQ(1, number_of_files());
+
+    for (int i = 5; i >= 1; --i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, IngressPriorityTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+    buffer.SetIngress(16);
+    std::random_device generator;
+    std::uniform_int_distribution<unsigned long long> distribution(0, 100LL);
+    for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+        auto message = std::unique_ptr<PriorityMessage>{ new PriorityMessage{} };
+        message->set_priority(distribution(generator));
+        buffer.Push(std::move(message));
+    }
+
+    // Whatever the drainer has not moved yet is taken from the ring by Pop
+    unsigned long long priority = 100LL;
+    for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_GE(priority, message->priority());
+        priority = message->priority();
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, IngressReopenPriorityTest) {
+    {
+        PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE, 5};
+        buffer.SetIngress(4, PriorityIngressPolicy::SPILL);
+        for (int i = 0; i < 30; ++i) {
+            PriorityMessage message;
+            message.set_priority(i);
+            buffer.Push(std::move(message));
+        }
+    }
+
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+    for (int i = 29; i >= 0; --i) {
+        auto message = buffer.Pop();
+        ASSERT_NE(nullptr, message);
+        EXPECT_EQ(i, message->priority());
+    }
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, PushManyPopManyPriorityTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+    std::random_device generator;
+    std::uniform_int_distribution<unsigned long long> distribution(0, 100LL);
+    std::vector<std::unique_ptr<PriorityMessage>> messages;
+    for (int i = 0; i < NUMBER_MESSAGES_IN_TEST; ++i) {
+        messages.emplace_back(new PriorityMessage{});
+        messages.back()->set_priority(distribution(generator));
+    }
+    buffer.PushMany(messages.begin(), messages.end());
+    for (auto& message : messages) {
+        EXPECT_EQ(nullptr, message);
+    }
+    EXPECT_EQ(NUMBER_MESSAGES_IN_TEST - DEFAULT_MAX_MEMORY_SIZE, number_of_files_());
+
+    // Batches come out in priority order, both within and across them
+    unsigned long long priority = 100LL;
+    int popped = 0;
+    for (auto batch = buffer.PopMany(64); !batch.empty(); batch = buffer.PopMany(64)) {
+        EXPECT_GE(64, batch.size());
+        for (auto& message : batch) {
+            ASSERT_NE(nullptr, message);
+            EXPECT_GE(priority, message->priority());
+            priority = message->priority();
+            ++popped;
+        }
+    }
+    EXPECT_EQ(NUMBER_MESSAGES_IN_TEST, popped);
+    EXPECT_EQ(nullptr, buffer.Pop());
+}
+
+TEST_F(FSFixture, PopManyBytesPriorityTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+    for (int i = 1; i <= 10; ++i) {
+        PriorityMessage message;
+        message.set_priority(i);
+        buffer.Push(std::move(message));
+    }
+    EXPECT_TRUE(buffer.PopMany(0).empty());
+
+    // Each of these messages takes 2 bytes
+    auto batch = buffer.PopMany(10, 7);
+    ASSERT_EQ(3, batch.size());
+    EXPECT_EQ(10, batch[0]->priority());
+    EXPECT_EQ(9, batch[1]->priority());
+    EXPECT_EQ(8, batch[2]->priority());
+
+    // The first message is taken even if it doesn't fit
+    batch = buffer.PopMany(10, 1);
+    ASSERT_EQ(1, batch.size());
+    EXPECT_EQ(7, batch[0]->priority());
+
+    batch = buffer.PopMany(10);
+    ASSERT_EQ(6, batch.size());
+    EXPECT_EQ(1, batch[5]->priority());
+}
+
+TEST_F(FSFixture, PopManyCountPriorityTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority, DEFAULT_MAX_BUFFER_SIZE, 10};
+    std::vector<std::unique_ptr<PriorityMessage>> messages;
+    for (int i = 1; i <= 30; ++i) {
+        messages.emplace_back(new PriorityMessage{});
+        messages.back()->set_priority(i);
+    }
+    buffer.PushMany(messages.begin(), messages.end());
+    EXPECT_EQ(20, number_of_files_());
+
+    // Every batch but the last is full, whether its messages are in memory or on disk
+    int priority = 30;
+    for (int i = 0; i < 4; ++i) {
+        auto batch = buffer.PopMany(8);
+        ASSERT_EQ(i < 3 ? 8 : 6, batch.size());
+        for (auto& message : batch) {
+            ASSERT_NE(nullptr, message);
+            EXPECT_EQ(priority--, message->priority());
+        }
+    }
+    EXPECT_TRUE(buffer.PopMany(8).empty());
+    EXPECT_EQ(0, number_of_files_());
+}
+
+TEST_F(FSFixture, TryPopPriorityTest) {
+    PriorityBuffer<PriorityMessage> buffer{get_priority};
+    PriorityMessage message;
+    EXPECT_EQ(PriorityPopStatus::EMPTY, buffer.TryPop(message));
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(PriorityPopStatus::TIMEOUT,
+              buffer.TryPopFor(message, std::chrono::milliseconds(20)));
+    EXPECT_LE(std::chrono::milliseconds(20), std::chrono::steady_clock::now() - start);
+
+    for (auto priority : {1, 3, 2}) {
+        PriorityMessage pushed;
+        pushed.set_priority(priority);
+        buffer.Push(std::move(pushed));
+    }
+    EXPECT_EQ(PriorityPopStatus::OK, buffer.TryPop(message));
+    EXPECT_EQ(3, message.priority());
+    EXPECT_EQ(PriorityPopStatus::OK, buffer.TryPopFor(message, std::chrono::seconds(1)));
+    EXPECT_EQ(2, message.priority());
+    EXPECT_EQ(PriorityPopStatus::OK,
+              buffer.PopUntil(message, std::chrono::system_clock::now() + std::chrono::seconds(1)));
+    EXPECT_EQ(1, message.priority());
+
+    // Once closed, an empty buffer no longer waits, but still takes messages
+    buffer.Close();
+    EXPECT_EQ(PriorityPopStatus::CLOSED, buffer.TryPopFor(message, std::chrono::hours(1)));
+    EXPECT_EQ(nullptr, buffer.Pop(true));
+    PriorityMessage pushed;
+    pushed.set_priority(4);
+    buffer.Push(std::move(pushed));
+    EXPECT_EQ(PriorityPopStatus::OK, buffer.TryPop(message));
+    EXPECT_EQ(4, message.priority());
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     GOOGLE_PROTOBUF_VERIFY_VERSION;